@@ -0,0 +1,195 @@
+// Config parser benchmark. Generates configs with many accounts and reports parse and serialize
+// times, and the parse throughput of several threads parsing concurrently. Runs in-process and
+// needs neither a display nor a session bus.
+
+#include "harness.h"
+#include "src/config.h"
+#include "src/presets.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+typedef struct MelangeBenchParseThread {
+    const char *data;
+    gsize length;
+    guint iterations;
+    guint n_accounts;
+    gboolean ok;
+} MelangeBenchParseThread;
+
+
+// Two thirds preset accounts, one third custom ones with all details spelled out
+static char *
+melange_bench_configparse_generate(guint n_accounts) {
+    MelangeConfig *config = melange_config_new();
+    config->hibernate_after = 30;
+    for (guint i = 0; i < n_accounts; ++i) {
+        MelangeAccount *account;
+        if (i % 3 != 2) {
+            const MelangeAccount *preset = &melange_account_presets[i % melange_n_account_presets];
+            account = melange_account_new_from_preset(
+                    melange_config_new_account_id(config, preset->id), preset);
+        } else {
+            account = melange_account_new(melange_config_new_account_id(config, "custom"),
+                    g_strdup_printf("Custom %u", i),
+                    g_strdup_printf("https://chat%u.example.org/app/", i),
+                    g_strdup_printf("https://chat%u.example.org/favicon.ico", i),
+                    g_strdup("Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36"));
+            account->keep_alive = i % 2;
+        }
+        melange_config_add_account(config, account);
+    }
+
+    char *data = melange_config_serialize(config);
+    melange_config_free(config);
+    return data;
+}
+
+
+static gboolean
+melange_bench_configparse_check(MelangeConfig *config, guint n_accounts, GError *error) {
+    if (!config) {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    gboolean ok = config->accounts->len == n_accounts;
+    if (!ok) {
+        g_printerr("Parsed %u instead of %u accounts\n", config->accounts->len, n_accounts);
+    }
+    melange_config_free(config);
+    return ok;
+}
+
+
+static gpointer
+melange_bench_configparse_thread(gpointer user_data) {
+    MelangeBenchParseThread *thread = user_data;
+    thread->ok = TRUE;
+    for (guint i = 0; i < thread->iterations && thread->ok; ++i) {
+        GError *error = NULL;
+        MelangeConfig *config = melange_config_new_from_data(thread->data, thread->length,
+                "bench.conf", &error);
+        thread->ok = melange_bench_configparse_check(config, thread->n_accounts, error);
+    }
+    return NULL;
+}
+
+
+static gboolean
+melange_bench_configparse_run(guint n_accounts, guint iterations, guint n_threads) {
+    char *data = melange_bench_configparse_generate(n_accounts);
+    gsize length = strlen(data);
+
+    gint64 *parse_times = g_malloc(iterations * sizeof *parse_times);
+    gint64 *serialize_times = g_malloc(iterations * sizeof *serialize_times);
+    gboolean ok = TRUE;
+    for (guint i = 0; i < iterations && ok; ++i) {
+        GError *error = NULL;
+        gint64 begin = g_get_monotonic_time();
+        MelangeConfig *config = melange_config_new_from_data(data, length, "bench.conf", &error);
+        parse_times[i] = g_get_monotonic_time() - begin;
+
+        if (config) {
+            begin = g_get_monotonic_time();
+            g_free(melange_config_serialize(config));
+            serialize_times[i] = g_get_monotonic_time() - begin;
+        }
+        ok = melange_bench_configparse_check(config, n_accounts, error);
+    }
+    if (!ok) {
+        g_free(serialize_times);
+        g_free(parse_times);
+        g_free(data);
+        return FALSE;
+    }
+    qsort(parse_times, iterations, sizeof *parse_times, melange_bench_compare_gint64);
+    qsort(serialize_times, iterations, sizeof *serialize_times, melange_bench_compare_gint64);
+
+    // Every thread parses the same buffer, which must give the same result as a single thread
+    MelangeBenchParseThread *threads = g_malloc(n_threads * sizeof *threads);
+    GThread **handles = g_malloc(n_threads * sizeof *handles);
+    gint64 begin = g_get_monotonic_time();
+    for (guint t = 0; t < n_threads; ++t) {
+        threads[t] = (MelangeBenchParseThread) {
+                .data = data,
+                .length = length,
+                .iterations = iterations,
+                .n_accounts = n_accounts,
+        };
+        handles[t] = g_thread_new("parse", melange_bench_configparse_thread, &threads[t]);
+    }
+    for (guint t = 0; t < n_threads; ++t) {
+        g_thread_join(handles[t]);
+        ok &= threads[t].ok;
+    }
+    gint64 concurrent_time = g_get_monotonic_time() - begin;
+
+    double p50 = (double) parse_times[iterations / 2] / 1000.0;
+    printf("%8u %10.1f %10.2f %10.2f %9.2f %10.1f %10.2f %13.1f\n",
+            n_accounts,
+            (double) length / 1024.0,
+            p50,
+            (double) parse_times[0] / 1000.0,
+            (double) parse_times[iterations / 2] / n_accounts,
+            (double) length / 1048576.0 / (p50 / 1000.0),
+            (double) serialize_times[iterations / 2] / 1000.0,
+            (double) (n_threads * iterations) * (double) length / 1048576.0
+                    / ((double) concurrent_time / 1e6));
+    fflush(stdout);
+
+    g_free(handles);
+    g_free(threads);
+    g_free(serialize_times);
+    g_free(parse_times);
+    g_free(data);
+    return ok;
+}
+
+
+int
+main(int argc, char **argv) {
+    char *accounts = NULL;
+    int iterations = 10;
+    int n_threads = 4;
+
+    GOptionEntry entries[] = {
+            { "accounts", 'n', 0, G_OPTION_ARG_STRING, &accounts,
+                    "Comma-separated account counts (default 10,100,1000,10000)", "N,..." },
+            { "iterations", 'i', 0, G_OPTION_ARG_INT, &iterations,
+                    "Parses per account count and thread (default 10)", "N" },
+            { "threads", 'j', 0, G_OPTION_ARG_INT, &n_threads,
+                    "Threads parsing concurrently (default 4)", "N" },
+            { NULL, 0, 0, 0, NULL, NULL, NULL },
+    };
+
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("- melange config parser benchmark");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error) || iterations < 1
+            || n_threads < 1) {
+        g_printerr("%s\n", error ? error->message : "Need at least one iteration and thread");
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    char **counts = g_strsplit(accounts ? accounts : "10,100,1000,10000", ",", -1);
+    printf("%d iterations, %d threads\n", iterations, n_threads);
+    printf("accounts size [KiB]   p50 [ms]   min [ms]   us/acct  p50 MiB/s  ser. [ms] "
+            "threads MiB/s\n");
+
+    gboolean ok = TRUE;
+    for (char **count = counts; *count; ++count) {
+        guint n_accounts = (guint) g_ascii_strtoull(*count, NULL, 10);
+        if (n_accounts > 0) {
+            ok &= melange_bench_configparse_run(n_accounts, (guint) iterations,
+                    (guint) n_threads);
+        }
+    }
+
+    g_strfreev(counts);
+    g_free(accounts);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,500 @@
+#include "harness.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+// Time the instance gets to shut down and write its trace after SIGTERM
+#define MELANGE_BENCH_STOP_TIMEOUT 15000
+
+
+struct MelangeBenchInstance {
+    GSubprocess *process;
+    gint64 start_time;
+    char *base_dir;
+    char *trace_file_name;
+    gboolean exited;
+    GPtrArray *trace;
+};
+
+
+static void
+melange_bench_trace_event_free(MelangeBenchTraceEvent *event) {
+    g_free(event->name);
+    g_free(event->detail);
+    g_free(event);
+}
+
+
+static void
+melange_bench_remove_recursively(const char *path) {
+    if (g_file_test(path, G_FILE_TEST_IS_DIR) && !g_file_test(path, G_FILE_TEST_IS_SYMLINK)) {
+        GDir *dir = g_dir_open(path, 0, NULL);
+        if (dir) {
+            const char *name;
+            while ((name = g_dir_read_name(dir))) {
+                char *child = g_build_filename(path, name, NULL);
+                melange_bench_remove_recursively(child);
+                g_free(child);
+            }
+            g_dir_close(dir);
+        }
+        g_rmdir(path);
+    } else {
+        g_remove(path);
+    }
+}
+
+
+MelangeBenchInstance *
+melange_bench_instance_new(const char *binary, const char *config, GError **error) {
+    char *base_dir = g_dir_make_tmp("melange-bench-XXXXXX", error);
+    if (!base_dir) return NULL;
+
+    char *config_home = g_build_filename(base_dir, "config", NULL);
+    char *data_home = g_build_filename(base_dir, "data", NULL);
+    char *cache_home = g_build_filename(base_dir, "cache", NULL);
+    char *config_dir = g_build_filename(config_home, "melange", NULL);
+    char *config_file_name = g_build_filename(config_dir, "config", NULL);
+    char *trace_file_name = g_build_filename(base_dir, "trace.json", NULL);
+    char *trace_spec = g_strconcat("chrome:", trace_file_name, NULL);
+
+    MelangeBenchInstance *instance = NULL;
+    GSubprocessLauncher *launcher = NULL;
+    g_mkdir_with_parents(config_dir, 0700);
+    if (!g_file_set_contents(config_file_name, config, -1, error)) goto cleanup;
+
+    GSubprocessFlags flags = G_SUBPROCESS_FLAGS_NONE;
+    if (!g_getenv("MELANGE_BENCH_VERBOSE")) {
+        flags |= G_SUBPROCESS_FLAGS_STDOUT_SILENCE | G_SUBPROCESS_FLAGS_STDERR_SILENCE;
+    }
+    launcher = g_subprocess_launcher_new(flags);
+    g_subprocess_launcher_setenv(launcher, "XDG_CONFIG_HOME", config_home, TRUE);
+    g_subprocess_launcher_setenv(launcher, "XDG_DATA_HOME", data_home, TRUE);
+    g_subprocess_launcher_setenv(launcher, "XDG_CACHE_HOME", cache_home, TRUE);
+    g_subprocess_launcher_setenv(launcher, "MELANGE_TRACE", trace_spec, TRUE);
+
+    gint64 start_time = g_get_monotonic_time();
+    GSubprocess *process = g_subprocess_launcher_spawn(launcher, error, binary, NULL);
+    if (!process) goto cleanup;
+
+    MelangeBenchInstance instance_template = {
+            .process = process,
+            .start_time = start_time,
+            .base_dir = base_dir,
+            .trace_file_name = trace_file_name,
+            .exited = FALSE,
+            .trace = g_ptr_array_new_with_free_func(
+                    (GDestroyNotify) melange_bench_trace_event_free),
+    };
+    instance = g_memdup(&instance_template, sizeof instance_template);
+    base_dir = NULL;
+    trace_file_name = NULL;
+
+    cleanup:
+    if (launcher) g_object_unref(launcher);
+    if (base_dir) melange_bench_remove_recursively(base_dir);
+    g_free(base_dir);
+    g_free(trace_file_name);
+    g_free(trace_spec);
+    g_free(config_file_name);
+    g_free(config_dir);
+    g_free(cache_home);
+    g_free(data_home);
+    g_free(config_home);
+    return instance;
+}
+
+
+void
+melange_bench_instance_free(MelangeBenchInstance *instance) {
+    if (!instance) return;
+
+    if (!instance->exited) {
+        melange_bench_instance_stop(instance);
+    }
+    g_object_unref(instance->process);
+    melange_bench_remove_recursively(instance->base_dir);
+    g_free(instance->base_dir);
+    g_free(instance->trace_file_name);
+    g_ptr_array_free(instance->trace, TRUE);
+    g_free(instance);
+}
+
+
+gint64
+melange_bench_instance_get_start_time(MelangeBenchInstance *instance) {
+    return instance->start_time;
+}
+
+
+static gboolean
+melange_bench_read_parent_pid(const char *pid, int *ppid) {
+    char *file_name = g_build_filename("/proc", pid, "stat", NULL);
+    char *stat = NULL;
+    gboolean ok = g_file_get_contents(file_name, &stat, NULL, NULL);
+    g_free(file_name);
+    if (!ok) return FALSE;
+
+    // The command name in parentheses may itself contain spaces and parentheses
+    const char *after_comm = strrchr(stat, ')');
+    char state;
+    ok = after_comm && sscanf(after_comm + 1, " %c %d", &state, ppid) == 2;
+    g_free(stat);
+    return ok;
+}
+
+
+static void
+melange_bench_add_process_memory(int pid, MelangeBenchMemory *memory) {
+    char *file_name = g_strdup_printf("/proc/%d/smaps_rollup", pid);
+    char *smaps = NULL;
+    if (g_file_get_contents(file_name, &smaps, NULL, NULL)) {
+        char **lines = g_strsplit(smaps, "\n", -1);
+        for (char **line = lines; *line; ++line) {
+            guint64 kib;
+            if (sscanf(*line, "Rss: %" G_GUINT64_FORMAT " kB", &kib) == 1) {
+                memory->rss_kib += kib;
+            } else if (sscanf(*line, "Pss: %" G_GUINT64_FORMAT " kB", &kib) == 1) {
+                memory->pss_kib += kib;
+            }
+        }
+        g_strfreev(lines);
+        g_free(smaps);
+    }
+    g_free(file_name);
+    ++memory->n_processes;
+}
+
+
+// Returns the pids of the instance process and all of its descendants
+static GArray *
+melange_bench_instance_list_processes(MelangeBenchInstance *instance) {
+    // Collect (pid, ppid) pairs of all processes
+    GArray *pids = g_array_new(FALSE, FALSE, sizeof(int));
+    GArray *ppids = g_array_new(FALSE, FALSE, sizeof(int));
+    GDir *proc = g_dir_open("/proc", 0, NULL);
+    if (proc) {
+        const char *name;
+        while ((name = g_dir_read_name(proc))) {
+            int ppid;
+            if (g_ascii_isdigit(*name) && melange_bench_read_parent_pid(name, &ppid)) {
+                int pid = atoi(name);
+                g_array_append_val(pids, pid);
+                g_array_append_val(ppids, ppid);
+            }
+        }
+        g_dir_close(proc);
+    }
+
+    // Web processes may be spawned through helpers like bwrap, so follow the whole tree
+    GHashTable *tree = g_hash_table_new(g_direct_hash, g_direct_equal);
+    int root = atoi(g_subprocess_get_identifier(instance->process));
+    g_hash_table_add(tree, GINT_TO_POINTER(root));
+    for (gboolean grown = TRUE; grown;) {
+        grown = FALSE;
+        for (guint i = 0; i < pids->len; ++i) {
+            int pid = g_array_index(pids, int, i);
+            int ppid = g_array_index(ppids, int, i);
+            if (!g_hash_table_contains(tree, GINT_TO_POINTER(pid))
+                    && g_hash_table_contains(tree, GINT_TO_POINTER(ppid))) {
+                g_hash_table_add(tree, GINT_TO_POINTER(pid));
+                grown = TRUE;
+            }
+        }
+    }
+
+    GArray *processes = g_array_new(FALSE, FALSE, sizeof(int));
+    GHashTableIter iter;
+    gpointer pid;
+    g_hash_table_iter_init(&iter, tree);
+    while (g_hash_table_iter_next(&iter, &pid, NULL)) {
+        int process = GPOINTER_TO_INT(pid);
+        g_array_append_val(processes, process);
+    }
+
+    g_hash_table_destroy(tree);
+    g_array_free(ppids, TRUE);
+    g_array_free(pids, TRUE);
+    return processes;
+}
+
+
+void
+melange_bench_instance_sample_memory(MelangeBenchInstance *instance, MelangeBenchMemory *memory) {
+    memset(memory, 0, sizeof *memory);
+
+    GArray *processes = melange_bench_instance_list_processes(instance);
+    for (guint i = 0; i < processes->len; ++i) {
+        melange_bench_add_process_memory(g_array_index(processes, int, i), memory);
+    }
+    g_array_free(processes, TRUE);
+}
+
+
+// User and system time of one process in clock ticks
+static guint64
+melange_bench_get_process_cpu_ticks(int pid) {
+    char *file_name = g_strdup_printf("/proc/%d/stat", pid);
+    char *stat = NULL;
+    guint64 ticks = 0;
+    if (g_file_get_contents(file_name, &stat, NULL, NULL)) {
+        // Fields after the command name, starting with field 3 (state). utime and stime are
+        // fields 14 and 15.
+        const char *after_comm = strrchr(stat, ')');
+        char **fields = after_comm ? g_strsplit(after_comm + 2, " ", -1) : NULL;
+        if (fields && g_strv_length(fields) > 12) {
+            ticks = g_ascii_strtoull(fields[11], NULL, 10) + g_ascii_strtoull(fields[12], NULL, 10);
+        }
+        g_strfreev(fields);
+        g_free(stat);
+    }
+    g_free(file_name);
+    return ticks;
+}
+
+
+gint64
+melange_bench_instance_get_cpu_time(MelangeBenchInstance *instance) {
+    guint64 ticks = 0;
+    GArray *processes = melange_bench_instance_list_processes(instance);
+    for (guint i = 0; i < processes->len; ++i) {
+        ticks += melange_bench_get_process_cpu_ticks(g_array_index(processes, int, i));
+    }
+    g_array_free(processes, TRUE);
+    return (gint64) (ticks * G_USEC_PER_SEC / (guint64) sysconf(_SC_CLK_TCK));
+}
+
+
+gint64
+melange_bench_instance_get_ui_cpu_time(MelangeBenchInstance *instance) {
+    guint64 ticks = melange_bench_get_process_cpu_ticks(
+            atoi(g_subprocess_get_identifier(instance->process)));
+    return (gint64) (ticks * G_USEC_PER_SEC / (guint64) sysconf(_SC_CLK_TCK));
+}
+
+
+static gboolean
+melange_bench_instance_has_exited(gpointer user_data) {
+    return ((MelangeBenchInstance *) user_data)->exited;
+}
+
+
+static void
+melange_bench_instance_wait_finished(GObject *source, GAsyncResult *result, gpointer user_data) {
+    g_subprocess_wait_finish(G_SUBPROCESS(source), result, NULL);
+    ((MelangeBenchInstance *) user_data)->exited = TRUE;
+}
+
+
+// Reads the one-event-per-line JSON written by src/trace.c
+static gboolean
+melange_bench_instance_parse_trace(MelangeBenchInstance *instance) {
+    char *json = NULL;
+    if (!g_file_get_contents(instance->trace_file_name, &json, NULL, NULL)) {
+        return FALSE;
+    }
+
+    GRegex *epoch_regex = g_regex_new("\"monotonic-epoch\":\"(-?\\d+)\"", 0, 0, NULL);
+    GRegex *event_regex = g_regex_new("^\\{\"name\":\"([^\"]*)\".*\"ph\":\"(.)\",\"ts\":(-?\\d+)"
+            "(?:.*\"dur\":(\\d+))?(?:.*\"detail\":\"([^\"]*)\")?", G_REGEX_MULTILINE, 0, NULL);
+
+    gint64 epoch = 0;
+    GMatchInfo *match;
+    gboolean ok = g_regex_match(epoch_regex, json, 0, &match);
+    if (ok) {
+        char *epoch_str = g_match_info_fetch(match, 1);
+        epoch = g_ascii_strtoll(epoch_str, NULL, 10);
+        g_free(epoch_str);
+    }
+    g_match_info_free(match);
+
+    g_regex_match(event_regex, json, 0, &match);
+    while (ok && g_match_info_matches(match)) {
+        char *phase = g_match_info_fetch(match, 2);
+        char *ts = g_match_info_fetch(match, 3);
+        char *dur = g_match_info_fetch(match, 4);
+        char *detail = g_match_info_fetch(match, 5);
+
+        MelangeBenchTraceEvent event_template = {
+                .name = g_match_info_fetch(match, 1),
+                .detail = detail && *detail ? g_strdup(detail) : NULL,
+                .phase = phase[0],
+                .time = epoch + g_ascii_strtoll(ts, NULL, 10),
+                .duration = dur && *dur ? g_ascii_strtoll(dur, NULL, 10) : 0,
+        };
+        g_ptr_array_add(instance->trace, g_memdup(&event_template, sizeof event_template));
+
+        g_free(detail);
+        g_free(dur);
+        g_free(ts);
+        g_free(phase);
+        g_match_info_next(match, NULL);
+    }
+    g_match_info_free(match);
+
+    g_regex_unref(event_regex);
+    g_regex_unref(epoch_regex);
+    g_free(json);
+    return ok;
+}
+
+
+gboolean
+melange_bench_instance_stop(MelangeBenchInstance *instance) {
+    if (instance->exited) return FALSE;
+
+    gboolean clean = TRUE;
+    g_subprocess_wait_async(instance->process, NULL, melange_bench_instance_wait_finished,
+            instance);
+    g_subprocess_send_signal(instance->process, SIGTERM);
+    if (!melange_bench_run_until(melange_bench_instance_has_exited, instance,
+            MELANGE_BENCH_STOP_TIMEOUT)) {
+        g_warning("Instance did not exit after SIGTERM, killing it");
+        g_subprocess_force_exit(instance->process);
+        melange_bench_run_until(melange_bench_instance_has_exited, instance, G_MAXUINT);
+        clean = FALSE;
+    }
+
+    if (!melange_bench_instance_parse_trace(instance)) {
+        g_warning("Unable to read trace %s", instance->trace_file_name);
+        clean = FALSE;
+    }
+    return clean;
+}
+
+
+GPtrArray *
+melange_bench_instance_get_trace(MelangeBenchInstance *instance) {
+    return instance->trace;
+}
+
+
+const MelangeBenchTraceEvent *
+melange_bench_instance_find_event(MelangeBenchInstance *instance, const char *name,
+        const char *detail) {
+    for (guint i = 0; i < instance->trace->len; ++i) {
+        const MelangeBenchTraceEvent *event = g_ptr_array_index(instance->trace, i);
+        if (g_str_equal(event->name, name)
+                && (!detail || (event->detail && g_str_equal(event->detail, detail)))) {
+            return event;
+        }
+    }
+    return NULL;
+}
+
+
+static gboolean
+melange_bench_timeout_expired(gpointer user_data) {
+    *(gboolean *) user_data = TRUE;
+    return G_SOURCE_REMOVE;
+}
+
+
+int
+melange_bench_compare_gint64(const void *lhs, const void *rhs) {
+    gint64 l = *(const gint64 *) lhs, r = *(const gint64 *) rhs;
+    return (l > r) - (l < r);
+}
+
+
+static gboolean
+melange_bench_never(gpointer user_data) {
+    (void) user_data;
+    return FALSE;
+}
+
+
+gboolean
+melange_bench_run_until(gboolean (*done)(gpointer user_data), gpointer user_data,
+        guint timeout_ms) {
+    gboolean expired = FALSE;
+    guint timeout = 0;
+    if (timeout_ms != G_MAXUINT) {
+        timeout = g_timeout_add(timeout_ms, melange_bench_timeout_expired, &expired);
+    }
+
+    while (!done(user_data) && !expired) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+
+    if (!expired && timeout) {
+        g_source_remove(timeout);
+    }
+    return !expired;
+}
+
+
+void
+melange_bench_run_for(guint ms) {
+    melange_bench_run_until(melange_bench_never, NULL, ms);
+}
+
+
+static void
+melange_bench_server_handle_favicon(SoupServer *server, SoupMessage *message, const char *path,
+        GHashTable *query, SoupClientContext *client, gpointer user_data) {
+    (void) server;
+    (void) path;
+    (void) query;
+    (void) client;
+
+    GBytes *png = user_data;
+    gsize size;
+    const void *data = g_bytes_get_data(png, &size);
+    soup_message_set_status(message, SOUP_STATUS_OK);
+    soup_message_set_response(message, "image/png", SOUP_MEMORY_COPY, data, size);
+}
+
+
+SoupServer *
+melange_bench_server_new(GError **error) {
+    SoupServer *server = soup_server_new(SOUP_SERVER_SERVER_HEADER, "melange-bench ", NULL);
+    if (!soup_server_listen_local(server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, error)) {
+        g_object_unref(server);
+        return NULL;
+    }
+
+    // A plain colored square, real favicons are not what is being measured
+    GdkPixbuf *icon = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, 32, 32);
+    gdk_pixbuf_fill(icon, 0x3080e0ff);
+    char *png;
+    gsize png_size;
+    if (gdk_pixbuf_save_to_buffer(icon, &png, &png_size, "png", NULL, NULL)) {
+        soup_server_add_handler(server, "/favicon.ico", melange_bench_server_handle_favicon,
+                g_bytes_new_take(png, png_size), (GDestroyNotify) g_bytes_unref);
+    }
+    g_object_unref(icon);
+
+    return server;
+}
+
+
+char *
+melange_bench_server_get_base_uri(SoupServer *server) {
+    GSList *uris = soup_server_get_uris(server);
+    SoupURI *uri = uris->data;
+    char *base_uri = g_strdup_printf("http://127.0.0.1:%u", soup_uri_get_port(uri));
+    g_slist_free_full(uris, (GDestroyNotify) soup_uri_free);
+    return base_uri;
+}
+
+
+char *
+melange_bench_format_account(const char *id, const char *service_url, const char *icon_url) {
+    return g_strdup_printf(
+            "\naccount {\n"
+                    "    id            \"%s\"\n"
+                    "    service-name  \"%s\"\n"
+                    "    service-url   \"%s\"\n"
+                    "    icon-url      \"%s\"\n"
+                    "    user-agent    \"Mozilla/5.0 (X11; Linux x86_64) melange-bench\"\n"
+                    "}\n",
+            id, id, service_url, icon_url);
+}
@@ -0,0 +1,83 @@
+#ifndef MELANGE_BENCH_HARNESS_H
+#define MELANGE_BENCH_HARNESS_H
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+
+// Runs a melange binary in throw-away XDG config, data and cache directories with tracing
+// enabled, so that benchmarks neither see nor touch the user's accounts.
+typedef struct MelangeBenchInstance MelangeBenchInstance;
+
+typedef struct MelangeBenchMemory {
+    guint64 rss_kib;
+    guint64 pss_kib;
+    guint n_processes;
+} MelangeBenchMemory;
+
+// One event from the Chrome trace written by the instance
+typedef struct MelangeBenchTraceEvent {
+    char *name;
+    char *detail;
+    char phase;
+    // Absolute g_get_monotonic_time() in microseconds
+    gint64 time;
+    gint64 duration;
+} MelangeBenchTraceEvent;
+
+
+// Spawns binary with the given config file contents
+MelangeBenchInstance *melange_bench_instance_new(const char *binary, const char *config,
+        GError **error);
+
+// Stops the instance if still running and removes its directories
+void melange_bench_instance_free(MelangeBenchInstance *instance);
+
+// Monotonic time in microseconds at which the process was spawned
+gint64 melange_bench_instance_get_start_time(MelangeBenchInstance *instance);
+
+// Sums up memory of the UI process and all of its descendants, i.e. the web and network processes
+void melange_bench_instance_sample_memory(MelangeBenchInstance *instance,
+        MelangeBenchMemory *memory);
+
+// User and system CPU time in microseconds consumed so far by the UI process and all of its
+// descendants that are still running
+gint64 melange_bench_instance_get_cpu_time(MelangeBenchInstance *instance);
+
+// Same, but only for the UI process
+gint64 melange_bench_instance_get_ui_cpu_time(MelangeBenchInstance *instance);
+
+// Sends SIGTERM, waits for the trace to be written and parses it. Returns FALSE if the process had
+// to be killed or the trace could not be read.
+gboolean melange_bench_instance_stop(MelangeBenchInstance *instance);
+
+// Array of MelangeBenchTraceEvent*, valid after melange_bench_instance_stop()
+GPtrArray *melange_bench_instance_get_trace(MelangeBenchInstance *instance);
+
+// First event with the given name and detail (NULL matches any detail), or NULL
+const MelangeBenchTraceEvent *melange_bench_instance_find_event(MelangeBenchInstance *instance,
+        const char *name, const char *detail);
+
+// Iterates the default main context until done returns TRUE or timeout_ms have passed.
+// Returns FALSE on timeout.
+gboolean melange_bench_run_until(gboolean (*done)(gpointer user_data), gpointer user_data,
+        guint timeout_ms);
+
+// Iterates the default main context for ms milliseconds, e.g. to let an instance settle
+void melange_bench_run_for(guint ms);
+
+// Orders gint64 values ascending, for qsort() and g_array_sort()
+int melange_bench_compare_gint64(const void *lhs, const void *rhs);
+
+// HTTP server on a random local port serving /favicon.ico. Add further handlers with
+// soup_server_add_handler().
+SoupServer *melange_bench_server_new(GError **error);
+
+// e.g. "http://127.0.0.1:12345", without a trailing slash
+char *melange_bench_server_get_base_uri(SoupServer *server);
+
+// An account block for a custom account served by the stub server
+char *melange_bench_format_account(const char *id, const char *service_url, const char *icon_url);
+
+
+#endif // MELANGE_BENCH_HARNESS_H
@@ -0,0 +1,376 @@
+// Notification storm benchmark. Stub pages fire Web Notifications at a fixed rate across several
+// accounts while a fake org.freedesktop.Notifications service counts what melange delivers.
+// Reports main-loop latency during the storm, notifications delivered versus dropped, config
+// writes triggered and CPU time per message.
+//
+// Registers the fake notification service on the session bus, so always run it in a private
+// one, e.g.
+//     xvfb-run -a dbus-run-session ./melange-bench-notifications
+
+#include "harness.h"
+
+#include <gio/gio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Interval of main-loop latency probes while no probe is outstanding
+#define MELANGE_BENCH_PROBE_INTERVAL 20
+
+// Time given to melange to deliver queued notifications after the last one was fired
+#define MELANGE_BENCH_DRAIN_TIME 2000
+
+
+// Counts up fired notifications and mirrors them in the title, which the unread probe picks up
+static const char *storm_page =
+        "<!DOCTYPE html>\n"
+        "<html><head><title>Storm</title></head><body>\n"
+        "<script>\n"
+        "  var params = new URLSearchParams(location.search);\n"
+        "  var rate = +params.get('rate'), total = Math.round(rate * +params.get('duration'));\n"
+        "  var fired = 0, start;\n"
+        "  function tick() {\n"
+        "    var due = Math.min(total, Math.floor((performance.now() - start) * rate / 1000));\n"
+        "    for (; fired < due; ++fired) {\n"
+        "      new Notification('Busy group', { body: 'Message ' + fired, tag: 'm' + fired });\n"
+        "      document.title = '(' + (fired + 1) + ') Storm';\n"
+        "    }\n"
+        "    if (fired < total) setTimeout(tick, 2); else fetch('done?fired=' + fired);\n"
+        "  }\n"
+        "  Notification.requestPermission(function() { start = performance.now(); tick(); });\n"
+        "</script></body></html>\n";
+
+
+static const char *notifications_xml =
+        "<node>"
+        "  <interface name='org.freedesktop.Notifications'>"
+        "    <method name='Notify'>"
+        "      <arg type='s' direction='in'/><arg type='u' direction='in'/>"
+        "      <arg type='s' direction='in'/><arg type='s' direction='in'/>"
+        "      <arg type='s' direction='in'/><arg type='as' direction='in'/>"
+        "      <arg type='a{sv}' direction='in'/><arg type='i' direction='in'/>"
+        "      <arg type='u' direction='out'/>"
+        "    </method>"
+        "    <method name='CloseNotification'><arg type='u' direction='in'/></method>"
+        "    <method name='GetCapabilities'><arg type='as' direction='out'/></method>"
+        "    <method name='GetServerInformation'>"
+        "      <arg type='s' direction='out'/><arg type='s' direction='out'/>"
+        "      <arg type='s' direction='out'/><arg type='s' direction='out'/>"
+        "    </method>"
+        "  </interface>"
+        "</node>";
+
+
+typedef struct MelangeBenchStorm {
+    MelangeBenchInstance *instance;
+    GDBusConnection *bus;
+    guint n_accounts;
+
+    guint n_done;
+    guint64 n_fired;
+    guint64 n_delivered;
+
+    // CPU times when the first notification arrived
+    gboolean storm_started;
+    gint64 storm_cpu_time;
+    gint64 storm_ui_cpu_time;
+
+    // Main-loop latency probes, only recorded while the storm is running
+    guint probe_timeout;
+    gboolean probe_outstanding;
+    gint64 probe_sent;
+    GArray *latencies;
+} MelangeBenchStorm;
+
+
+static void
+melange_bench_notifications_method_call(GDBusConnection *connection, const char *sender,
+        const char *object_path, const char *interface_name, const char *method_name,
+        GVariant *parameters, GDBusMethodInvocation *invocation, gpointer user_data) {
+    (void) connection;
+    (void) sender;
+    (void) object_path;
+    (void) interface_name;
+    (void) parameters;
+
+    MelangeBenchStorm *storm = user_data;
+    if (g_str_equal(method_name, "Notify")) {
+        if (storm->instance && !storm->storm_started) {
+            storm->storm_started = TRUE;
+            storm->storm_cpu_time = melange_bench_instance_get_cpu_time(storm->instance);
+            storm->storm_ui_cpu_time = melange_bench_instance_get_ui_cpu_time(storm->instance);
+        }
+        ++storm->n_delivered;
+        g_dbus_method_invocation_return_value(invocation,
+                g_variant_new("(u)", (guint32) storm->n_delivered));
+    } else if (g_str_equal(method_name, "GetCapabilities")) {
+        const char *capabilities[] = { "body", NULL };
+        g_dbus_method_invocation_return_value(invocation,
+                g_variant_new("(^as)", capabilities));
+    } else if (g_str_equal(method_name, "GetServerInformation")) {
+        g_dbus_method_invocation_return_value(invocation,
+                g_variant_new("(ssss)", "melange-bench", "melange", "0", "1.2"));
+    } else {
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    }
+}
+
+
+static void
+melange_bench_storm_handle_account(SoupServer *server, SoupMessage *message, const char *path,
+        GHashTable *query, SoupClientContext *client, gpointer user_data) {
+    (void) server;
+    (void) client;
+
+    MelangeBenchStorm *storm = user_data;
+    if (g_str_has_suffix(path, "/done")) {
+        const char *fired = query ? g_hash_table_lookup(query, "fired") : NULL;
+        storm->n_fired += fired ? g_ascii_strtoull(fired, NULL, 10) : 0;
+        ++storm->n_done;
+        soup_message_set_status(message, SOUP_STATUS_NO_CONTENT);
+    } else {
+        soup_message_set_status(message, SOUP_STATUS_OK);
+        soup_message_set_response(message, "text/html", SOUP_MEMORY_STATIC, storm_page,
+                strlen(storm_page));
+    }
+}
+
+
+// GtkApplication handles org.gtk.Actions on the main thread, so the round trip time of a call
+// includes however long the UI main loop is blocked
+static void
+melange_bench_storm_probe_finished(GObject *source, GAsyncResult *result, gpointer user_data) {
+    MelangeBenchStorm *storm = user_data;
+    GVariant *reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, NULL);
+    if (reply) {
+        if (storm->storm_started && storm->probe_timeout) {
+            gint64 latency = g_get_monotonic_time() - storm->probe_sent;
+            g_array_append_val(storm->latencies, latency);
+        }
+        g_variant_unref(reply);
+    }
+    storm->probe_outstanding = FALSE;
+}
+
+
+static gboolean
+melange_bench_storm_probe(gpointer user_data) {
+    MelangeBenchStorm *storm = user_data;
+    if (!storm->probe_outstanding) {
+        storm->probe_outstanding = TRUE;
+        storm->probe_sent = g_get_monotonic_time();
+        g_dbus_connection_call(storm->bus, "de.inforge.melange", "/de/inforge/melange",
+                "org.gtk.Actions", "DescribeAll", NULL, NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                melange_bench_storm_probe_finished, storm);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+
+static gboolean
+melange_bench_storm_all_done(gpointer user_data) {
+    MelangeBenchStorm *storm = user_data;
+    return storm->n_done == storm->n_accounts;
+}
+
+
+static gboolean
+melange_bench_storm_probe_idle(gpointer user_data) {
+    return !((MelangeBenchStorm *) user_data)->probe_outstanding;
+}
+
+
+static double
+melange_bench_percentile_ms(GArray *sorted, double percentile) {
+    if (sorted->len == 0) return -1.0;
+    guint index = (guint) (percentile * (sorted->len - 1));
+    return (double) g_array_index(sorted, gint64, index) / 1000.0;
+}
+
+
+static gboolean
+melange_bench_storm_run(MelangeBenchStorm *storm, const char *binary, SoupServer *server,
+        const char *base_uri, double rate, double duration) {
+    storm->n_done = 0;
+    storm->n_fired = 0;
+    storm->n_delivered = 0;
+    storm->storm_started = FALSE;
+    storm->probe_outstanding = FALSE;
+    g_array_set_size(storm->latencies, 0);
+
+    GString *config = g_string_new(
+            "settings {\n"
+                    "    load-accounts  \"eager\"\n"
+                    "    hibernate-after  \"0\"\n"
+                    "}\n");
+    char *icon_url = g_strconcat(base_uri, "/favicon.ico", NULL);
+    for (guint i = 0; i < storm->n_accounts; ++i) {
+        char *id = g_strdup_printf("storm-%u", i);
+        char *service_url = g_strdup_printf("%s/storm/%u/?rate=%g&duration=%g", base_uri, i,
+                rate, duration);
+        char *account = melange_bench_format_account(id, service_url, icon_url);
+        g_string_append(config, account);
+        g_free(account);
+        g_free(service_url);
+        g_free(id);
+    }
+    g_free(icon_url);
+
+    GError *error = NULL;
+    storm->instance = melange_bench_instance_new(binary, config->str, &error);
+    g_string_free(config, TRUE);
+    if (!storm->instance) {
+        g_printerr("Unable to start %s: %s\n", binary, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    storm->probe_timeout = g_timeout_add(MELANGE_BENCH_PROBE_INTERVAL, melange_bench_storm_probe,
+            storm);
+
+    guint timeout_ms = (guint) (duration * 1000) + 60000;
+    gboolean complete = melange_bench_run_until(melange_bench_storm_all_done, storm, timeout_ms);
+    if (!complete) {
+        g_printerr("Only %u of %u accounts finished firing within %u ms\n", storm->n_done,
+                storm->n_accounts, timeout_ms);
+    }
+    melange_bench_run_for(MELANGE_BENCH_DRAIN_TIME);
+
+    gint64 cpu_time = melange_bench_instance_get_cpu_time(storm->instance)
+            - storm->storm_cpu_time;
+    gint64 ui_cpu_time = melange_bench_instance_get_ui_cpu_time(storm->instance)
+            - storm->storm_ui_cpu_time;
+    g_source_remove(storm->probe_timeout);
+    storm->probe_timeout = 0;
+    melange_bench_run_until(melange_bench_storm_probe_idle, storm, 5000);
+
+    gboolean ok = melange_bench_instance_stop(storm->instance) && complete;
+
+    guint config_writes = 0;
+    GPtrArray *trace = melange_bench_instance_get_trace(storm->instance);
+    for (guint i = 0; i < trace->len; ++i) {
+        const MelangeBenchTraceEvent *event = g_ptr_array_index(trace, i);
+        if (g_str_equal(event->name, "config-write")) {
+            ++config_writes;
+        }
+    }
+
+    g_array_sort(storm->latencies, melange_bench_compare_gint64);
+    guint64 dropped = storm->n_fired > storm->n_delivered ? storm->n_fired - storm->n_delivered
+            : 0;
+    double delivered = storm->n_delivered ? (double) storm->n_delivered : 1.0;
+
+    printf("%8g %9" G_GUINT64_FORMAT " %9" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT
+            " %9.1f %9.1f %9.1f %7u %11.1f %11.1f\n",
+            rate, storm->n_fired, storm->n_delivered, dropped,
+            melange_bench_percentile_ms(storm->latencies, 0.5),
+            melange_bench_percentile_ms(storm->latencies, 0.99),
+            melange_bench_percentile_ms(storm->latencies, 1.0),
+            config_writes,
+            storm->storm_started ? (double) ui_cpu_time / delivered : -1.0,
+            storm->storm_started ? (double) cpu_time / delivered : -1.0);
+    fflush(stdout);
+
+    melange_bench_instance_free(storm->instance);
+    storm->instance = NULL;
+    return ok;
+}
+
+
+int
+main(int argc, char **argv) {
+    char *binary = NULL;
+    char *rates = NULL;
+    int n_accounts = 4;
+    double duration = 10.0;
+
+    GOptionEntry entries[] = {
+            { "melange", 'm', 0, G_OPTION_ARG_FILENAME, &binary,
+                    "melange binary to benchmark", "PATH" },
+            { "rates", 'r', 0, G_OPTION_ARG_STRING, &rates,
+                    "Comma-separated notifications per second and account "
+                    "(default 1,10,100,500)", "RATE,..." },
+            { "accounts", 'n', 0, G_OPTION_ARG_INT, &n_accounts,
+                    "Number of accounts firing notifications (default 4)", "N" },
+            { "duration", 'd', 0, G_OPTION_ARG_DOUBLE, &duration,
+                    "Seconds each storm lasts (default 10)", "SECONDS" },
+            { NULL, 0, 0, 0, NULL, NULL, NULL },
+    };
+
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("- melange notification storm benchmark");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error) || n_accounts < 1) {
+        g_printerr("%s\n", error ? error->message : "Need at least one account");
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    if (!g_getenv("DISPLAY") && !g_getenv("WAYLAND_DISPLAY") && !g_getenv("BROADWAY_DISPLAY")) {
+        g_printerr("No display available, run under xvfb-run or a broadway backend\n");
+        return EXIT_FAILURE;
+    }
+
+    MelangeBenchStorm storm = {
+            .n_accounts = (guint) n_accounts,
+            .latencies = g_array_new(FALSE, FALSE, sizeof(gint64)),
+    };
+
+    storm.bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+    if (!storm.bus) {
+        g_printerr("No session bus: %s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    GDBusNodeInfo *node = g_dbus_node_info_new_for_xml(notifications_xml, NULL);
+    GDBusInterfaceVTable vtable = { melange_bench_notifications_method_call, NULL, NULL, { 0 } };
+    g_dbus_connection_register_object(storm.bus, "/org/freedesktop/Notifications",
+            node->interfaces[0], &vtable, &storm, NULL, NULL);
+    GVariant *reply = g_dbus_connection_call_sync(storm.bus, "org.freedesktop.DBus",
+            "/org/freedesktop/DBus", "org.freedesktop.DBus", "RequestName",
+            g_variant_new("(su)", "org.freedesktop.Notifications", 4 /* DO_NOT_QUEUE */),
+            G_VARIANT_TYPE("(u)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+    guint32 name_reply = 0;
+    if (reply) {
+        g_variant_get(reply, "(u)", &name_reply);
+        g_variant_unref(reply);
+    }
+    if (name_reply != 1 /* PRIMARY_OWNER */) {
+        g_printerr("Unable to own org.freedesktop.Notifications, run in a private session bus "
+                "with dbus-run-session\n");
+        return EXIT_FAILURE;
+    }
+
+    SoupServer *server = melange_bench_server_new(&error);
+    if (!server) {
+        g_printerr("Unable to start stub server: %s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    soup_server_add_handler(server, "/storm", melange_bench_storm_handle_account, &storm, NULL);
+    char *base_uri = melange_bench_server_get_base_uri(server);
+
+    printf("%d accounts, %g s per storm\n", n_accounts, duration);
+    printf("    rate     fired delivered  dropped  p50 [ms]  p99 [ms]  max [ms] cfg-wr"
+            " UI [us/msg] all [us/msg]\n");
+
+    gboolean ok = TRUE;
+    char **rate_strs = g_strsplit(rates ? rates : "1,10,100,500", ",", -1);
+    for (char **rate = rate_strs; *rate; ++rate) {
+        double r = g_ascii_strtod(*rate, NULL);
+        if (r > 0) {
+            ok &= melange_bench_storm_run(&storm, binary ? binary : MELANGE_BINARY, server,
+                    base_uri, r, duration);
+        }
+    }
+
+    g_strfreev(rate_strs);
+    g_free(base_uri);
+    g_object_unref(server);
+    g_dbus_node_info_unref(node);
+    g_object_unref(storm.bus);
+    g_array_free(storm.latencies, TRUE);
+    g_free(rates);
+    g_free(binary);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,238 @@
+// Startup and footprint benchmark. Launches melange with N synthetic accounts served by a local
+// stub server and reports time until the main window is shown, time until each account has
+// finished loading, and the memory of all melange processes once everything has loaded.
+//
+// Needs a display and its own session bus, since melange is a unique application, e.g.
+//     xvfb-run -a dbus-run-session ./melange-bench-startup
+
+#include "harness.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Stand-in for a messenger web app: Some DOM and script work, and a beacon once loaded
+static const char *page_template =
+        "<!DOCTYPE html>\n"
+        "<html><head><title>%s</title></head>\n"
+        "<body><ul id=\"chats\"></ul>\n"
+        "<script>\n"
+        "  var chats = document.getElementById('chats');\n"
+        "  for (var i = 0; i < 500; ++i) {\n"
+        "    var li = document.createElement('li');\n"
+        "    li.textContent = 'Chat ' + i + ': ' + 'lorem ipsum '.repeat(8);\n"
+        "    chats.appendChild(li);\n"
+        "  }\n"
+        "  window.addEventListener('load', function() { fetch('loaded'); });\n"
+        "</script></body></html>\n";
+
+
+typedef struct MelangeBenchStartup {
+    guint n_accounts;
+    guint n_loaded;
+
+    // Indexed by account number, TRUE once the beacon has arrived
+    gboolean *loaded;
+} MelangeBenchStartup;
+
+
+// Serves /account/<n>/ and receives the /account/<n>/loaded beacon
+static void
+melange_bench_startup_handle_account(SoupServer *server, SoupMessage *message, const char *path,
+        GHashTable *query, SoupClientContext *client, gpointer user_data) {
+    (void) server;
+    (void) query;
+    (void) client;
+
+    MelangeBenchStartup *bench = user_data;
+    guint n;
+    char rest[16] = "";
+    if (sscanf(path, "/account/%u/%15s", &n, rest) < 1 || n >= bench->n_accounts) {
+        soup_message_set_status(message, SOUP_STATUS_NOT_FOUND);
+        return;
+    }
+
+    if (g_str_equal(rest, "loaded")) {
+        if (!bench->loaded[n]) {
+            bench->loaded[n] = TRUE;
+            ++bench->n_loaded;
+        }
+        soup_message_set_status(message, SOUP_STATUS_NO_CONTENT);
+    } else {
+        char *title = g_strdup_printf("Account %u", n);
+        char *page = g_strdup_printf(page_template, title);
+        soup_message_set_status(message, SOUP_STATUS_OK);
+        soup_message_set_response(message, "text/html", SOUP_MEMORY_TAKE, page, strlen(page));
+        g_free(title);
+    }
+}
+
+
+static gboolean
+melange_bench_startup_all_loaded(gpointer user_data) {
+    MelangeBenchStartup *bench = user_data;
+    return bench->n_loaded == bench->n_accounts;
+}
+
+
+static double
+melange_bench_ms(gint64 us) {
+    return (double) us / 1000.0;
+}
+
+
+static gboolean
+melange_bench_startup_run(const char *binary, SoupServer *server, const char *base_uri,
+        guint n_accounts, guint timeout_ms, gboolean per_account) {
+    MelangeBenchStartup bench = {
+            .n_accounts = n_accounts,
+            .n_loaded = 0,
+            .loaded = g_malloc0(n_accounts * sizeof(gboolean)),
+    };
+    soup_server_add_handler(server, "/account", melange_bench_startup_handle_account, &bench,
+            NULL);
+
+    // Load everything right away, that is the worst case being measured
+    GString *config = g_string_new(
+            "settings {\n"
+                    "    load-accounts  \"eager\"\n"
+                    "    hibernate-after  \"0\"\n"
+                    "}\n");
+    char *icon_url = g_strconcat(base_uri, "/favicon.ico", NULL);
+    for (guint i = 0; i < n_accounts; ++i) {
+        char *id = g_strdup_printf("account-%u", i);
+        char *service_url = g_strdup_printf("%s/account/%u/", base_uri, i);
+        char *account = melange_bench_format_account(id, service_url, icon_url);
+        g_string_append(config, account);
+        g_free(account);
+        g_free(service_url);
+        g_free(id);
+    }
+    g_free(icon_url);
+
+    GError *error = NULL;
+    MelangeBenchInstance *instance = melange_bench_instance_new(binary, config->str, &error);
+    g_string_free(config, TRUE);
+    if (!instance) {
+        g_printerr("Unable to start %s: %s\n", binary, error->message);
+        g_error_free(error);
+        soup_server_remove_handler(server, "/account");
+        g_free(bench.loaded);
+        return FALSE;
+    }
+
+    gboolean complete = melange_bench_run_until(melange_bench_startup_all_loaded, &bench,
+            timeout_ms);
+    if (!complete) {
+        g_printerr("Only %u of %u accounts loaded within %u ms\n", bench.n_loaded, n_accounts,
+                timeout_ms);
+    }
+
+    // Let web processes settle after the load event before measuring memory
+    melange_bench_run_for(2000);
+    MelangeBenchMemory memory;
+    melange_bench_instance_sample_memory(instance, &memory);
+
+    gboolean ok = melange_bench_instance_stop(instance) && complete;
+    gint64 start = melange_bench_instance_get_start_time(instance);
+
+    const MelangeBenchTraceEvent *shown = melange_bench_instance_find_event(instance,
+            "window-shown", NULL);
+
+    gint64 *load_times = g_malloc(n_accounts * sizeof(gint64));
+    guint n_load_times = 0;
+    for (guint i = 0; i < n_accounts; ++i) {
+        char *id = g_strdup_printf("account-%u", i);
+        const MelangeBenchTraceEvent *finished = melange_bench_instance_find_event(instance,
+                "load-finished", id);
+        if (finished) {
+            load_times[n_load_times++] = finished->time - start;
+            if (per_account) {
+                printf("  %-12s first load finished after %8.1f ms\n", id,
+                        melange_bench_ms(finished->time - start));
+            }
+        } else if (per_account) {
+            printf("  %-12s did not finish loading\n", id);
+        }
+        g_free(id);
+    }
+    qsort(load_times, n_load_times, sizeof *load_times, melange_bench_compare_gint64);
+
+    printf("%8u %12.1f %12.1f %12.1f %10.1f %10.1f %9u\n",
+            n_accounts,
+            shown ? melange_bench_ms(shown->time - start) : -1.0,
+            n_load_times ? melange_bench_ms(load_times[n_load_times / 2]) : -1.0,
+            n_load_times ? melange_bench_ms(load_times[n_load_times - 1]) : -1.0,
+            (double) memory.rss_kib / 1024.0,
+            (double) memory.pss_kib / 1024.0,
+            memory.n_processes);
+    fflush(stdout);
+
+    g_free(load_times);
+    melange_bench_instance_free(instance);
+    soup_server_remove_handler(server, "/account");
+    g_free(bench.loaded);
+    return ok;
+}
+
+
+int
+main(int argc, char **argv) {
+    char *binary = NULL;
+    char *accounts = NULL;
+    int timeout = 120;
+    gboolean per_account = FALSE;
+
+    GOptionEntry entries[] = {
+            { "melange", 'm', 0, G_OPTION_ARG_FILENAME, &binary,
+                    "melange binary to benchmark", "PATH" },
+            { "accounts", 'n', 0, G_OPTION_ARG_STRING, &accounts,
+                    "Comma-separated account counts (default 1,5,20,50)", "N,..." },
+            { "timeout", 't', 0, G_OPTION_ARG_INT, &timeout,
+                    "Seconds to wait for all accounts to load (default 120)", "SECONDS" },
+            { "per-account", 'p', 0, G_OPTION_ARG_NONE, &per_account,
+                    "Report load times of every account", NULL },
+            { NULL, 0, 0, 0, NULL, NULL, NULL },
+    };
+
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("- melange startup benchmark");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    if (!g_getenv("DISPLAY") && !g_getenv("WAYLAND_DISPLAY") && !g_getenv("BROADWAY_DISPLAY")) {
+        g_printerr("No display available, run under xvfb-run or a broadway backend\n");
+        return EXIT_FAILURE;
+    }
+
+    SoupServer *server = melange_bench_server_new(&error);
+    if (!server) {
+        g_printerr("Unable to start stub server: %s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    char *base_uri = melange_bench_server_get_base_uri(server);
+
+    char **counts = g_strsplit(accounts ? accounts : "1,5,20,50", ",", -1);
+    printf("accounts   shown [ms] p50 load [ms] max load [ms]  RSS [MiB]  PSS [MiB] processes\n");
+
+    gboolean ok = TRUE;
+    for (char **count = counts; *count; ++count) {
+        guint n_accounts = (guint) g_ascii_strtoull(*count, NULL, 10);
+        if (n_accounts > 0) {
+            ok &= melange_bench_startup_run(binary ? binary : MELANGE_BINARY, server, base_uri,
+                    n_accounts, (guint) timeout * 1000, per_account);
+        }
+    }
+
+    g_strfreev(counts);
+    g_free(base_uri);
+    g_object_unref(server);
+    g_free(accounts);
+    g_free(binary);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
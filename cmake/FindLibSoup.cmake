@@ -0,0 +1,20 @@
+find_package(PkgConfig)
+
+pkg_check_modules(LIBSOUP libsoup-2.4>=2.42)
+
+if (LIBSOUP_FOUND)
+    SET(LIBSOUP_LIBRARY_DIRS ${LIBSOUP_LIBDIR})
+    SET(LIBSOUP_LIBRARIES ${LIBSOUP_LDFLAGS})
+    SET(LIBSOUP_C_FLAGS ${LIBSOUP_CFLAGS})
+    if (NOT LibSoup_FIND_QUIETLY)
+        message(STATUS "Found LibSoup")
+    endif ()
+else ()
+    if (NOT LibSoup_FIND_QUIETLY)
+        if (LibSoup_FIND_REQUIRED)
+            message(FATAL_ERROR "Could not find LibSoup")
+        else ()
+            message(STATUS "Could not find LibSoup")
+        endif ()
+    endif ()
+endif ()
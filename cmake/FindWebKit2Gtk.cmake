@@ -1,14 +1,16 @@
 find_package(PkgConfig)
 
-pkg_check_modules(WEBKIT2GTK webkit2gtk-4.0>=2.14.5)
+pkg_check_modules(WEBKIT2GTK webkit2gtk-4.0>=2.34)
+pkg_check_modules(WEBKIT2GTK_WEB_EXTENSION webkit2gtk-web-extension-4.0>=2.34)
 
-if (WEBKIT2GTK_FOUND)
+if (WEBKIT2GTK_FOUND AND WEBKIT2GTK_WEB_EXTENSION_FOUND)
     if (NOT WebKit2Gtk_FIND_QUIETLY)
         message(STATUS "Found WebKit2Gtk")
     endif ()
     SET(WEBKIT2GTK_LIBRARY_DIRS ${WEBKIT2GTK_LIBDIR})
     SET(WEBKIT2GTK_LIBRARIES ${WEBKIT2GTK_LDFLAGS})
     SET(WEBKIT2GTK_C_FLAGS ${WEBKIT2GTK_CFLAGS})
+    SET(WEBKIT2GTK_WEB_EXTENSION_LIBRARIES ${WEBKIT2GTK_WEB_EXTENSION_LDFLAGS})
 else ()
     if (NOT WebKit2Gtk_FIND_QUIETLY)
         if (WebKit2Gtk_FIND_REQUIRED)
@@ -0,0 +1 @@
+melangeObserveUnread(melangeCountUnreadInTitle);
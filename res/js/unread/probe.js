@@ -0,0 +1,36 @@
+// Reports the number of unread messages to melange whenever it changes. The service-specific
+// probe calls melangeObserveUnread() with a function counting unread messages in the current
+// document and the node whose mutations may change that count.
+function melangeObserveUnread(count, target) {
+    let last = -1;
+    let scheduled = false;
+
+    const report = () => {
+        scheduled = false;
+        const unread = count();
+        if (unread !== last) {
+            last = unread;
+            window.webkit.messageHandlers.unread.postMessage(unread);
+        }
+    };
+
+    // Busy pages mutate constantly, only count once per burst
+    const observer = new MutationObserver(() => {
+        if (!scheduled) {
+            scheduled = true;
+            setTimeout(report, 500);
+        }
+    });
+    observer.observe(target || document.head, {
+        subtree: true,
+        childList: true,
+        characterData: true,
+    });
+    report();
+}
+
+// Number in titles like "(1) WhatsApp" or "3 new messages"
+function melangeCountUnreadInTitle() {
+    const match = /(^\s*|\()(\d+)\b/.exec(document.title);
+    return match ? parseInt(match[2], 10) : 0;
+}
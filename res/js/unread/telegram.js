@@ -0,0 +1,10 @@
+// Sum of the unread badges in the dialog list
+melangeObserveUnread(() => {
+    const badges = document.querySelectorAll('.im_dialog_badge:not(.ng-hide)');
+    if (badges.length === 0) {
+        return melangeCountUnreadInTitle();
+    }
+    let unread = 0;
+    badges.forEach(badge => unread += parseInt(badge.textContent, 10) || 0);
+    return unread;
+}, document.body);
@@ -0,0 +1,10 @@
+// Sum of the unread badges in the chat list, the title only counts chats
+melangeObserveUnread(() => {
+    const badges = document.querySelectorAll('#pane-side span[aria-label*="unread"]');
+    if (badges.length === 0) {
+        return melangeCountUnreadInTitle();
+    }
+    let unread = 0;
+    badges.forEach(badge => unread += parseInt(badge.textContent, 10) || 0);
+    return unread;
+}, document.body);
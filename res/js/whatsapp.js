@@ -1,12 +0,0 @@
-const style = document.createElement('style');
-style.type = 'text/css';
-style.appendChild(document.createTextNode(`
-    .app {
-        margin: 0 !important;
-        width: 100% !important;
-        height: 100% !important;
-        top: 0 !important;
-        border-radius: 0 !important;
-    }
-`));
-document.head.appendChild(style);
@@ -0,0 +1,901 @@
+#include "accountview.h"
+#include "util.h"
+#include "trace.h"
+
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+
+// The disk cache is first measured this many seconds after loading, then periodically
+#define MELANGE_ACCOUNT_VIEW_CACHE_CHECK_DELAY 30
+#define MELANGE_ACCOUNT_VIEW_CACHE_CHECK_INTERVAL (15 * 60)
+
+// A web process that stays unresponsive for this many seconds is considered hung
+#define MELANGE_ACCOUNT_VIEW_HANG_TIMEOUT 15
+// Reloads after a crash or hang are delayed by 1, 2, 4, ... seconds up to this maximum
+#define MELANGE_ACCOUNT_VIEW_MAX_RESTART_DELAY (5 * 60)
+// The backoff starts over once a web process has survived this many seconds
+#define MELANGE_ACCOUNT_VIEW_RESTART_RESET (10 * 60)
+// After a restart, the page reports 0 unread messages until it has caught up with the server.
+// Such counts are held back for this many seconds after the reload finished.
+#define MELANGE_ACCOUNT_VIEW_UNREAD_HOLD 30
+// Memory growth is measured against the first sample taken this many seconds after loading
+#define MELANGE_ACCOUNT_VIEW_MEMORY_SETTLE (3 * 60)
+
+
+struct MelangeAccountView {
+    GtkBox parent_instance;
+
+    MelangeApp *app;
+    MelangeAccount *account;
+
+    // Both NULL until the view is loaded and while it is hibernated
+    WebKitWebContext *web_context;
+    GtkWidget *web_view;
+
+    // Snapshot of the web view, shown while hibernated
+    GtkWidget *placeholder;
+    GCancellable *snapshot_cancellable;
+
+    // Enforces the cache quota while loaded. The directory is measured on a worker thread.
+    char *cache_path;
+    guint cache_check;
+    GCancellable *cache_check_cancellable;
+
+    // Web process watchdog. restarts counts consecutive recoveries for the backoff.
+    guint hang_timeout;
+    guint restart_timeout;
+    guint restarts;
+    guint total_restarts;
+    gint64 last_restart;
+
+    // Set from a restart until MELANGE_ACCOUNT_VIEW_UNREAD_HOLD after the reload, during which a
+    // count of 0 is stored in held_unread (-1 for none) instead of being reported
+    gboolean holding_unread;
+    int held_unread;
+    guint unread_hold_timeout;
+
+    // Reasons to reload once the network is back, see melange_account_view_reconnect(): a restart
+    // was put off while offline, or the last load failed with a network error
+    gboolean reload_deferred;
+    gboolean load_failed;
+
+    // Reported by src/webextension.c, 0 until the page has been created
+    GPid web_process_id;
+
+    // Resident memory of the web process once the page has settled, 0 until sampled
+    gint64 loaded_at;
+    guint64 memory_baseline;
+    // Resident memory before the last recycle, logged along with the new baseline
+    guint64 recycled_memory;
+
+    gint64 last_used;
+
+    // Start of the current page load for tracing, 0 while tracing is disabled
+    gint64 trace_load_begin;
+};
+
+
+typedef GtkBoxClass MelangeAccountViewClass;
+
+
+enum {
+    MELANGE_ACCOUNT_VIEW_PROP_APP = 1,
+    MELANGE_ACCOUNT_VIEW_PROP_ACCOUNT,
+    MELANGE_ACCOUNT_VIEW_N_PROPS
+};
+
+
+G_DEFINE_TYPE(MelangeAccountView, melange_account_view, GTK_TYPE_BOX)
+
+
+static void
+melange_account_view_set_property(GObject *object, guint property_id, const GValue *value,
+        GParamSpec *pspec) {
+    MelangeAccountView *view = MELANGE_ACCOUNT_VIEW(object);
+    switch (property_id) {
+        case MELANGE_ACCOUNT_VIEW_PROP_APP:
+            view->app = MELANGE_APP(g_value_get_pointer(value));
+            break;
+
+        case MELANGE_ACCOUNT_VIEW_PROP_ACCOUNT:
+            view->account = g_value_get_pointer(value);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+
+static gboolean
+melange_account_view_web_view_context_menu(WebKitWebView *web_view,
+        WebKitContextMenu *context_menu, GdkEvent *event, WebKitHitTestResult *hit_test_result,
+        gpointer user_data) {
+    (void) web_view;
+    (void) context_menu;
+    (void) event;
+    (void) hit_test_result;
+    (void) user_data;
+
+    // Suppress context menu
+    return TRUE;
+}
+
+
+// Message posted by the unread probe (res/js/unread) each time the unread count changes
+static void
+melange_account_view_unread_message_received(WebKitUserContentManager *content_manager,
+        WebKitJavascriptResult *result, MelangeAccountView *view) {
+    (void) content_manager;
+
+    JSCValue *value = webkit_javascript_result_get_js_value(result);
+    if (!jsc_value_is_number(value)) {
+        g_warning("Ignoring invalid unread count from account %s", view->account->id);
+        return;
+    }
+
+    int unread = MAX(0, jsc_value_to_int32(value));
+    if (view->holding_unread) {
+        if (unread == 0) {
+            view->held_unread = 0;
+            return;
+        }
+        // The page has caught up
+        view->holding_unread = FALSE;
+    }
+    g_signal_emit_by_name(view, "unread-messages-changed", unread);
+}
+
+
+static gboolean
+melange_account_view_release_unread(MelangeAccountView *view) {
+    view->unread_hold_timeout = 0;
+    view->holding_unread = FALSE;
+    if (view->held_unread >= 0) {
+        g_signal_emit_by_name(view, "unread-messages-changed", view->held_unread);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+
+static gboolean
+melange_account_view_restart_web_process(MelangeAccountView *view) {
+    view->restart_timeout = 0;
+    if (!g_network_monitor_get_network_available(g_network_monitor_get_default())) {
+        // Would only load an error page, the main window reconnects the account later
+        g_info("Deferring reload of account %s until the network is back", view->account->id);
+        view->reload_deferred = TRUE;
+        return G_SOURCE_REMOVE;
+    }
+
+    g_info("Reloading account %s after web process restart #%u", view->account->id,
+            view->total_restarts);
+    webkit_web_view_reload(WEBKIT_WEB_VIEW(view->web_view));
+    return G_SOURCE_REMOVE;
+}
+
+
+// Reloads the page, which spawns a new web process, after an exponentially growing delay so that
+// an account that keeps crashing does not hog the session
+static void
+melange_account_view_recover(MelangeAccountView *view, const char *reason) {
+    if (view->restart_timeout) return;
+
+    gint64 now = g_get_monotonic_time();
+    if (now - view->last_restart > MELANGE_ACCOUNT_VIEW_RESTART_RESET * G_USEC_PER_SEC) {
+        view->restarts = 0;
+    }
+    guint delay = MIN(1u << MIN(view->restarts, 16u), MELANGE_ACCOUNT_VIEW_MAX_RESTART_DELAY);
+    ++view->restarts;
+    ++view->total_restarts;
+    view->last_restart = now;
+
+    g_warning("Web process of account %s %s, restart #%u (%u in a row) in %u s",
+            view->account->id, reason, view->total_restarts, view->restarts, delay);
+    MELANGE_TRACE_MARK("web-process-restart", view->account->id);
+    MELANGE_TRACE_COUNTER("web-process-restarts", view->total_restarts);
+
+    view->holding_unread = TRUE;
+    view->held_unread = -1;
+    if (view->unread_hold_timeout) {
+        g_source_remove(view->unread_hold_timeout);
+        view->unread_hold_timeout = 0;
+    }
+    view->restart_timeout = g_timeout_add_seconds(delay,
+            (GSourceFunc) melange_account_view_restart_web_process, view);
+}
+
+
+static void
+melange_account_view_web_view_web_process_terminated(WebKitWebView *web_view,
+        WebKitWebProcessTerminationReason reason, MelangeAccountView *view) {
+    (void) web_view;
+
+    switch (reason) {
+        case WEBKIT_WEB_PROCESS_CRASHED:
+            melange_account_view_recover(view, "crashed");
+            break;
+        case WEBKIT_WEB_PROCESS_EXCEEDED_MEMORY_LIMIT:
+            melange_account_view_recover(view, "exceeded the memory limit");
+            break;
+        default:
+            // Terminated on our behalf, whoever did that takes care of what happens next
+            break;
+    }
+}
+
+
+static gboolean
+melange_account_view_hang_timeout(MelangeAccountView *view) {
+    view->hang_timeout = 0;
+    WebKitWebView *web_view = WEBKIT_WEB_VIEW(view->web_view);
+    if (!webkit_web_view_get_is_web_process_responsive(web_view)) {
+        melange_account_view_recover(view, "hung");
+        webkit_web_view_terminate_web_process(web_view);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+
+static void
+melange_account_view_web_view_notify_is_web_process_responsive(WebKitWebView *web_view,
+        GParamSpec *pspec, MelangeAccountView *view) {
+    (void) pspec;
+
+    if (webkit_web_view_get_is_web_process_responsive(web_view)) {
+        if (view->hang_timeout) {
+            g_source_remove(view->hang_timeout);
+            view->hang_timeout = 0;
+        }
+    } else if (!view->hang_timeout) {
+        view->hang_timeout = g_timeout_add_seconds(MELANGE_ACCOUNT_VIEW_HANG_TIMEOUT,
+                (GSourceFunc) melange_account_view_hang_timeout, view);
+    }
+}
+
+
+static void
+melange_account_view_web_view_load_changed_after_restart(WebKitWebView *web_view,
+        WebKitLoadEvent load_event, MelangeAccountView *view) {
+    (void) web_view;
+
+    if (load_event == WEBKIT_LOAD_COMMITTED) {
+        // The server has answered
+        view->load_failed = FALSE;
+    }
+    if (load_event == WEBKIT_LOAD_FINISHED && view->holding_unread && !view->restart_timeout
+            && !view->unread_hold_timeout) {
+        view->unread_hold_timeout = g_timeout_add_seconds(MELANGE_ACCOUNT_VIEW_UNREAD_HOLD,
+                (GSourceFunc) melange_account_view_release_unread, view);
+    }
+}
+
+
+static gboolean
+melange_account_view_web_view_load_failed(WebKitWebView *web_view, WebKitLoadEvent load_event,
+        char *failing_uri, GError *error, MelangeAccountView *view) {
+    (void) web_view;
+    (void) load_event;
+    (void) failing_uri;
+
+    if (error->domain == WEBKIT_NETWORK_ERROR
+            && !g_error_matches(error, WEBKIT_NETWORK_ERROR, WEBKIT_NETWORK_ERROR_CANCELLED)) {
+        view->load_failed = TRUE;
+    }
+    return FALSE;
+}
+
+
+// Sent by src/webextension.c whenever a (new) web process has created the page
+static gboolean
+melange_account_view_web_view_user_message_received(WebKitWebView *web_view,
+        WebKitUserMessage *message, MelangeAccountView *view) {
+    (void) web_view;
+
+    GVariant *parameters = webkit_user_message_get_parameters(message);
+    if (!g_str_equal(webkit_user_message_get_name(message), "web-process-id") || !parameters
+            || !g_variant_is_of_type(parameters, G_VARIANT_TYPE_UINT32)) return FALSE;
+
+    view->web_process_id = (GPid) g_variant_get_uint32(parameters);
+    view->memory_baseline = 0;
+    melange_app_apply_resource_limits(view->app, view->account, view->web_process_id);
+    return TRUE;
+}
+
+
+static void
+melange_account_view_cancel_watchdog(MelangeAccountView *view) {
+    if (view->hang_timeout) {
+        g_source_remove(view->hang_timeout);
+        view->hang_timeout = 0;
+    }
+    if (view->restart_timeout) {
+        g_source_remove(view->restart_timeout);
+        view->restart_timeout = 0;
+    }
+    if (view->unread_hold_timeout) {
+        g_source_remove(view->unread_hold_timeout);
+        view->unread_hold_timeout = 0;
+    }
+    view->holding_unread = FALSE;
+    view->reload_deferred = FALSE;
+    view->load_failed = FALSE;
+}
+
+
+// "decide-policy" is emitted when a new navigation request is received, e.g. from clicking a link.
+static gboolean
+melange_account_view_web_view_decide_policy(WebKitWebView *web_view,
+        WebKitPolicyDecision *decision, WebKitPolicyDecisionType decision_type,
+        MelangeAccountView *view) {
+    (void) web_view;
+    (void) view;
+
+    if (decision_type == WEBKIT_POLICY_DECISION_TYPE_NEW_WINDOW_ACTION
+            || decision_type == WEBKIT_POLICY_DECISION_TYPE_NAVIGATION_ACTION) {
+        WebKitNavigationAction *action = webkit_navigation_policy_decision_get_navigation_action(
+                        WEBKIT_NAVIGATION_POLICY_DECISION(decision));
+        const char *uri = webkit_uri_request_get_uri(webkit_navigation_action_get_request(action));
+        if (strncmp(uri, "blob:", 5) == 0) {
+            // Download urls start with blob:, apparently
+            webkit_policy_decision_download(decision);
+            return TRUE;
+        } else if (decision_type == WEBKIT_POLICY_DECISION_TYPE_NEW_WINDOW_ACTION) {
+            // Web apps usually try to open external urls in a new window, so we can redirect that
+            // to the os to open a browser window
+            GError *error = NULL;
+            if (!g_app_info_launch_default_for_uri(uri, NULL, &error)) {
+                g_warning("Unable to open URI %s in external application: %s", uri, error->message);
+                g_error_free(error);
+            }
+            webkit_policy_decision_ignore(decision);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+
+// Only connected while tracing. Marks every load milestone and records the whole page load, from
+// creating the web view (or the start of a reload) until it has finished.
+static void
+melange_account_view_web_view_load_changed(WebKitWebView *web_view, WebKitLoadEvent load_event,
+        MelangeAccountView *view) {
+    (void) web_view;
+
+    const char *account_id = view->account->id;
+    switch (load_event) {
+        case WEBKIT_LOAD_STARTED:
+            if (!view->trace_load_begin) {
+                view->trace_load_begin = MELANGE_TRACE_BEGIN();
+            }
+            MELANGE_TRACE_MARK("load-started", account_id);
+            break;
+        case WEBKIT_LOAD_REDIRECTED:
+            MELANGE_TRACE_MARK("load-redirected", account_id);
+            break;
+        case WEBKIT_LOAD_COMMITTED:
+            MELANGE_TRACE_MARK("load-committed", account_id);
+            break;
+        case WEBKIT_LOAD_FINISHED:
+            MELANGE_TRACE_MARK("load-finished", account_id);
+            MELANGE_TRACE_END(view->trace_load_begin, "account-view-load", account_id);
+            view->trace_load_begin = 0;
+            break;
+    }
+}
+
+
+static void
+melange_account_view_measure_cache_thread(GTask *task, gpointer source_object, gpointer task_data,
+        GCancellable *cancellable) {
+    (void) source_object;
+
+    guint64 *size = g_new(guint64, 1);
+    *size = melange_util_directory_size(task_data, cancellable);
+    g_task_return_pointer(task, size, g_free);
+}
+
+
+// WebKit has no size limit for its disk cache apart from the cache model, so the whole cache is
+// dropped once it exceeds the quota. The network process owns the files, removing them behind its
+// back would corrupt its index.
+static void
+melange_account_view_cache_measured(GObject *source_object, GAsyncResult *result,
+        gpointer user_data) {
+    (void) user_data;
+
+    // NULL if the web context has been released in the meantime
+    guint64 *size = g_task_propagate_pointer(G_TASK(result), NULL);
+    if (!size) return;
+
+    MelangeAccountView *view = MELANGE_ACCOUNT_VIEW(source_object);
+    g_clear_object(&view->cache_check_cancellable);
+
+    guint64 quota = (guint64) melange_app_get_account_cache_quota(view->app, view->account)
+            * 1024 * 1024;
+    if (quota > 0 && *size > quota && view->web_context) {
+        g_info("Disk cache of account %s has grown to %" G_GUINT64_FORMAT " MiB, clearing it",
+                view->account->id, *size / 1024 / 1024);
+        webkit_website_data_manager_clear(
+                webkit_web_context_get_website_data_manager(view->web_context),
+                WEBKIT_WEBSITE_DATA_DISK_CACHE | WEBKIT_WEBSITE_DATA_OFFLINE_APPLICATION_CACHE, 0,
+                NULL, NULL, NULL);
+    }
+    g_free(size);
+}
+
+
+static gboolean
+melange_account_view_check_cache(MelangeAccountView *view) {
+    if (!view->cache_check_cancellable
+            && melange_app_get_account_cache_quota(view->app, view->account) > 0) {
+        view->cache_check_cancellable = g_cancellable_new();
+        GTask *task = g_task_new(view, view->cache_check_cancellable,
+                melange_account_view_cache_measured, NULL);
+        g_task_set_task_data(task, g_strdup(view->cache_path), g_free);
+        g_task_run_in_thread(task, melange_account_view_measure_cache_thread);
+        g_object_unref(task);
+    }
+
+    view->cache_check = g_timeout_add_seconds(MELANGE_ACCOUNT_VIEW_CACHE_CHECK_INTERVAL,
+            (GSourceFunc) melange_account_view_check_cache, view);
+    return G_SOURCE_REMOVE;
+}
+
+
+static void
+melange_account_view_cancel_cache_check(MelangeAccountView *view) {
+    if (view->cache_check) {
+        g_source_remove(view->cache_check);
+        view->cache_check = 0;
+    }
+    if (view->cache_check_cancellable) {
+        g_cancellable_cancel(view->cache_check_cancellable);
+        g_clear_object(&view->cache_check_cancellable);
+    }
+}
+
+
+// Accounts used to keep website data and cache in a single directory below the cache dir. Moves
+// it to the data dir and the cache back. Returns FALSE if the old directory has to stay in use.
+static gboolean
+melange_account_view_migrate_legacy_directory(const char *data_path, const char *cache_path) {
+    if (g_file_test(data_path, G_FILE_TEST_EXISTS)
+            || !g_file_test(cache_path, G_FILE_TEST_IS_DIR)) return TRUE;
+
+    char *data_parent = g_path_get_dirname(data_path);
+    g_mkdir_with_parents(data_parent, 0700);
+    g_free(data_parent);
+    if (g_rename(cache_path, data_path) != 0) {
+        g_warning("Unable to move website data from %s to %s: %s", cache_path, data_path,
+                g_strerror(errno));
+        return FALSE;
+    }
+
+    // Everything WebKit derives from base-cache-directory
+    static const char *cache_entries[] = { "WebKitCache", "applications", "hsts-storage.sqlite" };
+    g_mkdir_with_parents(cache_path, 0700);
+    for (gsize i = 0; i < G_N_ELEMENTS(cache_entries); ++i) {
+        char *from = g_build_filename(data_path, cache_entries[i], NULL);
+        char *to = g_build_filename(cache_path, cache_entries[i], NULL);
+        if (g_rename(from, to) != 0 && errno != ENOENT) {
+            g_warning("Unable to move %s to %s: %s", from, to, g_strerror(errno));
+        }
+        g_free(to);
+        g_free(from);
+    }
+    g_info("Moved website data of %s to %s", cache_path, data_path);
+    return TRUE;
+}
+
+
+static WebKitCacheModel
+melange_account_view_get_webkit_cache_model(MelangeAccountView *view) {
+    switch (melange_app_get_account_cache_model(view->app, view->account)) {
+        case MELANGE_CACHE_MODEL_DOCUMENT_VIEWER:
+            return WEBKIT_CACHE_MODEL_DOCUMENT_VIEWER;
+        case MELANGE_CACHE_MODEL_DOCUMENT_BROWSER:
+            return WEBKIT_CACHE_MODEL_DOCUMENT_BROWSER;
+        default:
+            return WEBKIT_CACHE_MODEL_WEB_BROWSER;
+    }
+}
+
+
+void
+melange_account_view_load(MelangeAccountView *view) {
+    if (view->snapshot_cancellable) {
+        // Still waiting for a snapshot to hibernate, keep the current web view
+        g_cancellable_cancel(view->snapshot_cancellable);
+        g_clear_object(&view->snapshot_cancellable);
+    }
+    view->last_used = g_get_monotonic_time();
+    if (view->web_view) return;
+
+    if (view->placeholder) {
+        gtk_widget_destroy(view->placeholder);
+        view->placeholder = NULL;
+    }
+
+    view->trace_load_begin = MELANGE_TRACE_BEGIN();
+    view->loaded_at = g_get_monotonic_time();
+    view->memory_baseline = 0;
+    MelangeAccount *account = view->account;
+    char *data_path = g_build_filename(g_get_user_data_dir(), "melange", "accounts", account->id,
+            NULL);
+    g_free(view->cache_path);
+    view->cache_path = g_build_filename(g_get_user_cache_dir(), "melange", "accounts",
+            account->id, NULL);
+    if (!melange_account_view_migrate_legacy_directory(data_path, view->cache_path)) {
+        g_free(data_path);
+        data_path = g_strdup(view->cache_path);
+    }
+
+    // Each web view has its own data manager and web context to allow multiple accounts of the
+    // same messenger
+
+    WebKitWebsiteDataManager *data_manager = webkit_website_data_manager_new(
+            "base-data-directory", data_path,
+            "base-cache-directory", view->cache_path,
+            NULL);
+
+    g_free(data_path);
+
+    view->web_context = webkit_web_context_new_with_website_data_manager(data_manager);
+    g_object_unref(data_manager);
+    webkit_web_context_set_cache_model(view->web_context,
+            melange_account_view_get_webkit_cache_model(view));
+    webkit_web_context_set_web_extensions_directory(view->web_context,
+            melange_app_get_web_extension_dir(view->app));
+    view->cache_check = g_timeout_add_seconds(MELANGE_ACCOUNT_VIEW_CACHE_CHECK_DELAY,
+            (GSourceFunc) melange_account_view_check_cache, view);
+
+    WebKitSecurityOrigin *origin = webkit_security_origin_new_for_uri(
+            melange_account_get_service_url(account));
+    GList *allowed_origins = g_list_append(NULL, origin);
+    webkit_web_context_initialize_notification_permissions(view->web_context, allowed_origins,
+            NULL);
+    g_list_free_full(allowed_origins, (GDestroyNotify) webkit_security_origin_unref);
+
+    WebKitUserContentManager *content_manager = webkit_user_content_manager_new();
+    webkit_user_content_manager_register_script_message_handler(content_manager, "unread");
+    g_signal_connect(content_manager, "script-message-received::unread",
+            G_CALLBACK(melange_account_view_unread_message_received), view);
+    melange_app_add_user_content(view->app, account, content_manager);
+
+    view->web_view = g_object_new(WEBKIT_TYPE_WEB_VIEW,
+            "web-context", view->web_context,
+            "user-content-manager", content_manager,
+            NULL);
+    g_object_unref(content_manager);
+    g_signal_connect(view->web_view, "context-menu",
+            G_CALLBACK(melange_account_view_web_view_context_menu), view);
+    g_signal_connect(view->web_view, "decide-policy",
+            G_CALLBACK(melange_account_view_web_view_decide_policy), view);
+    g_signal_connect(view->web_view, "web-process-terminated",
+            G_CALLBACK(melange_account_view_web_view_web_process_terminated), view);
+    g_signal_connect(view->web_view, "notify::is-web-process-responsive",
+            G_CALLBACK(melange_account_view_web_view_notify_is_web_process_responsive), view);
+    g_signal_connect(view->web_view, "load-changed",
+            G_CALLBACK(melange_account_view_web_view_load_changed_after_restart), view);
+    g_signal_connect(view->web_view, "load-failed",
+            G_CALLBACK(melange_account_view_web_view_load_failed), view);
+    g_signal_connect(view->web_view, "user-message-received",
+            G_CALLBACK(melange_account_view_web_view_user_message_received), view);
+    if (melange_trace_active) {
+        g_signal_connect(view->web_view, "load-changed",
+                G_CALLBACK(melange_account_view_web_view_load_changed), view);
+    }
+
+    WebKitSettings *sett = webkit_web_view_get_settings(WEBKIT_WEB_VIEW(view->web_view));
+    webkit_settings_set_user_agent(sett, melange_account_get_user_agent(account));
+    webkit_settings_set_enable_java(sett, FALSE);
+    webkit_settings_set_enable_offline_web_application_cache(sett, TRUE);
+    webkit_settings_set_enable_plugins(sett, FALSE);
+    webkit_settings_set_enable_developer_extras(sett, FALSE);
+
+    gtk_box_pack_start(GTK_BOX(view), view->web_view, TRUE, TRUE, 0);
+    gtk_widget_show_all(view->web_view);
+
+    // Let the main window hook up notifications and downloads before the first request is made
+    g_signal_emit_by_name(view, "web-view-created", view->web_view);
+
+    webkit_web_view_load_uri(WEBKIT_WEB_VIEW(view->web_view),
+            melange_account_get_service_url(account));
+    MELANGE_TRACE_END(view->trace_load_begin, "account-view-create", account->id);
+}
+
+
+static void
+melange_account_view_release_web_view(MelangeAccountView *view) {
+    melange_account_view_cancel_cache_check(view);
+    melange_account_view_cancel_watchdog(view);
+
+    // Destroying the web view terminates its web process, dropping the last reference to the
+    // web context shuts down the network process
+    gtk_widget_destroy(view->web_view);
+    view->web_view = NULL;
+    view->web_process_id = 0;
+    g_clear_object(&view->web_context);
+}
+
+
+static void
+melange_account_view_snapshot_ready(GObject *web_view, GAsyncResult *result,
+        MelangeAccountView *view) {
+    GError *error = NULL;
+    cairo_surface_t *snapshot = webkit_web_view_get_snapshot_finish(WEBKIT_WEB_VIEW(web_view),
+            result, &error);
+
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        // The account was selected again in the meantime, or the view destroyed
+        g_error_free(error);
+        g_object_unref(view);
+        return;
+    }
+
+    if (error) {
+        g_info("Unable to take snapshot of %s before hibernating: %s", view->account->id,
+                error->message);
+        g_error_free(error);
+    }
+
+    g_clear_object(&view->snapshot_cancellable);
+    melange_account_view_release_web_view(view);
+
+    view->placeholder = snapshot ? gtk_image_new_from_surface(snapshot) : gtk_image_new();
+    gtk_box_pack_start(GTK_BOX(view), view->placeholder, TRUE, TRUE, 0);
+    gtk_widget_show(view->placeholder);
+    if (snapshot) {
+        cairo_surface_destroy(snapshot);
+    }
+
+    g_info("Hibernated account %s", view->account->id);
+    g_object_unref(view);
+}
+
+
+void
+melange_account_view_hibernate(MelangeAccountView *view) {
+    if (!view->web_view || view->snapshot_cancellable) return;
+
+    view->snapshot_cancellable = g_cancellable_new();
+    webkit_web_view_get_snapshot(WEBKIT_WEB_VIEW(view->web_view), WEBKIT_SNAPSHOT_REGION_VISIBLE,
+            WEBKIT_SNAPSHOT_OPTIONS_NONE, view->snapshot_cancellable,
+            (GAsyncReadyCallback) melange_account_view_snapshot_ready, g_object_ref(view));
+}
+
+
+// Resident set size from /proc, 0 if the process is gone
+static guint64
+melange_account_view_read_resident_memory(GPid pid) {
+    char *file_name = g_strdup_printf("/proc/%d/statm", (int) pid);
+    char *contents = NULL;
+    guint64 resident = 0;
+    // "<size> <resident> <shared> ...", in pages
+    if (g_file_get_contents(file_name, &contents, NULL, NULL)) {
+        const char *field = strchr(contents, ' ');
+        if (field) {
+            resident = g_ascii_strtoull(field + 1, NULL, 10) * (guint64) sysconf(_SC_PAGESIZE);
+        }
+    }
+    g_free(contents);
+    g_free(file_name);
+    return resident;
+}
+
+
+guint64
+melange_account_view_sample_memory_growth(MelangeAccountView *view) {
+    if (!view->web_view || !view->web_process_id
+            || g_get_monotonic_time() - view->loaded_at
+                    < MELANGE_ACCOUNT_VIEW_MEMORY_SETTLE * G_USEC_PER_SEC) return 0;
+
+    guint64 resident = melange_account_view_read_resident_memory(view->web_process_id);
+    if (!resident) return 0;
+
+    if (!view->memory_baseline) {
+        view->memory_baseline = resident;
+        if (view->recycled_memory) {
+            g_message("Recycled account %s: %" G_GUINT64_FORMAT " MiB before, %" G_GUINT64_FORMAT
+                    " MiB after", view->account->id, view->recycled_memory / 1048576,
+                    resident / 1048576);
+            view->recycled_memory = 0;
+        }
+        return 0;
+    }
+    return resident > view->memory_baseline ? resident - view->memory_baseline : 0;
+}
+
+
+void
+melange_account_view_recycle(MelangeAccountView *view) {
+    if (!view->web_view || view->snapshot_cancellable) return;
+
+    view->recycled_memory = view->web_process_id
+            ? melange_account_view_read_resident_memory(view->web_process_id) : 0;
+    g_message("Recycling account %s at %" G_GUINT64_FORMAT " MiB, %" G_GUINT64_FORMAT
+            " MiB above its settled size", view->account->id, view->recycled_memory / 1048576,
+            (view->recycled_memory - MIN(view->recycled_memory, view->memory_baseline)) / 1048576);
+
+    // Not a use of the account, hibernation should not be put off by it
+    gint64 last_used = view->last_used;
+    melange_account_view_release_web_view(view);
+    melange_account_view_load(view);
+    view->last_used = last_used;
+
+    // Like after a crash, the fresh page reports 0 unread messages until it has synced
+    view->holding_unread = TRUE;
+    view->held_unread = -1;
+}
+
+
+gboolean
+melange_account_view_needs_reconnect(MelangeAccountView *view) {
+    return view->web_view && (view->reload_deferred || view->load_failed);
+}
+
+
+gboolean
+melange_account_view_reconnect(MelangeAccountView *view) {
+    gboolean load_failed = view->load_failed;
+    gboolean reload_deferred = view->reload_deferred;
+    view->load_failed = FALSE;
+    view->reload_deferred = FALSE;
+
+    // Not a use of the account, like melange_account_view_recycle()
+    gint64 last_used = view->last_used;
+    gboolean reconnecting = TRUE;
+    if (view->placeholder) {
+        melange_account_view_load(view);
+    } else if (view->snapshot_cancellable) {
+        // Woken up before the snapshot was taken, the page reconnects by itself
+        melange_account_view_load(view);
+        reconnecting = FALSE;
+    } else if (view->web_view && load_failed) {
+        // Reloading would only reload the error page
+        g_info("Loading account %s again now that the network is back", view->account->id);
+        webkit_web_view_load_uri(WEBKIT_WEB_VIEW(view->web_view),
+                melange_account_get_service_url(view->account));
+    } else if (view->web_view && reload_deferred) {
+        melange_account_view_restart_web_process(view);
+    } else {
+        reconnecting = FALSE;
+    }
+    view->last_used = last_used;
+    return reconnecting;
+}
+
+
+MelangeAccount *
+melange_account_view_get_account(MelangeAccountView *view) {
+    return view->account;
+}
+
+
+WebKitWebView *
+melange_account_view_get_web_view(MelangeAccountView *view) {
+    return view->web_view ? WEBKIT_WEB_VIEW(view->web_view) : NULL;
+}
+
+
+MelangeAccountView *
+melange_account_view_for_web_view(WebKitWebView *web_view) {
+    return MELANGE_ACCOUNT_VIEW(gtk_widget_get_parent(GTK_WIDGET(web_view)));
+}
+
+
+gboolean
+melange_account_view_is_loaded(MelangeAccountView *view) {
+    return view->web_view != NULL;
+}
+
+
+gboolean
+melange_account_view_is_hibernated(MelangeAccountView *view) {
+    return view->placeholder != NULL;
+}
+
+
+void
+melange_account_view_mark_used(MelangeAccountView *view) {
+    view->last_used = g_get_monotonic_time();
+}
+
+
+gint64
+melange_account_view_get_idle_time(MelangeAccountView *view) {
+    return (g_get_monotonic_time() - view->last_used) / G_USEC_PER_SEC;
+}
+
+
+// The main window destroys the view right before its account is freed, while a snapshot or the
+// timers referring to the account may still be pending
+static void
+melange_account_view_dispose(GObject *obj) {
+    MelangeAccountView *view = MELANGE_ACCOUNT_VIEW(obj);
+    if (view->snapshot_cancellable) {
+        g_cancellable_cancel(view->snapshot_cancellable);
+        g_clear_object(&view->snapshot_cancellable);
+    }
+    melange_account_view_cancel_cache_check(view);
+    melange_account_view_cancel_watchdog(view);
+
+    G_OBJECT_CLASS(melange_account_view_parent_class)->dispose(obj);
+}
+
+
+static void
+melange_account_view_finalize(GObject *obj) {
+    MelangeAccountView *view = MELANGE_ACCOUNT_VIEW(obj);
+    melange_account_view_cancel_cache_check(view);
+    melange_account_view_cancel_watchdog(view);
+    g_clear_object(&view->web_context);
+    g_free(view->cache_path);
+
+    G_OBJECT_CLASS(melange_account_view_parent_class)->finalize(obj);
+}
+
+
+static void
+melange_account_view_init(MelangeAccountView *view) {
+    view->web_context = NULL;
+    view->web_view = NULL;
+    view->placeholder = NULL;
+    view->snapshot_cancellable = NULL;
+    view->cache_path = NULL;
+    view->cache_check = 0;
+    view->cache_check_cancellable = NULL;
+    view->hang_timeout = 0;
+    view->restart_timeout = 0;
+    view->restarts = 0;
+    view->total_restarts = 0;
+    view->last_restart = 0;
+    view->holding_unread = FALSE;
+    view->held_unread = -1;
+    view->unread_hold_timeout = 0;
+    view->reload_deferred = FALSE;
+    view->load_failed = FALSE;
+    view->web_process_id = 0;
+    view->loaded_at = 0;
+    view->memory_baseline = 0;
+    view->recycled_memory = 0;
+    view->last_used = g_get_monotonic_time();
+    gtk_orientable_set_orientation(GTK_ORIENTABLE(view), GTK_ORIENTATION_VERTICAL);
+}
+
+
+static void
+melange_account_view_class_init(MelangeAccountViewClass *cls) {
+    GObjectClass *object_class = G_OBJECT_CLASS(cls);
+    object_class->set_property = melange_account_view_set_property;
+    object_class->dispose = melange_account_view_dispose;
+    object_class->finalize = melange_account_view_finalize;
+
+    GParamFlags property_flags = G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE | G_PARAM_STATIC_NAME
+            | G_PARAM_STATIC_NICK | G_PARAM_STATIC_BLURB;
+    g_object_class_install_property(object_class, MELANGE_ACCOUNT_VIEW_PROP_APP,
+            g_param_spec_pointer("app", "app-context", "app", property_flags));
+    g_object_class_install_property(object_class, MELANGE_ACCOUNT_VIEW_PROP_ACCOUNT,
+            g_param_spec_pointer("account", "account", "account", property_flags));
+
+    g_signal_new("web-view-created", MELANGE_TYPE_ACCOUNT_VIEW, G_SIGNAL_RUN_LAST, 0, NULL, NULL,
+            NULL, G_TYPE_NONE, 1, WEBKIT_TYPE_WEB_VIEW);
+    g_signal_new("unread-messages-changed", MELANGE_TYPE_ACCOUNT_VIEW, G_SIGNAL_RUN_LAST, 0, NULL,
+            NULL, NULL, G_TYPE_NONE, 1, G_TYPE_INT);
+}
+
+
+GtkWidget *
+melange_account_view_new(MelangeApp *app, MelangeAccount *account) {
+    g_return_val_if_fail(MELANGE_IS_APP(app), NULL);
+
+    return g_object_new(MELANGE_TYPE_ACCOUNT_VIEW,
+            "app", app,
+            "account", account,
+            NULL);
+}
@@ -0,0 +1,64 @@
+#ifndef MELANGE_ACCOUNTVIEW_H
+#define MELANGE_ACCOUNTVIEW_H
+
+#include "app.h"
+
+
+typedef struct MelangeAccountView MelangeAccountView;
+
+#define MELANGE_TYPE_ACCOUNT_VIEW (melange_account_view_get_type())
+#define MELANGE_ACCOUNT_VIEW(obj) \
+        (G_TYPE_CHECK_INSTANCE_CAST((obj), MELANGE_TYPE_ACCOUNT_VIEW, MelangeAccountView))
+#define MELANGE_IS_ACCOUNT_VIEW(inst) \
+        (G_TYPE_CHECK_INSTANCE_TYPE((inst), MELANGE_TYPE_ACCOUNT_VIEW))
+
+
+GtkWidget *melange_account_view_new(MelangeApp *app, MelangeAccount *account);
+
+GType melange_account_view_get_type(void);
+
+MelangeAccount *melange_account_view_get_account(MelangeAccountView *view);
+
+// Returns NULL as long as the view has not been loaded
+WebKitWebView *melange_account_view_get_web_view(MelangeAccountView *view);
+
+// The account view a web view created by melange_account_view_load() belongs to
+MelangeAccountView *melange_account_view_for_web_view(WebKitWebView *web_view);
+
+gboolean melange_account_view_is_loaded(MelangeAccountView *view);
+
+gboolean melange_account_view_is_hibernated(MelangeAccountView *view);
+
+// Record that the user has just been looking at this view
+void melange_account_view_mark_used(MelangeAccountView *view);
+
+// Monotonic time in seconds since the view was last loaded or marked as used
+gint64 melange_account_view_get_idle_time(MelangeAccountView *view);
+
+// Creates web context and web view and starts loading the service URL. Does nothing if the
+// view is already loaded. Emits "web-view-created".
+void melange_account_view_load(MelangeAccountView *view);
+
+// Samples the resident memory of the web process. Returns by how many bytes it has grown since the
+// page settled after loading, 0 if that is not known yet.
+guint64 melange_account_view_sample_memory_growth(MelangeAccountView *view);
+
+// Reloads the account in a fresh web context and web process to get rid of leaked memory. The
+// unread count is kept until the new page has caught up.
+void melange_account_view_recycle(MelangeAccountView *view);
+
+// Whether the page has failed to load, or a restart after a crash has been put off, because the
+// network was unavailable
+gboolean melange_account_view_needs_reconnect(MelangeAccountView *view);
+
+// Brings the account back after the network returned or the machine resumed: loads it if it has
+// been hibernated, reloads it if melange_account_view_needs_reconnect(). Returns FALSE if there
+// was nothing to do, otherwise the page is loading.
+gboolean melange_account_view_reconnect(MelangeAccountView *view);
+
+// Replaces the web view by a snapshot of its last contents and releases web context and web
+// process. melange_account_view_load() brings the account back.
+void melange_account_view_hibernate(MelangeAccountView *view);
+
+
+#endif // MELANGE_ACCOUNTVIEW_H
@@ -2,17 +2,34 @@
 #include "util.h"
 #include "presets.h"
 #include "mainwindow.h"
+#include "configwriter.h"
+#include "iconcache.h"
+#include "iconfetcher.h"
+#include "notifier.h"
+#include "maintenance.h"
+#include "resourcelimits.h"
+#include "trace.h"
 
-#include <string.h>
-#include <errno.h>
-#include <libnotify/notify.h>
+#include <libsoup/soup.h>
+#include <stdlib.h>
+#include <glib-unix.h>
+#include <signal.h>
+
+
+// Style sheet and scripts injected into every web view of one preset. Any member can be NULL.
+typedef struct MelangeAppUserContent {
+    WebKitUserStyleSheet *style_sheet;
+    WebKitUserScript *script;
+    WebKitUserScript *unread_probe;
+} MelangeAppUserContent;
 
 
 struct MelangeApp {
     GtkApplication parent_instance;
 
-    // Path containing the files in res/, either that or install path (/usr/local/share/...)
-    const char *resource_base_path;
+    // Development override: Load res/ files from this directory instead of the compiled-in
+    // GResource bundle. Set from $MELANGE_RESOURCE_DIR, NULL otherwise.
+    char *resource_override_dir;
 
     GtkStatusIcon *status_icon;
     GtkWidget *status_menu;
@@ -23,17 +40,45 @@ struct MelangeApp {
     GdkPixbuf **notify_icons;
     int unread_messages;
 
-    // Ephemeral web context for fetching icons
-    WebKitWebContext *web_context;
-
     MelangeConfig *config;
     char *config_file_name;
+    MelangeConfigWriter *config_writer;
+
+    // Reloads the config when it is changed by someone else
+    GFileMonitor *config_monitor;
+    guint config_reload_timeout;
+    GCancellable *config_reload_cancellable;
+    // Set while a reloaded config is applied, which must not be written back
+    gboolean applying_config;
 
     // Usually ~/.cache/melange/icons
     char *icon_cache_dir;
 
-    // Maps account->preset->id to GdkPixbuf* messenger icons
+    // Rasterized SVG resources, usually ~/.cache/melange/icon-atlas
+    MelangeIconCache *raster_cache;
+
+    // Favicon downloads, independent of any web context
+    MelangeIconFetcher *icon_fetcher;
+
+    // Maps icon ids (see melange_app_get_icon_id) to GdkPixbuf* messenger icons
     GHashTable *icon_table;
+    // Set of icon ids that have been requested, so accounts sharing an icon load it only once
+    GHashTable *icon_requests;
+    // Cancels icon decoding still running on worker threads when shutting down
+    GCancellable *icon_cancellable;
+
+    // Coalesces message notifications per account
+    MelangeNotifier *notifier;
+
+    // Places web processes into cgroups or systemd scopes
+    MelangeResourceLimits *resource_limits;
+    // Holds the web extension that reports web process ids, see src/webextension.c
+    char *web_extension_dir;
+
+    // Maps account->preset->id to MelangeAppUserContent*
+    GHashTable *user_content_table;
+    // For custom accounts
+    MelangeAppUserContent *default_user_content;
 };
 
 
@@ -44,18 +89,40 @@ enum {
     MELANGE_APP_PROP_DARK_THEME = 1,
     MELANGE_APP_PROP_CLIENT_SIDE_DECORATIONS,
     MELANGE_APP_PROP_AUTO_HIDE_SIDEBAR,
+    MELANGE_APP_PROP_LOAD_ACCOUNTS,
+    MELANGE_APP_PROP_HIBERNATE_AFTER,
+    MELANGE_APP_PROP_RECYCLE_THRESHOLD,
+    MELANGE_APP_PROP_NOTIFICATION_WINDOW,
+    MELANGE_APP_PROP_CACHE_MODEL,
+    MELANGE_APP_PROP_CACHE_QUOTA,
     MELANGE_APP_PROP_UNREAD_MESSAGES,
-    MELANGE_APP_PROP_EXECUTABLE_FILE,
     MELANGE_APP_N_PROPS
 };
 
 
-// Closure for icon download request via webkit
-typedef struct MelangeAppIconDownloadContext {
+// Task data for decoding a messenger icon on a worker thread
+typedef struct MelangeAppIconLoadContext {
     MelangeApp *app;
-    const MelangeAccount *preset;
-    gboolean failed;
-} MelangeAppIconDownloadContext;
+    char *icon_id;
+    char *icon_url;
+    char *file_name;
+
+    // Freshly downloaded icon to be stored in file_name before decoding, or NULL
+    GBytes *data;
+
+    // Fall back to fetching the icon from the web if the cached file can't be decoded
+    gboolean download_on_failure;
+
+    // For tracing the download, 0 while tracing is disabled
+    gint64 download_begin;
+} MelangeAppIconLoadContext;
+
+
+// Simultaneous favicon downloads
+#define MELANGE_APP_MAX_ICON_DOWNLOADS 4
+
+// Saving a file often produces several change events, reload once they have settled down
+#define MELANGE_APP_CONFIG_RELOAD_DELAY 250
 
 
 G_DEFINE_TYPE(MelangeApp, melange_app, GTK_TYPE_APPLICATION)
@@ -89,6 +156,51 @@ melange_app_get_property(GObject *object, guint property_id, GValue *value, GPar
             }
             break;
 
+        case MELANGE_APP_PROP_LOAD_ACCOUNTS:
+            switch (app->config->load_accounts) {
+                case MELANGE_LOAD_EAGER:
+                    g_value_set_string(value, "eager");
+                    break;
+                case MELANGE_LOAD_ON_DEMAND:
+                    g_value_set_string(value, "on-demand");
+                    break;
+                case MELANGE_LOAD_BACKGROUND:
+                    g_value_set_string(value, "background");
+                    break;
+            }
+            break;
+
+        case MELANGE_APP_PROP_HIBERNATE_AFTER:
+            g_value_set_uint(value, app->config->hibernate_after);
+            break;
+
+        case MELANGE_APP_PROP_RECYCLE_THRESHOLD:
+            g_value_set_uint(value, app->config->recycle_threshold);
+            break;
+
+        case MELANGE_APP_PROP_NOTIFICATION_WINDOW:
+            g_value_set_uint(value, app->config->notification_window);
+            break;
+
+        case MELANGE_APP_PROP_CACHE_MODEL:
+            switch (app->config->cache_model) {
+                case MELANGE_CACHE_MODEL_DOCUMENT_VIEWER:
+                    g_value_set_string(value, "document-viewer");
+                    break;
+                case MELANGE_CACHE_MODEL_DOCUMENT_BROWSER:
+                    g_value_set_string(value, "document-browser");
+                    break;
+                case MELANGE_CACHE_MODEL_DEFAULT:
+                case MELANGE_CACHE_MODEL_WEB_BROWSER:
+                    g_value_set_string(value, "web-browser");
+                    break;
+            }
+            break;
+
+        case MELANGE_APP_PROP_CACHE_QUOTA:
+            g_value_set_uint(value, app->config->cache_quota);
+            break;
+
         case MELANGE_APP_PROP_UNREAD_MESSAGES:
             g_value_set_int(value, app->unread_messages);
             break;
@@ -130,9 +242,56 @@ melange_app_set_property(GObject *object, guint property_id, const GValue *value
             break;
         }
 
+        case MELANGE_APP_PROP_LOAD_ACCOUNTS: {
+            const char *str_value = g_value_get_string(value);
+            if (g_str_equal(str_value, "eager")) {
+                app->config->load_accounts = MELANGE_LOAD_EAGER;
+            } else if (g_str_equal(str_value, "on-demand")) {
+                app->config->load_accounts = MELANGE_LOAD_ON_DEMAND;
+            } else if (g_str_equal(str_value, "background")) {
+                app->config->load_accounts = MELANGE_LOAD_BACKGROUND;
+            } else {
+                g_warning("Invalid value for property load-accounts: %s", str_value);
+            }
+            break;
+        }
+
+        case MELANGE_APP_PROP_HIBERNATE_AFTER:
+            app->config->hibernate_after = g_value_get_uint(value);
+            break;
+
+        case MELANGE_APP_PROP_RECYCLE_THRESHOLD:
+            app->config->recycle_threshold = g_value_get_uint(value);
+            break;
+
+        case MELANGE_APP_PROP_NOTIFICATION_WINDOW:
+            app->config->notification_window = g_value_get_uint(value);
+            break;
+
+        case MELANGE_APP_PROP_CACHE_MODEL: {
+            const char *str_value = g_value_get_string(value);
+            if (g_str_equal(str_value, "document-viewer")) {
+                app->config->cache_model = MELANGE_CACHE_MODEL_DOCUMENT_VIEWER;
+            } else if (g_str_equal(str_value, "document-browser")) {
+                app->config->cache_model = MELANGE_CACHE_MODEL_DOCUMENT_BROWSER;
+            } else if (g_str_equal(str_value, "web-browser")) {
+                app->config->cache_model = MELANGE_CACHE_MODEL_WEB_BROWSER;
+            } else {
+                g_warning("Invalid value for property cache-model: %s", str_value);
+            }
+            break;
+        }
+
+        case MELANGE_APP_PROP_CACHE_QUOTA:
+            app->config->cache_quota = g_value_get_uint(value);
+            break;
+
         case MELANGE_APP_PROP_UNREAD_MESSAGES: {
+            int old_icon_index = MIN(app->unread_messages, 10);
             app->unread_messages = g_value_get_int(value);
+            MELANGE_TRACE_COUNTER("unread-messages", app->unread_messages);
             int icon_index = MIN(app->unread_messages, 10);
+            if (icon_index == old_icon_index) return;
 
             if (app->main_window) {
                 gtk_window_set_icon(GTK_WINDOW(app->main_window), app->notify_icons[icon_index]);
@@ -145,38 +304,7 @@ melange_app_set_property(GObject *object, guint property_id, const GValue *value
             }
 #pragma GCC diagnostic pop
 
-            break;
-        }
-
-        case MELANGE_APP_PROP_EXECUTABLE_FILE: {
-            const char *executable = g_value_get_string(value);
-            if (strncmp(executable, MELANGE_INSTALL_PREFIX, strlen(MELANGE_INSTALL_PREFIX)) == 0) {
-                // I'm an installed copy of melange
-                app->resource_base_path = g_build_path(G_DIR_SEPARATOR_S, MELANGE_INSTALL_PREFIX,
-                        "share/melange", NULL);
-            } else {
-                // I'm probably being run from source.  Walk up the directory tree, looking for the
-                // first parent with a res/ subdirectory
-                char *path = g_malloc(strlen(executable) + 4);
-                strcpy(path, executable);
-                while (TRUE) {
-                    char *separator = strrchr(path, G_DIR_SEPARATOR);
-                    if (!separator) {
-                        g_warning("Could not find resource base path, tried every parent of %s",
-                                executable);
-                        g_free(path);
-                        return;
-                    }
-                    strcpy(separator, "/res");
-                    if (g_file_test(path, G_FILE_TEST_IS_DIR)) {
-                        g_info("App does not seem to be installed. Using resource base path %s",
-                                path);
-                        app->resource_base_path = path;
-                        break;
-                    }
-                    *separator = '\0';
-                }
-            }
+            // Changes with every message and is not part of the config, do not persist
             return;
         }
 
@@ -185,7 +313,9 @@ melange_app_set_property(GObject *object, guint property_id, const GValue *value
             return;
     }
 
-    melange_config_write_to_file(app->config, app->config_file_name);
+    if (!app->applying_config) {
+        melange_config_writer_schedule(app->config_writer);
+    }
 }
 
 
@@ -228,56 +358,235 @@ melange_app_main_window_delete_event(GtkWidget *widget, GdkEvent *event, gpointe
 }
 
 
+// Web processes only get the leftover CPU and I/O while nobody is looking at them. WebKit already
+// throttles timers and stops rendering of hidden pages, media is left alone for notification
+// sounds.
+static void
+melange_app_update_background_mode(MelangeApp *app) {
+    if (!app->resource_limits) return;
+
+    GdkWindow *window = gtk_widget_get_window(app->main_window);
+    gboolean background = !gtk_widget_get_visible(app->main_window) || (window
+            && (gdk_window_get_state(window) & GDK_WINDOW_STATE_ICONIFIED));
+    melange_resource_limits_set_background(app->resource_limits, background);
+}
+
+
+static void
+melange_app_main_window_notify_visible(GObject *object, GParamSpec *pspec, gpointer user_data) {
+    (void) object;
+    (void) pspec;
+
+    melange_app_update_background_mode(MELANGE_APP(user_data));
+}
+
+
 static gboolean
-melange_app_decide_icon_destination(WebKitDownload *download, gchar *suggested_filename,
-        MelangeAppIconDownloadContext *context) {
-    (void) suggested_filename;
+melange_app_main_window_window_state_event(GtkWidget *widget, GdkEventWindowState *event,
+        gpointer user_data) {
+    (void) widget;
 
-    char *uri = g_strdup_printf("file://%s/%s.ico", context->app->icon_cache_dir,
-            context->preset->id);
-    webkit_download_set_destination(download, uri);
-    g_free(uri);
+    if (event->changed_mask & GDK_WINDOW_STATE_ICONIFIED) {
+        melange_app_update_background_mode(MELANGE_APP(user_data));
+    }
+    return FALSE;
+}
 
-    return TRUE;
+
+// Only connected while tracing
+static gboolean
+melange_app_main_window_map_event(GtkWidget *widget, GdkEvent *event, gpointer user_data) {
+    (void) widget;
+    (void) event;
+    (void) user_data;
+
+    MELANGE_TRACE_MARK("window-shown", NULL);
+    return FALSE;
 }
 
 
+static gboolean
+melange_app_quit_signal(gpointer user_data) {
+    g_application_quit(G_APPLICATION(user_data));
+    return G_SOURCE_CONTINUE;
+}
+
+
+static void
+melange_app_icon_load_context_free(MelangeAppIconLoadContext *context) {
+    g_free(context->icon_id);
+    g_free(context->icon_url);
+    g_free(context->file_name);
+    if (context->data) g_bytes_unref(context->data);
+    g_free(context);
+}
+
+
+// Runs on a worker thread, so it must not touch the app
 static void
-melange_app_icon_download_failed(WebKitDownload *download, GError *error,
-        MelangeAppIconDownloadContext *context) {
-    (void) download;
-    (void) error;
+melange_app_load_icon_thread(GTask *task, gpointer source_object, gpointer task_data,
+        GCancellable *cancellable) {
+    (void) source_object;
+    (void) cancellable;
+
+    MelangeAppIconLoadContext *context = task_data;
+    gint64 trace_begin = MELANGE_TRACE_BEGIN();
 
-    g_warning("Unable to download favicon from %s: %s", context->preset->icon_url, error->message);
-    context->failed = TRUE;
+    GError *error = NULL;
+    if (context->data) {
+        gsize size;
+        const char *data = g_bytes_get_data(context->data, &size);
+        if (!g_file_set_contents(context->file_name, data, (gssize) size, &error)) {
+            g_task_return_error(task, error);
+            return;
+        }
+    }
+
+    GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_size(context->file_name, 32, 32, &error);
+    MELANGE_TRACE_END(trace_begin, "icon-decode", context->icon_id);
+    if (pixbuf) {
+        g_task_return_pointer(task, pixbuf, g_object_unref);
+    } else {
+        g_task_return_error(task, error);
+    }
 }
 
 
+static void melange_app_run_icon_task(MelangeApp *app, MelangeAppIconLoadContext *context);
+
+
 static void
-melange_app_icon_download_finished(WebKitDownload *download,
-        MelangeAppIconDownloadContext *context) {
-    (void) download;
+melange_app_icon_downloaded(GBytes *data, const GError *error, gpointer user_data) {
+    MelangeAppIconLoadContext *context = user_data;
+    MELANGE_TRACE_END(context->download_begin, "icon-download", context->icon_url);
+    if (data) {
+        context->data = g_bytes_ref(data);
+        melange_app_run_icon_task(context->app, context);
+    } else {
+        g_warning("Unable to download favicon from %s: %s", context->icon_url, error->message);
+        melange_app_icon_load_context_free(context);
+    }
+}
 
-    if (context->failed) goto cleanup;
 
-    // Save as .ico file (similar to favicon.ico), the actual extension does not matter
-    char *file_name = g_strdup_printf("%s/%s.ico", context->app->icon_cache_dir,
-            context->preset->id);
+// Back on the main thread once the worker has finished decoding
+static void
+melange_app_icon_loaded(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    (void) user_data;
+
+    MelangeApp *app = MELANGE_APP(source_object);
+    MelangeAppIconLoadContext *context = g_task_get_task_data(G_TASK(result));
 
     GError *error = NULL;
-    GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_size(file_name, 32, 32, &error);
+    GdkPixbuf *pixbuf = g_task_propagate_pointer(G_TASK(result), &error);
     if (pixbuf) {
-        g_hash_table_insert(context->app->icon_table, (gpointer) context->preset->id, pixbuf);
-        g_signal_emit_by_name(context->app, "icon-available", context->preset->id, pixbuf);
+        g_hash_table_insert(app->icon_table, g_strdup(context->icon_id), pixbuf);
+        if (app->notifier) {
+            // The file may just have been downloaded
+            melange_notifier_forget_icon(app->notifier, context->icon_id);
+        }
+        g_signal_emit_by_name(app, "icon-available", context->icon_id, pixbuf);
+    } else if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        // Shutting down
+    } else if (context->download_on_failure) {
+        MelangeAppIconLoadContext download_template = {
+                .app = app,
+                .icon_id = g_strdup(context->icon_id),
+                .icon_url = g_strdup(context->icon_url),
+                .file_name = g_strdup(context->file_name),
+                .data = NULL,
+                .download_on_failure = FALSE,
+                .download_begin = MELANGE_TRACE_BEGIN(),
+        };
+        melange_icon_fetcher_fetch(app->icon_fetcher, context->icon_url,
+                melange_app_icon_downloaded,
+                g_memdup(&download_template, sizeof download_template),
+                (GDestroyNotify) melange_app_icon_load_context_free);
     } else {
-        g_warning("Unable to load favicon file %s: %s", file_name, error->message);
-        g_error_free(error);
+        g_warning("Unable to load favicon file %s: %s", context->file_name, error->message);
     }
+    g_clear_error(&error);
+}
 
-    g_free(file_name);
 
-    cleanup:
-    g_free(context);
+// Takes ownership of context
+static void
+melange_app_run_icon_task(MelangeApp *app, MelangeAppIconLoadContext *context) {
+    GTask *task = g_task_new(app, app->icon_cancellable, melange_app_icon_loaded, NULL);
+    g_task_set_task_data(task, context, (GDestroyNotify) melange_app_icon_load_context_free);
+    g_task_set_return_on_cancel(task, TRUE);
+    g_task_run_in_thread(task, melange_app_load_icon_thread);
+    g_object_unref(task);
+}
+
+
+char *
+melange_app_get_icon_id(const MelangeAccount *account) {
+    if (account->preset) {
+        return g_strdup(account->preset->id);
+    }
+
+    // Custom accounts share the icon of their host
+    SoupURI *uri = soup_uri_new(melange_account_get_service_url(account));
+    char *host = NULL;
+    if (uri && uri->host && *uri->host) {
+        host = g_ascii_strdown(uri->host, -1);
+    }
+    if (uri) soup_uri_free(uri);
+    return host;
+}
+
+
+static char *
+melange_app_get_icon_url(const MelangeAccount *account) {
+    const char *icon_url = melange_account_get_icon_url(account);
+    if (icon_url && *icon_url) {
+        return g_strdup(icon_url);
+    }
+
+    // No icon configured, so guess the usual location
+    SoupURI *uri = soup_uri_new(melange_account_get_service_url(account));
+    if (!uri) return NULL;
+
+    soup_uri_set_path(uri, "/favicon.ico");
+    soup_uri_set_query(uri, NULL);
+    soup_uri_set_fragment(uri, NULL);
+    char *icon_url = soup_uri_to_string(uri, FALSE);
+    soup_uri_free(uri);
+    return icon_url;
+}
+
+
+// Decodes ~/.cache/melange/icons/<icon id>.ico on the worker pool, downloads it if necessary and
+// emits "icon-available" when done. Does nothing if the icon has already been requested.
+static void
+melange_app_update_icon(MelangeApp *app, const MelangeAccount *account) {
+    char *icon_id = melange_app_get_icon_id(account);
+    char *icon_url = melange_app_get_icon_url(account);
+    if (!icon_id || !icon_url || g_hash_table_contains(app->icon_requests, icon_id)) {
+        g_free(icon_id);
+        g_free(icon_url);
+        return;
+    }
+    g_hash_table_add(app->icon_requests, g_strdup(icon_id));
+
+    MelangeAppIconLoadContext context_template = {
+            .app = app,
+            .icon_id = icon_id,
+            .icon_url = icon_url,
+            // Save as .ico file (similar to favicon.ico), the actual extension does not matter
+            .file_name = g_strdup_printf("%s/%s.ico", app->icon_cache_dir, icon_id),
+            .data = NULL,
+            .download_on_failure = TRUE,
+            .download_begin = 0,
+    };
+    melange_app_run_icon_task(app, g_memdup(&context_template, sizeof context_template));
+}
+
+
+static void
+melange_app_update_account_icon(const MelangeAccount *account, MelangeApp *app) {
+    melange_app_update_icon(app, account);
 }
 
 
@@ -285,44 +594,118 @@ static void
 melange_app_start_updating_icons(MelangeApp *app) {
     g_mkdir_with_parents(app->icon_cache_dir, 0777);
 
+    // Until icons are available, windows show a placeholder and are updated through
+    // "icon-available". Presets are needed for the "add service" grid as well.
     for (size_t i = 0; i < melange_n_account_presets; ++i) {
         const MelangeAccount *preset = &melange_account_presets[i];
+        MelangeAccount preset_account = {
+                .id = preset->id,
+                .preset = preset,
+        };
+        melange_app_update_icon(app, &preset_account);
+    }
+    melange_app_iterate_accounts(app, melange_app_update_account_icon, app);
+}
 
-        // Lookup from ~/.cache/melange/icons first
-        char *file_name = g_strdup_printf("%s/%s.ico", app->icon_cache_dir, preset->id);
-        GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_size(file_name, 32, 32, NULL);
+
+static void
+melange_app_user_content_free(MelangeAppUserContent *content) {
+    if (content) {
+        if (content->style_sheet) webkit_user_style_sheet_unref(content->style_sheet);
+        if (content->script) webkit_user_script_unref(content->script);
+        if (content->unread_probe) webkit_user_script_unref(content->unread_probe);
+        g_free(content);
+    }
+}
+
+
+// Reads css/<id>.css, js/<id>.js and js/unread/<id>.js for a preset, or only the default unread
+// probe for custom accounts (preset_id == NULL)
+static MelangeAppUserContent *
+melange_app_load_user_content(MelangeApp *app, const char *preset_id) {
+    MelangeAppUserContent *content = g_malloc0(sizeof *content);
+    char *probe_js = NULL;
+
+    if (preset_id) {
+        // Style sheets are applied before the first layout, so there is no restyle flash
+        char *file_name = g_strdup_printf("css/%s.css", preset_id);
+        char *css = melange_app_load_text_resource(app, file_name, TRUE, NULL);
+        if (css) {
+            content->style_sheet = webkit_user_style_sheet_new(css,
+                    WEBKIT_USER_CONTENT_INJECT_TOP_FRAME, WEBKIT_USER_STYLE_LEVEL_USER, NULL, NULL);
+            g_free(css);
+        }
         g_free(file_name);
 
-        if (pixbuf) {
-            g_hash_table_insert(app->icon_table, (gpointer) preset->id, pixbuf);
-            continue;
+        file_name = g_strdup_printf("js/%s.js", preset_id);
+        char *js = melange_app_load_text_resource(app, file_name, TRUE, NULL);
+        if (js) {
+            content->script = webkit_user_script_new(js, WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+                    WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START, NULL, NULL);
+            g_free(js);
         }
+        g_free(file_name);
 
-        // If not available, download
-        WebKitDownload *download = webkit_web_context_download_uri(app->web_context,
-                preset->icon_url);
+        file_name = g_strdup_printf("js/unread/%s.js", preset_id);
+        probe_js = melange_app_load_text_resource(app, file_name, TRUE, NULL);
+        g_free(file_name);
+    }
 
-        MelangeAppIconDownloadContext context_template = {
-                .app = app,
-                .preset = preset,
-                .failed = FALSE,
-        };
+    // Presets without their own probe fall back to parsing the page title
+    if (!probe_js) {
+        probe_js = melange_app_load_text_resource(app, "js/unread/default.js", FALSE, NULL);
+    }
 
-        MelangeAppIconDownloadContext *context = g_memdup(&context_template,
-                sizeof context_template);
+    // The probe needs the DOM, so it runs once the document has been parsed
+    char *common_js = melange_app_load_text_resource(app, "js/unread/probe.js", FALSE, NULL);
+    char *source = g_strconcat(common_js, "\n", probe_js, NULL);
+    content->unread_probe = webkit_user_script_new(source, WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+            WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_END, NULL, NULL);
+    g_free(source);
+    g_free(common_js);
+    g_free(probe_js);
 
-        g_signal_connect(download, "decide-destination",
-                G_CALLBACK(melange_app_decide_icon_destination), context);
-        g_signal_connect(download, "failed", G_CALLBACK(melange_app_icon_download_failed), context);
-        g_signal_connect(download, "finished", G_CALLBACK(melange_app_icon_download_finished),
-                context);
+    return content;
+}
+
+
+static void
+melange_app_load_all_user_content(MelangeApp *app) {
+    for (size_t i = 0; i < melange_n_account_presets; ++i) {
+        const char *id = melange_account_presets[i].id;
+        g_hash_table_insert(app->user_content_table, (gpointer) id,
+                melange_app_load_user_content(app, id));
+    }
+    app->default_user_content = melange_app_load_user_content(app, NULL);
+}
+
+
+void
+melange_app_add_user_content(MelangeApp *app, const MelangeAccount *account,
+        WebKitUserContentManager *content_manager) {
+    MelangeAppUserContent *content = NULL;
+    if (account->preset) {
+        content = g_hash_table_lookup(app->user_content_table, account->preset->id);
+    }
+    if (!content) {
+        content = app->default_user_content;
+    }
+
+    if (content->style_sheet) {
+        webkit_user_content_manager_add_style_sheet(content_manager, content->style_sheet);
+    }
+    if (content->script) {
+        webkit_user_content_manager_add_script(content_manager, content->script);
+    }
+    if (content->unread_probe) {
+        webkit_user_content_manager_add_script(content_manager, content->unread_probe);
     }
 }
 
 
 GdkPixbuf *
-melange_app_request_icon(MelangeApp *app, const char *hostname) {
-    GdkPixbuf *lookup = g_hash_table_lookup(app->icon_table, hostname);
+melange_app_request_icon(MelangeApp *app, const char *icon_id) {
+    GdkPixbuf *lookup = g_hash_table_lookup(app->icon_table, icon_id);
     return lookup;
 }
 
@@ -330,7 +713,11 @@ melange_app_request_icon(MelangeApp *app, const char *hostname) {
 gboolean
 melange_app_add_account(MelangeApp *app, MelangeAccount *account) {
     if (melange_config_add_account(app->config, account)) {
-        melange_config_write_to_file(app->config, app->config_file_name);
+        if (!app->applying_config) {
+            melange_config_writer_schedule(app->config_writer);
+        }
+        melange_app_update_icon(app, account);
+        g_signal_emit_by_name(app, "account-added", account);
         return TRUE;
     } else {
         return FALSE;
@@ -338,77 +725,401 @@ melange_app_add_account(MelangeApp *app, MelangeAccount *account) {
 }
 
 
+gboolean
+melange_app_remove_account(MelangeApp *app, const char *id) {
+    MelangeAccount *account = melange_config_lookup_account(app->config, id);
+    if (!account) return FALSE;
+
+    // Views let go of the account before it is freed
+    g_signal_emit_by_name(app, "account-removed", account);
+    melange_config_remove_account(app->config, id);
+    if (!app->applying_config) {
+        melange_config_writer_schedule(app->config_writer);
+    }
+    return TRUE;
+}
+
+
+char *
+melange_app_new_account_id(MelangeApp *app, const char *prefix) {
+    // A new account must not pick up the logins and website data of a removed one, which
+    // outlive the session unless --maintenance has cleaned them up
+    while (TRUE) {
+        char *id = melange_config_new_account_id(app->config, prefix);
+        char *data_path = g_build_filename(g_get_user_data_dir(), "melange", "accounts", id, NULL);
+        char *cache_path = g_build_filename(g_get_user_cache_dir(), "melange", "accounts", id,
+                NULL);
+        gboolean taken = g_file_test(data_path, G_FILE_TEST_EXISTS)
+                || g_file_test(cache_path, G_FILE_TEST_EXISTS);
+        g_free(cache_path);
+        g_free(data_path);
+        if (!taken || !melange_config_reserve_account_id(app->config, id)) return id;
+
+        g_info("Not reusing account id %s, its web data is still around", id);
+        g_free(id);
+    }
+}
+
+
 void
 melange_app_iterate_accounts(MelangeApp *app, MelangeAccountConstFunc func, gpointer user_data) {
     melange_config_for_each_account(app->config, (MelangeAccountFunc) func, user_data);
 }
 
 
-char *
-melange_app_get_resource_path(MelangeApp *app, const char *resource) {
-    return g_build_path(G_DIR_SEPARATOR_S, app->resource_base_path, resource, NULL);
+// A config file read and parsed on a worker thread
+typedef struct MelangeAppConfigReload {
+    char *contents;
+    MelangeConfig *config;
+} MelangeAppConfigReload;
+
+
+static void
+melange_app_config_reload_free(MelangeAppConfigReload *reload) {
+    g_free(reload->contents);
+    if (reload->config) {
+        melange_config_free(reload->config);
+    }
+    g_free(reload);
+}
+
+
+static gint
+melange_app_compare_account_positions(gconstpointer lhs, gconstpointer rhs, gpointer positions) {
+    guint l = GPOINTER_TO_UINT(g_hash_table_lookup(positions,
+            (*(MelangeAccount *const *) lhs)->id));
+    guint r = GPOINTER_TO_UINT(g_hash_table_lookup(positions,
+            (*(MelangeAccount *const *) rhs)->id));
+    return (l > r) - (l < r);
+}
+
+
+// Brings the running config in line with new_config, which is consumed in the process. Views are
+// only created or torn down for accounts that were added, removed or changed their service, all
+// other accounts keep their web processes and sessions.
+static void
+melange_app_apply_config(MelangeApp *app, MelangeConfig *new_config) {
+    gint64 trace_begin = MELANGE_TRACE_BEGIN();
+    MelangeConfig *config = app->config;
+    app->applying_config = TRUE;
+
+    // Settings go through the properties, so that side effects and notifications take place
+    if (new_config->dark_theme != config->dark_theme) {
+        g_object_set(app, "dark-theme", new_config->dark_theme, NULL);
+    }
+    if (new_config->auto_hide_sidebar != config->auto_hide_sidebar) {
+        g_object_set(app, "auto-hide-sidebar", new_config->auto_hide_sidebar, NULL);
+    }
+    if (new_config->client_side_decorations != config->client_side_decorations) {
+        config->client_side_decorations = new_config->client_side_decorations;
+        g_object_notify(G_OBJECT(app), "client-side-decorations");
+    }
+    if (new_config->load_accounts != config->load_accounts) {
+        config->load_accounts = new_config->load_accounts;
+        g_object_notify(G_OBJECT(app), "load-accounts");
+    }
+    if (new_config->hibernate_after != config->hibernate_after) {
+        g_object_set(app, "hibernate-after", new_config->hibernate_after, NULL);
+    }
+    if (new_config->recycle_threshold != config->recycle_threshold) {
+        g_object_set(app, "recycle-threshold", new_config->recycle_threshold, NULL);
+    }
+    if (new_config->notification_window != config->notification_window) {
+        g_object_set(app, "notification-window", new_config->notification_window, NULL);
+    }
+    if (new_config->cache_model != config->cache_model) {
+        config->cache_model = new_config->cache_model;
+        g_object_notify(G_OBJECT(app), "cache-model");
+    }
+    if (new_config->cache_quota != config->cache_quota) {
+        g_object_set(app, "cache-quota", new_config->cache_quota, NULL);
+    }
+    // Applies to web processes started from now on
+    config->resource_limits = new_config->resource_limits;
+
+    // Accounts that are gone or point to a different service lose their views. Details that are
+    // looked up on demand are updated in place.
+    GPtrArray *ids = g_ptr_array_new_with_free_func(g_free);
+    for (guint i = 0; i < config->accounts->len; ++i) {
+        MelangeAccount *account = g_array_index(config->accounts, MelangeAccount *, i);
+        MelangeAccount *new_account = melange_config_lookup_account(new_config, account->id);
+        if (!new_account || !melange_account_equal_service(account, new_account)) {
+            g_ptr_array_add(ids, g_strdup(account->id));
+        } else {
+            account->keep_alive = new_account->keep_alive;
+            account->notification_window = new_account->notification_window;
+            account->cache_model = new_account->cache_model;
+            account->cache_quota = new_account->cache_quota;
+        }
+    }
+    for (guint i = 0; i < ids->len; ++i) {
+        melange_app_remove_account(app, g_ptr_array_index(ids, i));
+    }
+    g_ptr_array_set_size(ids, 0);
+
+    // Keys point into the accounts, which stay alive when moved over to the running config
+    GHashTable *positions = g_hash_table_new(g_str_hash, g_str_equal);
+    for (guint i = 0; i < new_config->accounts->len; ++i) {
+        MelangeAccount *new_account = g_array_index(new_config->accounts, MelangeAccount *, i);
+        g_hash_table_insert(positions, new_account->id, GUINT_TO_POINTER(i));
+        if (!melange_config_lookup_account(config, new_account->id)) {
+            g_ptr_array_add(ids, g_strdup(new_account->id));
+        }
+    }
+    for (guint i = 0; i < ids->len; ++i) {
+        melange_app_add_account(app,
+                melange_config_steal_account(new_config, g_ptr_array_index(ids, i)));
+    }
+
+    g_array_sort_with_data(config->accounts, melange_app_compare_account_positions, positions);
+    g_signal_emit_by_name(app, "accounts-reordered");
+
+    g_hash_table_destroy(positions);
+    g_ptr_array_free(ids, TRUE);
+    app->applying_config = FALSE;
+    MELANGE_TRACE_END(trace_begin, "config-apply", NULL);
+}
+
+
+static void
+melange_app_read_config_thread(GTask *task, gpointer source_object, gpointer task_data,
+        GCancellable *cancellable) {
+    (void) source_object;
+    (void) cancellable;
+
+    const char *file_name = task_data;
+    MelangeAppConfigReload *reload = g_malloc0(sizeof *reload);
+    gsize length;
+    GError *error = NULL;
+    if (g_file_get_contents(file_name, &reload->contents, &length, &error)) {
+        reload->config = melange_config_new_from_data(reload->contents, length, file_name,
+                &error);
+    }
+
+    if (reload->config) {
+        g_task_return_pointer(task, reload, (GDestroyNotify) melange_app_config_reload_free);
+    } else {
+        melange_app_config_reload_free(reload);
+        g_task_return_error(task, error);
+    }
+}
+
+
+static void
+melange_app_config_read(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    (void) user_data;
+
+    GError *error = NULL;
+    MelangeAppConfigReload *reload = g_task_propagate_pointer(G_TASK(result), &error);
+    if (!reload) {
+        // The running config stays in place until the file is fixed
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)
+                && !g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            g_warning("Not reloading configuration: %s", error->message);
+        }
+        g_error_free(error);
+        return;
+    }
+
+    MelangeApp *app = MELANGE_APP(source_object);
+    if (!melange_config_writer_wrote(app->config_writer, reload->contents)) {
+        melange_app_apply_config(app, reload->config);
+        melange_config_writer_set_applied(app->config_writer, reload->contents);
+    }
+    melange_app_config_reload_free(reload);
+}
+
+
+// Parsing happens on a worker thread, only the differences are applied on the main thread
+static gboolean
+melange_app_config_reload_timeout(MelangeApp *app) {
+    app->config_reload_timeout = 0;
+
+    GTask *task = g_task_new(app, app->config_reload_cancellable, melange_app_config_read, NULL);
+    g_task_set_task_data(task, g_strdup(app->config_file_name), g_free);
+    g_task_run_in_thread(task, melange_app_read_config_thread);
+    g_object_unref(task);
+    return G_SOURCE_REMOVE;
+}
+
+
+static void
+melange_app_config_file_changed(GFileMonitor *monitor, GFile *file, GFile *other_file,
+        GFileMonitorEvent event, MelangeApp *app) {
+    (void) monitor;
+    (void) file;
+    (void) other_file;
+
+    // In-place writes end with CHANGES_DONE_HINT, atomic replacements show up as CREATED
+    if (event != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT && event != G_FILE_MONITOR_EVENT_CREATED) {
+        return;
+    }
+
+    if (app->config_reload_timeout) {
+        g_source_remove(app->config_reload_timeout);
+    }
+    app->config_reload_timeout = g_timeout_add(MELANGE_APP_CONFIG_RELOAD_DELAY,
+            (GSourceFunc) melange_app_config_reload_timeout, app);
+}
+
+
+GFile *
+melange_app_get_resource_file(MelangeApp *app, const char *resource) {
+    if (app->resource_override_dir) {
+        char *path = g_build_filename(app->resource_override_dir, resource, NULL);
+        GFile *file = g_file_new_for_path(path);
+        g_free(path);
+        return file;
+    } else {
+        char *uri = g_strconcat("resource://" MELANGE_RESOURCE_PREFIX "/", resource, NULL);
+        GFile *file = g_file_new_for_uri(uri);
+        g_free(uri);
+        return file;
+    }
+}
+
+
+// Identifies a rasterization of the current version of resource. Bundled resources have no
+// modification time, so their contents are hashed instead, which needs no copy or parsing.
+static char *
+melange_app_get_raster_cache_key(MelangeApp *app, const char *resource, gint width, gint height,
+        gint scale) {
+    guint64 stamp = 0;
+    if (app->resource_override_dir) {
+        GFile *file = melange_app_get_resource_file(app, resource);
+        GFileInfo *info = g_file_query_info(file, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                G_FILE_QUERY_INFO_NONE, NULL, NULL);
+        if (info) {
+            stamp = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+            g_object_unref(info);
+        }
+        g_object_unref(file);
+    } else {
+        char *path = g_strconcat(MELANGE_RESOURCE_PREFIX "/", resource, NULL);
+        GBytes *bytes = g_resources_lookup_data(path, G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
+        if (bytes) {
+            stamp = (guint64) g_bytes_get_size(bytes) << 32 | g_bytes_hash(bytes);
+            g_bytes_unref(bytes);
+        }
+        g_free(path);
+    }
+    return g_strdup_printf("%s@%dx%d@%d:%" G_GINT64_MODIFIER "x", resource, width, height, scale,
+            stamp);
 }
 
 
 GdkPixbuf *
 melange_app_load_pixbuf_resource(MelangeApp *app, const char *resource, gint width, gint height,
         gboolean allow_failure) {
+    // Icons are not rendered for HiDPI yet, so everything is rasterized at scale 1
+    gint64 trace_begin = MELANGE_TRACE_BEGIN();
+    char *key = melange_app_get_raster_cache_key(app, resource, width, height, 1);
+    GdkPixbuf *pixbuf = melange_icon_cache_lookup(app->raster_cache, key);
+    if (pixbuf) {
+        MELANGE_TRACE_END(trace_begin, "pixbuf-resource-cached", resource);
+        g_free(key);
+        return pixbuf;
+    }
+
     GError *error = NULL;
-    char *path = melange_app_get_resource_path(app, resource);
-    GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_size(path, width, height, &error);
-    if (!pixbuf && !allow_failure) {
-        g_error("Unable to load pixbuf resource from %s: %s", path, error->message);
+    GFile *file = melange_app_get_resource_file(app, resource);
+
+    // Streams from the GResource bundle read directly from the mapped binary
+    GFileInputStream *stream = g_file_read(file, NULL, &error);
+    if (stream) {
+        pixbuf = gdk_pixbuf_new_from_stream_at_scale(G_INPUT_STREAM(stream), width, height, TRUE,
+                NULL, &error);
+        g_object_unref(stream);
+    }
+    if (pixbuf) {
+        melange_icon_cache_insert(app->raster_cache, key, pixbuf);
+    } else if (!allow_failure) {
+        g_error("Unable to load pixbuf resource %s: %s", resource, error->message);
     }
-    g_free(path);
+    g_clear_error(&error);
+    g_object_unref(file);
+    g_free(key);
+    MELANGE_TRACE_END(trace_begin, "pixbuf-resource-rasterize", resource);
     return pixbuf;
 }
 
 
 GtkBuilder *
 melange_app_load_ui_resource(MelangeApp *app, const char *resource, gboolean allow_failure) {
-    char *path = melange_app_get_resource_path(app, resource);
-    GtkBuilder *ui = gtk_builder_new_from_file(path);
-    if (!ui && !allow_failure) {
-        g_error("Unable to load ui resource from %s: %s", path, g_strerror(errno));
+    gint64 trace_begin = MELANGE_TRACE_BEGIN();
+    GtkBuilder *ui = NULL;
+    gsize length;
+    char *text = melange_app_load_text_resource(app, resource, allow_failure, &length);
+    if (text) {
+        ui = gtk_builder_new_from_string(text, (gssize) length);
+        g_free(text);
     }
-    g_free(path);
+    MELANGE_TRACE_END(trace_begin, "builder-load", resource);
     return ui;
 }
 
 
 char *
-melange_app_load_text_resource(MelangeApp *app, const char *resource, gboolean allow_failure) {
+melange_app_load_text_resource(MelangeApp *app, const char *resource, gboolean allow_failure,
+        gsize *length) {
     GError *error = NULL;
-    char *path = melange_app_get_resource_path(app, resource);
     char *text = NULL;
-    if (!g_file_get_contents(path, &text, NULL, &error) && !allow_failure) {
-        g_error("Unable to load text resource from %s: %s", path, error->message);
+    GFile *file = melange_app_get_resource_file(app, resource);
+    if (!g_file_load_contents(file, NULL, &text, length, NULL, &error) && !allow_failure) {
+        g_error("Unable to load text resource %s: %s", resource, error->message);
     }
-    g_free(path);
+    g_clear_error(&error);
+    g_object_unref(file);
     return text;
 }
 
 
 void
-melange_app_show_message_notification(MelangeApp *app, const char *title, const char *body,
-        const char *service) {
-    char *icon_path = NULL;
-    if (service) {
-        icon_path = g_strdup_printf("%s/%s.ico", app->icon_cache_dir, service);
-        if (!g_file_test(icon_path, G_FILE_TEST_IS_REGULAR)) {
-            g_free(icon_path);
-            icon_path = NULL;
-        }
-    }
-    if (!icon_path) {
-        icon_path = melange_app_get_resource_path(app, "icons/melange.svg");
-    }
+melange_app_show_message_notification(MelangeApp *app, const MelangeAccount *account,
+        const char *title, const char *body) {
+    gint64 trace_begin = MELANGE_TRACE_BEGIN();
+
+    guint window = account->notification_window > 0
+            ? account->notification_window : app->config->notification_window;
+    char *icon_id = melange_app_get_icon_id(account);
+    melange_notifier_post(app->notifier, account->id, icon_id, window * 1000, title, body);
+    g_free(icon_id);
+
+    MELANGE_TRACE_END(trace_begin, "notification", account->id);
+}
+
+
+void
+melange_app_clear_message_notifications(MelangeApp *app, const MelangeAccount *account) {
+    melange_notifier_clear(app->notifier, account->id);
+}
+
+
+MelangeCacheModel
+melange_app_get_account_cache_model(MelangeApp *app, const MelangeAccount *account) {
+    return account->cache_model != MELANGE_CACHE_MODEL_DEFAULT
+            ? account->cache_model : app->config->cache_model;
+}
+
+
+guint
+melange_app_get_account_cache_quota(MelangeApp *app, const MelangeAccount *account) {
+    return account->cache_quota > 0 ? account->cache_quota : app->config->cache_quota;
+}
 
-    NotifyNotification *notification = notify_notification_new(title, body, icon_path);
-    notify_notification_show(notification, NULL);
-    g_object_unref(notification);
 
-    g_free(icon_path);
+const char *
+melange_app_get_web_extension_dir(MelangeApp *app) {
+    return app->web_extension_dir;
+}
+
+
+void
+melange_app_apply_resource_limits(MelangeApp *app, const MelangeAccount *account, GPid pid) {
+    if (app->resource_limits) {
+        melange_resource_limits_apply(app->resource_limits, app->config->resource_limits, account,
+                pid);
+    }
 }
 
 
@@ -425,11 +1136,41 @@ melange_app_startup(GApplication *g_app) {
     G_APPLICATION_CLASS(melange_app_parent_class)->startup(g_app);
 
     MelangeApp *app = MELANGE_APP(g_app);
+    gint64 trace_begin = MELANGE_TRACE_BEGIN();
+
+    char *raster_cache_file = g_strdup_printf("%s/melange/icon-atlas", g_get_user_cache_dir());
+    app->raster_cache = melange_icon_cache_new(raster_cache_file);
+    g_free(raster_cache_file);
 
     app->config = melange_config_new_from_file(app->config_file_name);
+    // Writing the empty replacement of a file that exists but cannot be parsed would lose every
+    // account in it
+    gboolean config_broken = !app->config
+            && g_file_test(app->config_file_name, G_FILE_TEST_EXISTS);
     if (!app->config) {
         app->config = melange_config_new();
     }
+    app->config_writer = melange_config_writer_new(app->config, app->config_file_name);
+    if (config_broken) {
+        g_warning("Not saving any changes until %s can be parsed", app->config_file_name);
+        melange_config_writer_suspend(app->config_writer);
+    }
+
+    // Before the first web process is spawned
+    app->resource_limits = melange_resource_limits_new();
+    melange_resource_limits_prepare(app->resource_limits, app->config->resource_limits);
+
+    GError *error = NULL;
+    GFile *config_file = g_file_new_for_path(app->config_file_name);
+    app->config_monitor = g_file_monitor_file(config_file, G_FILE_MONITOR_NONE, NULL, &error);
+    if (app->config_monitor) {
+        g_signal_connect(app->config_monitor, "changed",
+                G_CALLBACK(melange_app_config_file_changed), app);
+    } else {
+        g_warning("Unable to watch %s for changes: %s", app->config_file_name, error->message);
+        g_error_free(error);
+    }
+    g_object_unref(config_file);
 
     GtkBuilder *builder = melange_app_load_ui_resource(app, "ui/app.glade", FALSE);
     gtk_builder_connect_signals(builder, app);
@@ -471,6 +1212,8 @@ melange_app_startup(GApplication *g_app) {
         }
     }
 
+    app->notifier = melange_notifier_new(app->icon_cache_dir, app->notify_icons[0]);
+
     gtk_about_dialog_set_logo(GTK_ABOUT_DIALOG(app->about_dialog),
             melange_app_load_pixbuf_resource(app, "icons/melange.svg", 128, 128, FALSE));
     gtk_about_dialog_set_version(GTK_ABOUT_DIALOG(app->about_dialog), "Version " MELANGE_VERSION);
@@ -484,9 +1227,11 @@ melange_app_startup(GApplication *g_app) {
 
 #pragma GCC diagnostic pop
 
-    app->web_context = webkit_web_context_new_ephemeral();
+    app->icon_fetcher = melange_icon_fetcher_new(MELANGE_APP_MAX_ICON_DOWNLOADS);
     melange_app_start_updating_icons(app);
 
+    melange_app_load_all_user_content(app);
+
     // MainWindow icon and title are always set from outside
     app->main_window = melange_main_window_new(app);
     gtk_window_set_icon(GTK_WINDOW(app->main_window), app->notify_icons[icon_index]);
@@ -494,14 +1239,72 @@ melange_app_startup(GApplication *g_app) {
     g_signal_connect_swapped(app->main_window, "destroy", G_CALLBACK(g_application_quit), app);
     g_signal_connect(app->main_window, "delete-event",
             G_CALLBACK(melange_app_main_window_delete_event), NULL);
+    g_signal_connect(app->main_window, "notify::visible",
+            G_CALLBACK(melange_app_main_window_notify_visible), app);
+    g_signal_connect(app->main_window, "window-state-event",
+            G_CALLBACK(melange_app_main_window_window_state_event), app);
+    if (melange_trace_active) {
+        g_signal_connect(app->main_window, "map-event",
+                G_CALLBACK(melange_app_main_window_map_event), NULL);
+    }
     gtk_widget_show_all(app->main_window);
     gtk_application_add_window(GTK_APPLICATION(app), GTK_WINDOW(app->main_window));
+
+    // Everything needed for startup is rasterized by now
+    melange_icon_cache_save(app->raster_cache);
+
+    // Quit cleanly on SIGTERM and SIGINT, so that pending config writes and traces are flushed
+    g_unix_signal_add(SIGTERM, melange_app_quit_signal, app);
+    g_unix_signal_add(SIGINT, melange_app_quit_signal, app);
+
+    MELANGE_TRACE_END(trace_begin, "startup", NULL);
 }
 
 
 static void
-melange_app_shutdown(GApplication *app) {
-    G_APPLICATION_CLASS(melange_app_parent_class)->shutdown(app);
+melange_app_shutdown(GApplication *g_app) {
+    MelangeApp *app = MELANGE_APP(g_app);
+    if (app->config_writer) {
+        melange_config_writer_flush(app->config_writer);
+    }
+    if (app->raster_cache) {
+        melange_icon_cache_save(app->raster_cache);
+    }
+    g_cancellable_cancel(app->icon_cancellable);
+    g_cancellable_cancel(app->config_reload_cancellable);
+    if (app->config_reload_timeout) {
+        g_source_remove(app->config_reload_timeout);
+        app->config_reload_timeout = 0;
+    }
+    if (app->config_monitor) {
+        g_signal_handlers_disconnect_by_data(app->config_monitor, app);
+        g_clear_object(&app->config_monitor);
+    }
+    melange_icon_fetcher_free(app->icon_fetcher);
+    app->icon_fetcher = NULL;
+    melange_notifier_free(app->notifier);
+    app->notifier = NULL;
+    melange_resource_limits_free(app->resource_limits);
+    app->resource_limits = NULL;
+
+    G_APPLICATION_CLASS(melange_app_parent_class)->shutdown(g_app);
+}
+
+
+// Handles options that must take effect before startup, before the primary instance is contacted
+static gint
+melange_app_handle_local_options(GApplication *app, GVariantDict *options) {
+    const char *trace;
+    if (g_variant_dict_lookup(options, "trace", "&s", &trace) && !melange_trace_enable(trace)) {
+        return EXIT_FAILURE;
+    }
+
+    // Runs to completion without ever starting up the application
+    if (g_variant_dict_contains(options, "maintenance")) {
+        return melange_maintenance_run(g_application_get_application_id(app),
+                MELANGE_APP(app)->config_file_name, g_variant_dict_contains(options, "dry-run"));
+    }
+    return -1;
 }
 
 
@@ -514,9 +1317,18 @@ melange_app_activate(GApplication *app) {
 static void
 melange_app_finalize(GObject *g_app) {
     MelangeApp *app = MELANGE_APP(g_app);
+    melange_config_writer_free(app->config_writer);
+    melange_icon_cache_free(app->raster_cache);
     g_free(app->icon_cache_dir);
     g_hash_table_destroy(app->icon_table);
+    g_hash_table_destroy(app->icon_requests);
+    g_object_unref(app->icon_cancellable);
+    g_object_unref(app->config_reload_cancellable);
+    g_hash_table_destroy(app->user_content_table);
+    melange_app_user_content_free(app->default_user_content);
     g_free(app->config_file_name);
+    g_free(app->resource_override_dir);
+    g_free(app->web_extension_dir);
 
     if (app->notify_icons) {
         for (int i = 0; i < 11; ++i) {
@@ -531,9 +1343,41 @@ melange_app_finalize(GObject *g_app) {
 
 static void
 melange_app_init(MelangeApp *app) {
+    g_application_add_main_option(G_APPLICATION(app), "trace", 0, G_OPTION_FLAG_NONE,
+            G_OPTION_ARG_STRING, "Record startup and hot-path tracing, like $MELANGE_TRACE",
+            "chrome[:FILE]|sysprof");
+    g_application_add_main_option(G_APPLICATION(app), "maintenance", 0, G_OPTION_FLAG_NONE,
+            G_OPTION_ARG_NONE, "Report disk usage and clean up website data, then exit", NULL);
+    g_application_add_main_option(G_APPLICATION(app), "dry-run", 0, G_OPTION_FLAG_NONE,
+            G_OPTION_ARG_NONE, "With --maintenance, only print what would be removed", NULL);
+
     app->icon_cache_dir = g_strdup_printf("%s/melange/icons", g_get_user_cache_dir());
-    app->icon_table = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_object_unref);
+    app->icon_table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+    app->icon_requests = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    app->icon_cancellable = g_cancellable_new();
+    app->config_reload_cancellable = g_cancellable_new();
+    app->user_content_table = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+            (GDestroyNotify) melange_app_user_content_free);
     app->config_file_name = g_strdup_printf("%s/melange/config", g_get_user_config_dir());
+
+    const char *resource_dir = g_getenv("MELANGE_RESOURCE_DIR");
+    if (resource_dir && *resource_dir) {
+        g_info("Loading resources from %s instead of the bundled resources", resource_dir);
+        app->resource_override_dir = g_strdup(resource_dir);
+    }
+
+    // Prefer the extension built next to an uninstalled binary
+    char *exe = g_file_read_link("/proc/self/exe", NULL);
+    if (exe) {
+        char *exe_dir = g_path_get_dirname(exe);
+        app->web_extension_dir = g_build_filename(exe_dir, "web-extensions", NULL);
+        g_free(exe_dir);
+        g_free(exe);
+    }
+    if (!app->web_extension_dir || !g_file_test(app->web_extension_dir, G_FILE_TEST_IS_DIR)) {
+        g_free(app->web_extension_dir);
+        app->web_extension_dir = g_strdup(MELANGE_WEB_EXTENSION_DIR);
+    }
 }
 
 
@@ -543,6 +1387,7 @@ melange_app_class_init(MelangeAppClass *cls) {
     application_class->startup = melange_app_startup;
     application_class->shutdown = melange_app_shutdown;
     application_class->activate = melange_app_activate;
+    application_class->handle_local_options = melange_app_handle_local_options;
 
     GObjectClass *object_class = G_OBJECT_CLASS(cls);
     object_class->finalize = melange_app_finalize;
@@ -560,30 +1405,44 @@ melange_app_class_init(MelangeAppClass *cls) {
     property_specs[MELANGE_APP_PROP_CLIENT_SIDE_DECORATIONS] = g_param_spec_string(
             "client-side-decorations", "client-side-decorations", "client-side-decorations",
             "auto", property_flags);
+    property_specs[MELANGE_APP_PROP_LOAD_ACCOUNTS] = g_param_spec_string("load-accounts",
+            "load-accounts", "load-accounts", "eager", property_flags);
+    property_specs[MELANGE_APP_PROP_HIBERNATE_AFTER] = g_param_spec_uint("hibernate-after",
+            "hibernate-after", "hibernate-after", 0, G_MAXUINT, 0, property_flags);
+    property_specs[MELANGE_APP_PROP_RECYCLE_THRESHOLD] = g_param_spec_uint("recycle-threshold",
+            "recycle-threshold", "recycle-threshold", 0, G_MAXUINT, 0, property_flags);
+    property_specs[MELANGE_APP_PROP_NOTIFICATION_WINDOW] = g_param_spec_uint(
+            "notification-window", "notification-window", "notification-window", 0, G_MAXUINT, 3,
+            property_flags);
+    property_specs[MELANGE_APP_PROP_CACHE_MODEL] = g_param_spec_string("cache-model",
+            "cache-model", "cache-model", "web-browser", property_flags);
+    property_specs[MELANGE_APP_PROP_CACHE_QUOTA] = g_param_spec_uint("cache-quota",
+            "cache-quota", "cache-quota", 0, G_MAXUINT, 256, property_flags);
     property_specs[MELANGE_APP_PROP_UNREAD_MESSAGES] = g_param_spec_int(
             "unread-messages", "unread-messages", "unread-messages", 0, INT_MAX, 0, property_flags);
-    property_specs[MELANGE_APP_PROP_EXECUTABLE_FILE] = g_param_spec_string("executable-file",
-            "executable-file", "executable-file", NULL, G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE
-                    | G_PARAM_STATIC_NAME | G_PARAM_STATIC_NICK | G_PARAM_STATIC_BLURB);
 
     g_object_class_install_properties(G_OBJECT_CLASS(cls), MELANGE_APP_N_PROPS, property_specs);
 
     g_signal_new("icon-available", MELANGE_TYPE_APP, G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL,
             G_TYPE_NONE, 2, G_TYPE_STRING, GDK_TYPE_PIXBUF);
+
+    // Carry the MelangeAccount*, which is freed right after "account-removed"
+    g_signal_new("account-added", MELANGE_TYPE_APP, G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL,
+            G_TYPE_NONE, 1, G_TYPE_POINTER);
+    g_signal_new("account-removed", MELANGE_TYPE_APP, G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL,
+            G_TYPE_NONE, 1, G_TYPE_POINTER);
+    // The order of melange_app_iterate_accounts() has changed
+    g_signal_new("accounts-reordered", MELANGE_TYPE_APP, G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL,
+            G_TYPE_NONE, 0);
 }
 
 
 GApplication *
-melange_app_new(const char *executable_file) {
+melange_app_new(void) {
     return g_object_new(MELANGE_TYPE_APP,
-            "executable-file", executable_file,
             "application-id", "de.inforge.melange",
             "register-session", TRUE,
             NULL);
 }
 
 
-WebKitWebContext *
-melange_app_get_web_context(MelangeApp *app) {
-    return app->web_context;
-}
@@ -14,20 +14,39 @@ typedef struct MelangeApp MelangeApp;
 #define MELANGE_IS_APP(inst) (G_TYPE_CHECK_INSTANCE_TYPE ((inst), MELANGE_TYPE_APP))
 
 
-GApplication *melange_app_new(const char *executable_file);
+// Prefix of the GResource bundle compiled from res/melange.gresource.xml
+#define MELANGE_RESOURCE_PREFIX "/de/inforge/melange"
+
+
+GApplication *melange_app_new(void);
 
 GType melange_app_get_type(void);
 
-WebKitWebContext *melange_app_get_web_context(MelangeApp *app);
+// Identifies the messenger icon of an account: The preset id, or the host name for custom accounts.
+// Returns NULL if the account has no usable service URL.
+char *melange_app_get_icon_id(const MelangeAccount *account);
 
-GdkPixbuf *melange_app_request_icon(MelangeApp *app, const char *hostname);
+// NULL if the icon has not been loaded yet. Watch "icon-available" in that case.
+GdkPixbuf *melange_app_request_icon(MelangeApp *app, const char *icon_id);
 
 gboolean melange_app_add_account(MelangeApp *app, MelangeAccount *account);
 
+// Emits "account-removed" and frees the account. Returns FALSE if there is no such account.
+gboolean melange_app_remove_account(MelangeApp *app, const char *id);
+
+// An unused account id such as "whatsapp3", never one that a removed account left web data under
+char *melange_app_new_account_id(MelangeApp *app, const char *prefix);
+
 void melange_app_iterate_accounts(MelangeApp *app, MelangeAccountConstFunc func,
         gpointer user_data);
 
-char *melange_app_get_resource_path(MelangeApp *app, const char *resource);
+// Adds the style sheets and scripts for the account's preset, which are loaded only once and
+// shared between all accounts
+void melange_app_add_user_content(MelangeApp *app, const MelangeAccount *account,
+        WebKitUserContentManager *content_manager);
+
+// A file in res/. Usually a resource:// URI into the bundle compiled into the binary.
+GFile *melange_app_get_resource_file(MelangeApp *app, const char *resource);
 
 GdkPixbuf *melange_app_load_pixbuf_resource(MelangeApp *app, const char *resource,
         gint width, gint height, gboolean allow_failure);
@@ -36,10 +55,27 @@ GtkBuilder *melange_app_load_ui_resource(MelangeApp *app, const char *resource,
         gboolean allow_failure);
 
 char *melange_app_load_text_resource(MelangeApp *app, const char *resource,
-        gboolean allow_failure);
+        gboolean allow_failure, gsize *length);
+
+// Coalesced per account, see MelangeNotifier
+void melange_app_show_message_notification(MelangeApp *app, const MelangeAccount *account,
+        const char *title, const char *body);
+
+// The account has been looked at, start counting its messages over
+void melange_app_clear_message_notifications(MelangeApp *app, const MelangeAccount *account);
+
+// The account's own settings if present, the global ones otherwise
+MelangeCacheModel melange_app_get_account_cache_model(MelangeApp *app,
+        const MelangeAccount *account);
+
+// In MiB, 0 for no limit
+guint melange_app_get_account_cache_quota(MelangeApp *app, const MelangeAccount *account);
+
+// For webkit_web_context_set_web_extensions_directory()
+const char *melange_app_get_web_extension_dir(MelangeApp *app);
 
-void melange_app_show_message_notification(MelangeApp *app, const char *title, const char *body,
-        const char *service);
+// Called with the id of every web process that starts rendering account, see MelangeResourceLimits
+void melange_app_apply_resource_limits(MelangeApp *app, const MelangeAccount *account, GPid pid);
 
 
 #endif // MELANGE_APP_H
@@ -1,13 +1,17 @@
 #include "config.h"
 #include "presets.h"
-#include <stdio.h>
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 
-extern FILE *melange_config_parser_in;
-extern MelangeConfig *melange_config_parser_result;
+// Defined along with the scanner in config.l
+MelangeConfig *melange_config_parse(const char *data, gsize length, const char *file_name,
+        MelangeConfigParseReport *report, GError **error);
 
-int melange_config_parser_parse(void);
+
+G_DEFINE_QUARK(melange-config-error-quark, melange_config_error)
 
 
 MelangeAccount *
@@ -42,6 +46,9 @@ melange_account_free(MelangeAccount *account) {
         g_free(account->service_url);
         g_free(account->icon_url);
         g_free(account->user_agent);
+        g_free(account->cpu_max);
+        g_free(account->memory_high);
+        g_free(account->memory_max);
         g_free(account);
     }
 }
@@ -71,6 +78,20 @@ melange_account_get_user_agent(const MelangeAccount *account) {
 }
 
 
+gboolean
+melange_account_equal_service(const MelangeAccount *a, const MelangeAccount *b) {
+    return g_str_equal(a->id, b->id)
+            && a->preset == b->preset
+            && g_strcmp0(a->service_name, b->service_name) == 0
+            && g_strcmp0(a->service_url, b->service_url) == 0
+            && g_strcmp0(a->icon_url, b->icon_url) == 0
+            && g_strcmp0(a->user_agent, b->user_agent) == 0
+            && g_strcmp0(a->cpu_max, b->cpu_max) == 0
+            && g_strcmp0(a->memory_high, b->memory_high) == 0
+            && g_strcmp0(a->memory_max, b->memory_max) == 0;
+}
+
+
 void
 melange_clear_account_pointer(MelangeAccount **account) {
     melange_account_free(*account);
@@ -83,65 +104,167 @@ melange_config_new(void) {
             .dark_theme = FALSE,
             .client_side_decorations = MELANGE_CSD_AUTO,
             .auto_hide_sidebar = FALSE,
+            .load_accounts = MELANGE_LOAD_EAGER,
+            .hibernate_after = 0,
+            .recycle_threshold = 0,
+            .notification_window = 3,
+            .cache_model = MELANGE_CACHE_MODEL_WEB_BROWSER,
+            .cache_quota = 256,
+            .resource_limits = MELANGE_RESOURCE_LIMITS_OFF,
             .accounts = g_array_new(FALSE, FALSE, sizeof(MelangeAccount *)),
+            .account_index = g_hash_table_new(g_str_hash, g_str_equal),
+            .account_serials = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL),
     };
     g_array_set_clear_func(template.accounts, (GDestroyNotify) melange_clear_account_pointer);
     return g_memdup(&template, sizeof template);
 }
 
 
+MelangeConfig *
+melange_config_new_from_data(const char *data, gsize length, const char *file_name,
+        GError **error) {
+    return melange_config_new_from_data_with_report(data, length, file_name, NULL, error);
+}
+
+
+MelangeConfig *
+melange_config_new_from_data_with_report(const char *data, gsize length, const char *file_name,
+        MelangeConfigParseReport *report, GError **error) {
+    gint64 trace_begin = MELANGE_TRACE_BEGIN();
+    MelangeConfig *config = melange_config_parse(data ? data : "", length, file_name, report,
+            error);
+    MELANGE_TRACE_END(trace_begin, "config-parse", file_name);
+    return config;
+}
+
+
+void
+melange_config_parse_report_clear(MelangeConfigParseReport *report) {
+    g_clear_pointer(&report->account_ids, g_hash_table_destroy);
+    report->dropped_blocks = 0;
+}
+
+
 MelangeConfig *
 melange_config_new_from_file(const char *file_name) {
-    FILE *file = fopen(file_name, "r");
+    GError *error = NULL;
+    GMappedFile *file = g_mapped_file_new(file_name, FALSE, &error);
     if (!file) {
-        if (errno != ENOENT) {
-            g_warning("Unable to open existing config file %s: %s", file_name, g_strerror(errno));
+        if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            g_warning("Unable to open existing config file %s: %s", file_name, error->message);
         }
+        g_error_free(error);
         return NULL;
     }
 
-    // Use bison parser
-    melange_config_parser_in = file;
-    melange_config_parser_result = NULL;
-    int status = melange_config_parser_parse();
+    // Empty files map to NULL contents
+    MelangeConfig *config = melange_config_new_from_data(g_mapped_file_get_contents(file),
+            g_mapped_file_get_length(file), file_name, &error);
+    g_mapped_file_unref(file);
 
-    fclose(file);
-
-    if (status == 0) {
-        return melange_config_parser_result;
-    } else {
-        melange_config_free(melange_config_parser_result);
-        return NULL;
+    if (!config) {
+        g_warning("Unable to parse configuration: %s", error->message);
+        g_error_free(error);
     }
+    return config;
 }
 
 
 void melange_config_free(MelangeConfig *config) {
+    g_hash_table_destroy(config->account_index);
+    g_hash_table_destroy(config->account_serials);
     g_array_free(config->accounts, TRUE);
     g_free(config);
 }
 
 
+// Splits "whatsapp12" into "whatsapp" and 12. Returns NULL if the id does not end in a serial.
+static char *
+melange_config_split_account_id(const char *id, guint *serial) {
+    size_t length = strlen(id);
+    size_t prefix_length = length;
+    while (prefix_length > 0 && g_ascii_isdigit(id[prefix_length - 1])) {
+        --prefix_length;
+    }
+    if (prefix_length == length || length - prefix_length > 9) return NULL;
+
+    *serial = (guint) strtoul(id + prefix_length, NULL, 10);
+    return g_strndup(id, prefix_length);
+}
+
+
 gboolean
-melange_config_add_account(MelangeConfig *config, MelangeAccount *account) {
-    if (!melange_config_lookup_account(config, account->id)) {
-        g_array_append_val(config->accounts, account);
-        return TRUE;
+melange_config_reserve_account_id(MelangeConfig *config, const char *id) {
+    guint serial;
+    char *prefix = melange_config_split_account_id(id, &serial);
+    if (!prefix) return FALSE;
+
+    guint highest = GPOINTER_TO_UINT(g_hash_table_lookup(config->account_serials, prefix));
+    if (serial > highest) {
+        g_hash_table_insert(config->account_serials, prefix, GUINT_TO_POINTER(serial));
     } else {
-        return FALSE;
+        g_free(prefix);
     }
+    return TRUE;
+}
+
+
+gboolean
+melange_config_add_account(MelangeConfig *config, MelangeAccount *account) {
+    if (g_hash_table_contains(config->account_index, account->id)) return FALSE;
+
+    g_hash_table_insert(config->account_index, account->id, account);
+    g_array_append_val(config->accounts, account);
+    melange_config_reserve_account_id(config, account->id);
+    return TRUE;
 }
 
 
 MelangeAccount *
-melange_config_lookup_account(MelangeConfig *config, const char *id) {
-    for (size_t i = 0; i < config->accounts->len; ++i) {
-        MelangeAccount *account = g_array_index(config->accounts, MelangeAccount *, i);
-        if (g_str_equal(account, id)) {
-            return account;
+melange_config_steal_account(MelangeConfig *config, const char *id) {
+    MelangeAccount *account = g_hash_table_lookup(config->account_index, id);
+    if (!account) return NULL;
+
+    g_hash_table_remove(config->account_index, id);
+    for (guint i = 0; i < config->accounts->len; ++i) {
+        if (g_array_index(config->accounts, MelangeAccount *, i) == account) {
+            // Clear the slot first, the array would free the account otherwise
+            g_array_index(config->accounts, MelangeAccount *, i) = NULL;
+            g_array_remove_index(config->accounts, i);
+            break;
         }
     }
-    return NULL;
+    return account;
+}
+
+
+gboolean
+melange_config_remove_account(MelangeConfig *config, const char *id) {
+    // The serial stays reserved for this session only, since serials are rebuilt from the accounts
+    // in the file. melange_app_new_account_id() also skips ids that still have web data on disk.
+    MelangeAccount *account = melange_config_steal_account(config, id);
+    melange_account_free(account);
+    return account != NULL;
+}
+
+
+MelangeAccount *
+melange_config_lookup_account(MelangeConfig *config, const char *id) {
+    return g_hash_table_lookup(config->account_index, id);
+}
+
+
+char *
+melange_config_new_account_id(MelangeConfig *config, const char *prefix) {
+    guint serial = GPOINTER_TO_UINT(g_hash_table_lookup(config->account_serials, prefix));
+    char *id;
+    do {
+        // Overlong serials are not tracked, so they may still collide
+        id = g_strdup_printf("%s%u", prefix, ++serial);
+        if (!g_hash_table_contains(config->account_index, id)) break;
+        g_free(id);
+    } while (TRUE);
+    return id;
 }
 
 
@@ -154,66 +277,124 @@ melange_config_for_each_account(MelangeConfig *config, MelangeAccountFunc func,
 }
 
 
+static const char *melange_cache_model_string[] = {
+        "default", "document-viewer", "document-browser", "web-browser" };
+
+
 static void
-melange_config_write_account(MelangeAccount *account, FILE *file) {
-    fprintf(file,
+melange_config_write_account(MelangeAccount *account, GString *out) {
+    g_string_append_printf(out,
             "\naccount {\n"
                     "    id            \"%s\"\n",
             account->id
     );
     if (account->preset) {
-        fprintf(file,
-                "    preset        \"%s\"\n"
-                        "}\n",
+        g_string_append_printf(out,
+                "    preset        \"%s\"\n",
                 account->preset->id
         );
     } else {
-        fprintf(file,
+        g_string_append_printf(out,
                 "    service-name  \"%s\"\n"
                         "    service-url   \"%s\"\n"
                         "    icon-url      \"%s\"\n"
-                        "    user-agent    \"%s\"\n"
-                        "}\n",
+                        "    user-agent    \"%s\"\n",
                 account->service_name,
                 account->service_url,
                 account->icon_url,
                 account->user_agent
         );
     }
-}
-
-
-void
-melange_config_write_to_file(MelangeConfig *config, const char *file_name) {
-    char *path = g_path_get_dirname(file_name);
-    if (g_mkdir_with_parents(path, 0777) != 0) {
-        g_warning("Unable to create config directory %s: %s", path, g_strerror(errno));
-        g_free(path);
-        return;
+    if (account->keep_alive) {
+        g_string_append(out, "    keep-alive    \"true\"\n");
     }
-    g_free(path);
-
-    FILE *file = fopen(file_name, "w");
-    if (!file) {
-        g_warning("Unable to write config file %s: %s", file_name, g_strerror(errno));
-        return;
+    if (account->notification_window > 0) {
+        g_string_append_printf(out, "    notification-window \"%u\"\n",
+                account->notification_window);
+    }
+    if (account->cache_model != MELANGE_CACHE_MODEL_DEFAULT) {
+        g_string_append_printf(out, "    cache-model   \"%s\"\n",
+                melange_cache_model_string[account->cache_model]);
+    }
+    if (account->cache_quota > 0) {
+        g_string_append_printf(out, "    cache-quota   \"%u\"\n", account->cache_quota);
+    }
+    if (account->cpu_max) {
+        g_string_append_printf(out, "    cpu-max       \"%s\"\n", account->cpu_max);
+    }
+    if (account->memory_high) {
+        g_string_append_printf(out, "    memory-high   \"%s\"\n", account->memory_high);
+    }
+    if (account->memory_max) {
+        g_string_append_printf(out, "    memory-max    \"%s\"\n", account->memory_max);
     }
+    g_string_append(out, "}\n");
+}
+
 
+char *
+melange_config_serialize(MelangeConfig *config) {
     static const char *bool_string[] = { "false", "true" };
     static const char *csd_string[] = { "off", "on", "auto" };
+    static const char *load_string[] = { "eager", "on-demand", "background" };
+    static const char *resource_limits_string[] = { "off", "auto", "cgroup", "systemd" };
 
-    fprintf(file,
+    GString *out = g_string_new(NULL);
+    g_string_append_printf(out,
             "settings {\n"
                     "    dark-theme               \"%s\"\n"
                     "    client-side-decorations  \"%s\"\n"
                     "    auto-hide-sidebar        \"%s\"\n"
+                    "    load-accounts            \"%s\"\n"
+                    "    hibernate-after          \"%u\"\n"
+                    "    recycle-threshold        \"%u\"\n"
+                    "    notification-window      \"%u\"\n"
+                    "    cache-model              \"%s\"\n"
+                    "    cache-quota              \"%u\"\n"
+                    "    resource-limits          \"%s\"\n"
                     "}\n",
             bool_string[config->dark_theme],
             csd_string[config->client_side_decorations],
-            bool_string[config->auto_hide_sidebar]
+            bool_string[config->auto_hide_sidebar],
+            load_string[config->load_accounts],
+            config->hibernate_after,
+            config->recycle_threshold,
+            config->notification_window,
+            melange_cache_model_string[config->cache_model],
+            config->cache_quota,
+            resource_limits_string[config->resource_limits]
     );
 
     melange_config_for_each_account(config, (MelangeAccountFunc) melange_config_write_account,
-            file);
-    fclose(file);
+            out);
+    return g_string_free(out, FALSE);
+}
+
+
+gboolean
+melange_config_write_serialized(const char *contents, const char *file_name) {
+    char *path = g_path_get_dirname(file_name);
+    if (g_mkdir_with_parents(path, 0777) != 0) {
+        g_warning("Unable to create config directory %s: %s", path, g_strerror(errno));
+        g_free(path);
+        return FALSE;
+    }
+    g_free(path);
+
+    // Writes to a temporary file and renames it, so a crash never leaves a truncated config
+    GError *error = NULL;
+    if (!g_file_set_contents(file_name, contents, -1, &error)) {
+        g_warning("Unable to write config file %s: %s", file_name, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+void
+melange_config_write_to_file(MelangeConfig *config, const char *file_name) {
+    char *contents = melange_config_serialize(config);
+    melange_config_write_serialized(contents, file_name);
+    g_free(contents);
 }
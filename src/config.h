@@ -4,12 +4,49 @@
 #include <glib.h>
 
 
+#define MELANGE_CONFIG_ERROR melange_config_error_quark()
+
+typedef enum MelangeConfigError {
+    // Syntax errors, reported as "<file>:<line>:<column>: <message>"
+    MELANGE_CONFIG_ERROR_PARSE,
+} MelangeConfigError;
+
 typedef enum MelangeCsdMode {
     MELANGE_CSD_OFF,
     MELANGE_CSD_ON,
     MELANGE_CSD_AUTO,
 } MelangeCsdMode;
 
+// When to create the web view (and web process) of an account
+typedef enum MelangeLoadMode {
+    // All accounts are loaded at startup
+    MELANGE_LOAD_EAGER,
+    // Accounts are loaded when first selected. Unloaded accounts do not produce notifications
+    MELANGE_LOAD_ON_DEMAND,
+    // Like on-demand, but remaining accounts are loaded one by one after the window is shown
+    MELANGE_LOAD_BACKGROUND,
+} MelangeLoadMode;
+
+// Mirrors WebKitCacheModel, which decides how much WebKit caches in memory and on disk
+typedef enum MelangeCacheModel {
+    // Accounts only: use MelangeConfig::cache_model
+    MELANGE_CACHE_MODEL_DEFAULT,
+    MELANGE_CACHE_MODEL_DOCUMENT_VIEWER,
+    MELANGE_CACHE_MODEL_DOCUMENT_BROWSER,
+    MELANGE_CACHE_MODEL_WEB_BROWSER,
+} MelangeCacheModel;
+
+// Where web processes of accounts with cpu-max, memory-high or memory-max are placed
+typedef enum MelangeResourceLimitMode {
+    MELANGE_RESOURCE_LIMITS_OFF,
+    // systemd if the system was booted with it, cgroup otherwise
+    MELANGE_RESOURCE_LIMITS_AUTO,
+    // A child of melange's own cgroup v2, which must have been delegated
+    MELANGE_RESOURCE_LIMITS_CGROUP,
+    // A transient systemd user scope
+    MELANGE_RESOURCE_LIMITS_SYSTEMD,
+} MelangeResourceLimitMode;
+
 typedef struct MelangeAccount {
     char *id;
     const struct MelangeAccount *preset;
@@ -17,16 +54,64 @@ typedef struct MelangeAccount {
     char *service_url;
     char *icon_url;
     char *user_agent;
+
+    // Never hibernate this account, e.g. so that it keeps delivering notifications
+    gboolean keep_alive;
+
+    // Overrides MelangeConfig::notification_window if > 0
+    guint notification_window;
+
+    // Override MelangeConfig::cache_model and MelangeConfig::cache_quota if set / > 0
+    MelangeCacheModel cache_model;
+    guint cache_quota;
+
+    // Limits for the web process in cgroup v2 syntax, e.g. "50000 100000" and "1G". NULL if unset.
+    char *cpu_max;
+    char *memory_high;
+    char *memory_max;
 } MelangeAccount;
 
 typedef struct MelangeConfig {
     gboolean dark_theme;
     MelangeCsdMode client_side_decorations;
     gboolean auto_hide_sidebar;
+    MelangeLoadMode load_accounts;
 
+    // Idle time in minutes after which background accounts are hibernated, 0 to disable
+    guint hibernate_after;
+
+    // Background accounts whose web process has grown by this many MiB since the page settled are
+    // reloaded in a fresh web process, 0 to disable
+    guint recycle_threshold;
+
+    // Notifications of an account are summed up and shown at most once within this many seconds,
+    // 0 to show every message
+    guint notification_window;
+
+    MelangeCacheModel cache_model;
+    // Disk cache limit per account in MiB, 0 for no limit
+    guint cache_quota;
+
+    MelangeResourceLimitMode resource_limits;
+
+    // MelangeAccount* in config file order
     GArray *accounts;
+
+    // Maps account ids to the MelangeAccount* in accounts
+    GHashTable *account_index;
+    // Maps id prefixes to the highest serial in use, e.g. "whatsapp" -> 3 for "whatsapp3"
+    GHashTable *account_serials;
 } MelangeConfig;
 
+// What a parse has seen beyond the resulting config. Blocks that are ignored with a warning still
+// name accounts whose data must not be treated as abandoned.
+typedef struct MelangeConfigParseReport {
+    // Every account id in the file, including those of ignored blocks (set of char*)
+    GHashTable *account_ids;
+    // Incomplete or duplicate account blocks and blocks of unknown type that have been ignored
+    guint dropped_blocks;
+} MelangeConfigParseReport;
+
 typedef void (*MelangeAccountFunc)(MelangeAccount *account, gpointer user_data);
 
 typedef void (*MelangeAccountConstFunc)(const MelangeAccount *account, gpointer user_data);
@@ -47,20 +132,60 @@ const char *melange_account_get_icon_url(const MelangeAccount *account);
 
 const char *melange_account_get_user_agent(const MelangeAccount *account);
 
+// TRUE if both accounts can share a web view, i.e. they differ at most in keep-alive,
+// notification-window and cache settings
+gboolean melange_account_equal_service(const MelangeAccount *a, const MelangeAccount *b);
+
+
+GQuark melange_config_error_quark(void);
 
 MelangeConfig *melange_config_new(void);
 
+// Returns NULL without a warning if the file does not exist
 MelangeConfig *melange_config_new_from_file(const char *file_name);
 
+// Parses config file contents from memory. file_name is only used in error messages. Does not
+// touch any global state, so it is safe to call from any thread.
+MelangeConfig *melange_config_new_from_data(const char *data, gsize length, const char *file_name,
+        GError **error);
+
+// Like melange_config_new_from_data(), also fills report, which must be released with
+// melange_config_parse_report_clear() unless NULL is returned
+MelangeConfig *melange_config_new_from_data_with_report(const char *data, gsize length,
+        const char *file_name, MelangeConfigParseReport *report, GError **error);
+
+void melange_config_parse_report_clear(MelangeConfigParseReport *report);
+
 void melange_config_free(MelangeConfig *config);
 
+// Takes ownership of account. Returns FALSE and leaves account to the caller if the id is taken.
 gboolean melange_config_add_account(MelangeConfig *config, MelangeAccount *account);
 
+// Frees the account. Returns FALSE if there is no account with that id.
+gboolean melange_config_remove_account(MelangeConfig *config, const char *id);
+
+// Removes the account without freeing it. Returns NULL if there is no account with that id.
+MelangeAccount *melange_config_steal_account(MelangeConfig *config, const char *id);
+
 MelangeAccount *melange_config_lookup_account(MelangeConfig *config, const char *id);
 
+// Returns an unused id <prefix><serial> such as "whatsapp3", counting up from 1
+char *melange_config_new_account_id(MelangeConfig *config, const char *prefix);
+
+// Keeps melange_config_new_account_id() from handing out id or any lower serial of its prefix.
+// Returns FALSE if id does not end in a serial that can be tracked.
+gboolean melange_config_reserve_account_id(MelangeConfig *config, const char *id);
+
 void melange_config_for_each_account(MelangeConfig *config, MelangeAccountFunc func,
         gpointer user_data);
 
+// Returns the contents of a config file describing config
+char *melange_config_serialize(MelangeConfig *config);
+
+// Atomically replaces file_name by contents. Does not touch any MelangeConfig, so it is safe to
+// call from a worker thread.
+gboolean melange_config_write_serialized(const char *contents, const char *file_name);
+
 void melange_config_write_to_file(MelangeConfig *config, const char *file_name);
 
 
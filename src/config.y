@@ -1,62 +1,44 @@
 %define api.prefix {melange_config_parser_}
-
-%{
+%define api.pure full
+%define api.value.type {void *}
+%define parse.error verbose
+%locations
+%param {void *scanner}
+%parse-param {MelangeConfigParserState *state}
+
+%code requires {
 #include <glib-2.0/glib.h>
-#include <stdio.h>
 
 #include <src/config.h>
-#include <src/presets.h>
-
-#define MELANGE_CONFIG_PARSER_STYPE void *
-
-#pragma GCC diagnostic ignored "-Wconversion"
-#pragma GCC diagnostic ignored "-Wsign-conversion"
-
-
-typedef struct KeyValuePair {
-    char *key;
-    char *value;
-} KeyValuePair;
-
-
-typedef struct Block {
-    char *type;
-    GArray *items;
-} Block;
-
-
-static KeyValuePair *
-key_value_pair_new(char *key, char *value) {
-    KeyValuePair template = {
-        .key = key,
-        .value = value,
-    };
-    return g_memdup(&template, sizeof template);
-}
 
-static void
-key_value_pair_destroy(KeyValuePair **pair) {
-    g_free((*pair)->key);
-    g_free((*pair)->value);
-    g_free(*pair);
+typedef enum MelangeConfigParserBlock {
+    MELANGE_CONFIG_PARSER_BLOCK_NONE,
+    MELANGE_CONFIG_PARSER_BLOCK_SETTINGS,
+    MELANGE_CONFIG_PARSER_BLOCK_ACCOUNT,
+    MELANGE_CONFIG_PARSER_BLOCK_UNKNOWN,
+} MelangeConfigParserBlock;
+
+// Everything a parse works on, so that parses can run concurrently on any thread
+typedef struct MelangeConfigParserState {
+    MelangeConfig *config;
+    // Only used in messages
+    const char *file_name;
+    MelangeConfigParserBlock block;
+    // The account block being parsed, added to config at its closing brace
+    MelangeAccount *account;
+    // Optional
+    MelangeConfigParseReport *report;
+    GError **error;
+} MelangeConfigParserState;
 }
 
+%code {
+#include <stdio.h>
 
-static Block *
-block_new(char *type, GArray *items) {
-    Block template = {
-        .type = type,
-        .items = items,
-    };
-    return g_memdup(&template, sizeof template);
-}
+#include <src/presets.h>
 
-static void
-block_free(Block *block) {
-    g_free(block->type);
-    g_array_free(block->items, TRUE);
-    g_free(block);
-}
+#pragma GCC diagnostic ignored "-Wconversion"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
 
 
 static void
@@ -73,6 +55,18 @@ read_boolean(const char *str, gboolean *out) {
 }
 
 
+static void
+read_uint(const char *str, guint *out) {
+    char *end;
+    guint64 value = g_ascii_strtoull(str, &end, 10);
+    if (*str && !*end && value <= G_MAXUINT) {
+        *out = (guint) value;
+    } else {
+        g_warning("Invalid unsigned integer value \"%s\", skipping", str);
+    }
+}
+
+
 static void
 read_csd(const char *str, MelangeCsdMode *out) {
     if (g_str_equal(str, "off")) {
@@ -87,6 +81,50 @@ read_csd(const char *str, MelangeCsdMode *out) {
 }
 
 
+static void
+read_load_mode(const char *str, MelangeLoadMode *out) {
+    if (g_str_equal(str, "eager")) {
+        *out = MELANGE_LOAD_EAGER;
+    } else if (g_str_equal(str, "on-demand")) {
+        *out = MELANGE_LOAD_ON_DEMAND;
+    } else if (g_str_equal(str, "background")) {
+        *out = MELANGE_LOAD_BACKGROUND;
+    } else {
+        g_warning("Invalid load-accounts value \"%s\", skipping", str);
+    }
+}
+
+
+static void
+read_cache_model(const char *str, MelangeCacheModel *out) {
+    if (g_str_equal(str, "document-viewer")) {
+        *out = MELANGE_CACHE_MODEL_DOCUMENT_VIEWER;
+    } else if (g_str_equal(str, "document-browser")) {
+        *out = MELANGE_CACHE_MODEL_DOCUMENT_BROWSER;
+    } else if (g_str_equal(str, "web-browser")) {
+        *out = MELANGE_CACHE_MODEL_WEB_BROWSER;
+    } else {
+        g_warning("Invalid cache-model value \"%s\", skipping", str);
+    }
+}
+
+
+static void
+read_resource_limit_mode(const char *str, MelangeResourceLimitMode *out) {
+    if (g_str_equal(str, "off")) {
+        *out = MELANGE_RESOURCE_LIMITS_OFF;
+    } else if (g_str_equal(str, "auto")) {
+        *out = MELANGE_RESOURCE_LIMITS_AUTO;
+    } else if (g_str_equal(str, "cgroup")) {
+        *out = MELANGE_RESOURCE_LIMITS_CGROUP;
+    } else if (g_str_equal(str, "systemd")) {
+        *out = MELANGE_RESOURCE_LIMITS_SYSTEMD;
+    } else {
+        g_warning("Invalid resource-limits value \"%s\", skipping", str);
+    }
+}
+
+
 // Copy pointer, set source to NULL to avoid freeing later
 static void
 move_ptr(void *dest, void *src) {
@@ -96,90 +134,185 @@ move_ptr(void *dest, void *src) {
 }
 
 
-int melange_config_parser_lex(void);
+int melange_config_parser_lex(MELANGE_CONFIG_PARSER_STYPE *value,
+        MELANGE_CONFIG_PARSER_LTYPE *location, void *scanner);
 
-MelangeConfig *melange_config_parser_result;
 
 void
-melange_config_parser_error(const char *str) {
-    g_warning("Unable to parse configuration: %s", str);
+melange_config_parser_error(MELANGE_CONFIG_PARSER_LTYPE *location, void *scanner,
+        MelangeConfigParserState *state, const char *message) {
+    (void) scanner;
+
+    // Only the first error is reported, bison may follow up with "memory exhausted"
+    if (state->error && !*state->error) {
+        g_set_error(state->error, MELANGE_CONFIG_ERROR, MELANGE_CONFIG_ERROR_PARSE, "%s:%d:%d: %s",
+                state->file_name, location->first_line, location->first_column, message);
+    }
+}
+
+
+static void
+report_dropped_block(MelangeConfigParserState *state) {
+    if (state->report) {
+        ++state->report->dropped_blocks;
+    }
 }
 
-int
-melange_config_parser_wrap(void) {
-    return 1;
+
+static void
+report_account_id(MelangeConfigParserState *state, const char *id) {
+    if (state->report) {
+        g_hash_table_add(state->report->account_ids, g_strdup(id));
+    }
 }
 
-%}
 
-%token T_STRING T_IDENTIFIER T_LEFT_BRACE T_RIGHT_BRACE T_LINE_FEED
+static void
+begin_block(MelangeConfigParserState *state, const char *type,
+        const MELANGE_CONFIG_PARSER_LTYPE *location) {
+    if (g_str_equal(type, "settings")) {
+        state->block = MELANGE_CONFIG_PARSER_BLOCK_SETTINGS;
+    } else if (g_str_equal(type, "account")) {
+        state->block = MELANGE_CONFIG_PARSER_BLOCK_ACCOUNT;
+        state->account = g_malloc0(sizeof *state->account);
+    } else {
+        g_warning("%s:%d: Ignoring unknown configuration block \"%s\"", state->file_name,
+                location->first_line, type);
+        state->block = MELANGE_CONFIG_PARSER_BLOCK_UNKNOWN;
+        report_dropped_block(state);
+    }
+}
 
-%%
 
-config_file:
-    blank_lines
-    {
-        melange_config_parser_result = melange_config_new();
+// Takes the value if it is stored as-is
+static void
+read_setting(MelangeConfigParserState *state, const char *key, char **value,
+        const MELANGE_CONFIG_PARSER_LTYPE *location) {
+    MelangeConfig *config = state->config;
+    if (g_str_equal(key, "dark-theme")) {
+        read_boolean(*value, &config->dark_theme);
+    } else if  (g_str_equal(key, "client-side-decorations")) {
+        read_csd(*value, &config->client_side_decorations);
+    } else if (g_str_equal(key, "auto-hide-sidebar")) {
+        read_boolean(*value, &config->auto_hide_sidebar);
+    } else if (g_str_equal(key, "load-accounts")) {
+        read_load_mode(*value, &config->load_accounts);
+    } else if (g_str_equal(key, "hibernate-after")) {
+        read_uint(*value, &config->hibernate_after);
+    } else if (g_str_equal(key, "recycle-threshold")) {
+        read_uint(*value, &config->recycle_threshold);
+    } else if (g_str_equal(key, "notification-window")) {
+        read_uint(*value, &config->notification_window);
+    } else if (g_str_equal(key, "cache-model")) {
+        read_cache_model(*value, &config->cache_model);
+    } else if (g_str_equal(key, "cache-quota")) {
+        read_uint(*value, &config->cache_quota);
+    } else if (g_str_equal(key, "resource-limits")) {
+        read_resource_limit_mode(*value, &config->resource_limits);
+    } else {
+        g_warning("%s:%d: Ignoring unknown setting %s in configuration", state->file_name,
+                location->first_line, key);
     }
-    | config_file block blank_lines
-    {
-        Block *block = (Block *) $2;
-        MelangeConfig *config = (MelangeConfig *) melange_config_parser_result;
-        if (g_str_equal(block->type, "settings")) {
-            for (size_t i = 0; i < block->items->len; ++i) {
-                KeyValuePair *kv = g_array_index(block->items, KeyValuePair *, i);
-                if (g_str_equal(kv->key, "dark-theme")) {
-                    read_boolean(kv->value, &config->dark_theme);
-                } else if  (g_str_equal(kv->key, "client-side-decorations")) {
-                    read_csd(kv->value, &config->client_side_decorations);
-                } else if (g_str_equal(kv->key, "auto-hide-sidebar")) {
-                    read_boolean(kv->value, &config->auto_hide_sidebar);
-                } else {
-                    g_warning("Ignoring unknown setting %s in configuration", kv->key);
-                }
-            }
-        } else if (g_str_equal(block->type, "account")) {
-            MelangeAccount *account = g_malloc0(sizeof *account);
-            for (size_t i = 0; i < block->items->len; ++i) {
-                KeyValuePair *kv = g_array_index(block->items, KeyValuePair *, i);
-                if (g_str_equal(kv->key, "id")) {
-                    move_ptr(&account->id, &kv->value);
-                } else if (g_str_equal(kv->key, "preset")) {
-                    const MelangeAccount *preset = melange_account_presets_lookup(kv->value);
-                    if (!preset) {
-                        g_warning("Unknown account preset \"%s\"", kv->value);
-                    }
-                    account->preset = preset;
-                } else if (g_str_equal(kv->key, "service-name")) {
-                    move_ptr(&account->service_name, &kv->value);
-                } else if (g_str_equal(kv->key, "service-url")) {
-                    move_ptr(&account->service_url, &kv->value);
-                } else if (g_str_equal(kv->key, "icon-url")) {
-                    move_ptr(&account->icon_url, &kv->value);
-                } else if (g_str_equal(kv->key, "user-agent")) {
-                    move_ptr(&account->user_agent, &kv->value);
-                } else {
-                    g_warning("Ignoring unknown account detail %s", kv->key);
-                }
-            }
-            if (account->id && (account->preset || (account->service_name
-                    && account->service_url && account->icon_url && account->user_agent))) {
-                g_array_append_val(config->accounts, account);
-            } else {
-                g_warning("Ignoring incomplete account in configuration");
+}
+
+
+static void
+read_account_detail(MelangeConfigParserState *state, const char *key, char **value,
+        const MELANGE_CONFIG_PARSER_LTYPE *location) {
+    MelangeAccount *account = state->account;
+    if (g_str_equal(key, "id")) {
+        report_account_id(state, *value);
+        move_ptr(&account->id, value);
+    } else if (g_str_equal(key, "preset")) {
+        const MelangeAccount *preset = melange_account_presets_lookup(*value);
+        if (!preset) {
+            g_warning("%s:%d: Unknown account preset \"%s\"", state->file_name,
+                    location->first_line, *value);
+        }
+        account->preset = preset;
+    } else if (g_str_equal(key, "service-name")) {
+        move_ptr(&account->service_name, value);
+    } else if (g_str_equal(key, "service-url")) {
+        move_ptr(&account->service_url, value);
+    } else if (g_str_equal(key, "icon-url")) {
+        move_ptr(&account->icon_url, value);
+    } else if (g_str_equal(key, "user-agent")) {
+        move_ptr(&account->user_agent, value);
+    } else if (g_str_equal(key, "keep-alive")) {
+        read_boolean(*value, &account->keep_alive);
+    } else if (g_str_equal(key, "notification-window")) {
+        read_uint(*value, &account->notification_window);
+    } else if (g_str_equal(key, "cache-model")) {
+        read_cache_model(*value, &account->cache_model);
+    } else if (g_str_equal(key, "cache-quota")) {
+        read_uint(*value, &account->cache_quota);
+    } else if (g_str_equal(key, "cpu-max")) {
+        move_ptr(&account->cpu_max, value);
+    } else if (g_str_equal(key, "memory-high")) {
+        move_ptr(&account->memory_high, value);
+    } else if (g_str_equal(key, "memory-max")) {
+        move_ptr(&account->memory_max, value);
+    } else {
+        g_warning("%s:%d: Ignoring unknown account detail %s", state->file_name,
+                location->first_line, key);
+    }
+}
+
+
+static void
+end_block(MelangeConfigParserState *state, const MELANGE_CONFIG_PARSER_LTYPE *location) {
+    if (state->block == MELANGE_CONFIG_PARSER_BLOCK_ACCOUNT) {
+        MelangeAccount *account = state->account;
+        state->account = NULL;
+        if (account->id && (account->preset || (account->service_name
+                && account->service_url && account->icon_url && account->user_agent))) {
+            if (!melange_config_add_account(state->config, account)) {
+                g_warning("%s:%d: Ignoring duplicate account id \"%s\" in configuration",
+                        state->file_name, location->first_line, account->id);
+                report_dropped_block(state);
                 melange_account_free(account);
             }
         } else {
-            g_warning("Ignoring unknown configuration block \"%s\"", block->type);
+            g_warning("%s:%d: Ignoring incomplete account in configuration", state->file_name,
+                    location->first_line);
+            report_dropped_block(state);
+            melange_account_free(account);
         }
-        block_free(block);
     }
+    state->block = MELANGE_CONFIG_PARSER_BLOCK_NONE;
+}
+
+}
+
+%token T_STRING "string"
+%token T_IDENTIFIER "identifier"
+%token T_LEFT_BRACE "{"
+%token T_RIGHT_BRACE "}"
+%token T_LINE_FEED "line feed"
+%token T_INVALID "invalid character"
+
+%destructor { g_free($$); } T_STRING T_IDENTIFIER
+
+%%
+
+config_file:
+    blank_lines
+    | config_file block blank_lines
     ;
 
+// Blocks and their key-value pairs are applied to the config as they are parsed
 block:
-    T_IDENTIFIER T_LEFT_BRACE line_break kv_lines T_RIGHT_BRACE
+    block_type T_LEFT_BRACE line_break kv_lines T_RIGHT_BRACE
+    {
+        end_block(state, &@1);
+    }
+    ;
+
+block_type:
+    T_IDENTIFIER
     {
-        $$ = block_new($1, $4);
+        begin_block(state, $1, &@1);
+        g_free($1);
     }
     ;
 
@@ -195,20 +328,22 @@ blank_lines:
 
 kv_lines:
     %empty
-    {
-        $$ = g_array_new(FALSE, FALSE, sizeof(KeyValuePair *));
-        g_array_set_clear_func($$, (GDestroyNotify) key_value_pair_destroy);
-    }
     | kv_lines key_value line_break
-    {
-        g_array_append_val($1, $2);
-        $$ = $1;
-    }
     ;
 
 key_value:
     T_IDENTIFIER T_STRING
     {
-        $$ = key_value_pair_new($1, $2);
+        char *value = $2;
+        if (state->block == MELANGE_CONFIG_PARSER_BLOCK_SETTINGS) {
+            read_setting(state, $1, &value, &@1);
+        } else if (state->block == MELANGE_CONFIG_PARSER_BLOCK_ACCOUNT) {
+            read_account_detail(state, $1, &value, &@1);
+        } else if (state->block == MELANGE_CONFIG_PARSER_BLOCK_UNKNOWN && g_str_equal($1, "id")) {
+            // Possibly a misspelled account block
+            report_account_id(state, value);
+        }
+        g_free($1);
+        g_free(value);
     }
     ;
@@ -0,0 +1,164 @@
+#include "configwriter.h"
+#include "trace.h"
+
+
+// Time to wait for further changes before writing, in milliseconds
+#define MELANGE_CONFIG_WRITER_DELAY 1000
+
+
+struct MelangeConfigWriter {
+    MelangeConfig *config;
+    char *file_name;
+
+    // Source id of the pending debounce timeout, 0 if the file is up to date
+    guint timeout;
+
+    // A single worker thread, so that writes complete in the order they were issued
+    GThreadPool *pool;
+
+    // What the file is known to contain: the contents read at startup, of the latest write or of
+    // the latest external change applied. Tells own writes from external changes. NULL if the file
+    // did not exist.
+    char *last_contents;
+
+    // Set while the file could not be parsed, config does not reflect it then
+    gboolean suspended;
+};
+
+
+typedef struct MelangeConfigWriterJob {
+    char *contents;
+    // last_contents at the time of submission
+    char *expected;
+} MelangeConfigWriterJob;
+
+
+// A file that has changed since melange last saw it holds an external change that has not been
+// reloaded yet. Overwriting it with the stale config would lose that change for good, the reload
+// replaces the config instead.
+static void
+melange_config_writer_thread_func(MelangeConfigWriterJob *job, MelangeConfigWriter *writer) {
+    gint64 trace_begin = MELANGE_TRACE_BEGIN();
+    char *current = NULL;
+    g_file_get_contents(writer->file_name, &current, NULL, NULL);
+    if (g_strcmp0(current, job->expected) == 0) {
+        melange_config_write_serialized(job->contents, writer->file_name);
+    } else {
+        g_info("%s has been changed by another program, not overwriting it", writer->file_name);
+    }
+    g_free(current);
+    g_free(job->expected);
+    g_free(job->contents);
+    g_free(job);
+    MELANGE_TRACE_END(trace_begin, "config-write", writer->file_name);
+}
+
+
+// The config is only ever touched on the main thread, the worker receives a serialized copy
+static void
+melange_config_writer_submit(MelangeConfigWriter *writer) {
+    GError *error = NULL;
+    MelangeConfigWriterJob *job = g_new(MelangeConfigWriterJob, 1);
+    job->contents = melange_config_serialize(writer->config);
+    job->expected = writer->last_contents;
+    writer->last_contents = g_strdup(job->contents);
+    if (!g_thread_pool_push(writer->pool, job, &error)) {
+        g_warning("Unable to write config in background, writing synchronously: %s",
+                error->message);
+        g_error_free(error);
+        melange_config_writer_thread_func(job, writer);
+    }
+}
+
+
+static gboolean
+melange_config_writer_timeout_callback(MelangeConfigWriter *writer) {
+    writer->timeout = 0;
+    melange_config_writer_submit(writer);
+    return FALSE;
+}
+
+
+MelangeConfigWriter *
+melange_config_writer_new(MelangeConfig *config, const char *file_name) {
+    MelangeConfigWriter *writer = g_malloc(sizeof *writer);
+    writer->config = config;
+    writer->file_name = g_strdup(file_name);
+    writer->timeout = 0;
+    writer->pool = g_thread_pool_new((GFunc) melange_config_writer_thread_func, writer, 1, FALSE,
+            NULL);
+    writer->last_contents = NULL;
+    g_file_get_contents(file_name, &writer->last_contents, NULL, NULL);
+    writer->suspended = FALSE;
+    return writer;
+}
+
+
+void
+melange_config_writer_schedule(MelangeConfigWriter *writer) {
+    if (writer->suspended) return;
+
+    // Restarting the timeout on every change makes a burst end up in a single write
+    if (writer->timeout) {
+        g_source_remove(writer->timeout);
+    }
+    writer->timeout = g_timeout_add(MELANGE_CONFIG_WRITER_DELAY,
+            (GSourceFunc) melange_config_writer_timeout_callback, writer);
+}
+
+
+void
+melange_config_writer_flush(MelangeConfigWriter *writer) {
+    if (writer->timeout) {
+        g_source_remove(writer->timeout);
+        writer->timeout = 0;
+        melange_config_writer_submit(writer);
+    }
+
+    // Freeing the pool waits for all queued writes, then start over with a fresh one
+    g_thread_pool_free(writer->pool, FALSE, TRUE);
+    writer->pool = g_thread_pool_new((GFunc) melange_config_writer_thread_func, writer, 1, FALSE,
+            NULL);
+}
+
+
+gboolean
+melange_config_writer_wrote(MelangeConfigWriter *writer, const char *contents) {
+    return writer->last_contents && g_str_equal(writer->last_contents, contents);
+}
+
+
+void
+melange_config_writer_set_applied(MelangeConfigWriter *writer, const char *contents) {
+    g_free(writer->last_contents);
+    writer->last_contents = g_strdup(contents);
+    if (writer->suspended) {
+        g_info("Configuration file %s has been fixed, saving changes again", writer->file_name);
+        writer->suspended = FALSE;
+    }
+}
+
+
+void
+melange_config_writer_suspend(MelangeConfigWriter *writer) {
+    if (writer->timeout) {
+        g_source_remove(writer->timeout);
+        writer->timeout = 0;
+    }
+    writer->suspended = TRUE;
+}
+
+
+void
+melange_config_writer_free(MelangeConfigWriter *writer) {
+    if (writer) {
+        if (writer->timeout) {
+            g_source_remove(writer->timeout);
+            melange_config_writer_submit(writer);
+        }
+        g_thread_pool_free(writer->pool, FALSE, TRUE);
+        g_free(writer->last_contents);
+        g_free(writer->file_name);
+        g_free(writer);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef MELANGE_CONFIGWRITER_H
+#define MELANGE_CONFIGWRITER_H
+
+#include "config.h"
+
+
+// Persists a MelangeConfig in the background. Bursts of changes are coalesced into a single
+// write, which is performed on a worker thread.
+typedef struct MelangeConfigWriter MelangeConfigWriter;
+
+
+// Must be created right after config has been read from file_name. Writes are skipped if the file
+// has been changed by someone else since, until that change has been applied.
+MelangeConfigWriter *melange_config_writer_new(MelangeConfig *config, const char *file_name);
+
+// Flushes pending changes before freeing
+void melange_config_writer_free(MelangeConfigWriter *writer);
+
+// Schedule a write after the config has been modified
+void melange_config_writer_schedule(MelangeConfigWriter *writer);
+
+// Write pending changes immediately and wait until all writes have completed
+void melange_config_writer_flush(MelangeConfigWriter *writer);
+
+// TRUE if contents is what the writer has last written, i.e. a change of the file was caused by
+// the writer itself
+gboolean melange_config_writer_wrote(MelangeConfigWriter *writer, const char *contents);
+
+// Records contents of an external change that has been applied, so that the file being changed
+// back to what the writer last wrote is not mistaken for the writer's own change. Ends a
+// suspension.
+void melange_config_writer_set_applied(MelangeConfigWriter *writer, const char *contents);
+
+// Drops pending and future changes instead of writing them until the next
+// melange_config_writer_set_applied(), e.g. because the file exists but could not be parsed
+void melange_config_writer_suspend(MelangeConfigWriter *writer);
+
+
+#endif // MELANGE_CONFIGWRITER_H
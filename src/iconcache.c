@@ -0,0 +1,258 @@
+#include "iconcache.h"
+
+#include <string.h>
+#include <errno.h>
+
+
+#define MELANGE_ICON_CACHE_MAGIC "MLNGICO1"
+
+// Pixel data of every entry starts at a multiple of this offset
+#define MELANGE_ICON_CACHE_ALIGNMENT 16
+
+
+// Atlas file layout, all integers in host byte order (it is a cache, never shared):
+//   char magic[8]
+//   guint32 n_entries
+//   n_entries times a MelangeIconCacheHeader followed by key_length bytes of key
+//   pixel data of all entries, as expected by gdk_pixbuf_new_from_bytes()
+typedef struct MelangeIconCacheHeader {
+    guint32 key_length;
+    guint32 width;
+    guint32 height;
+    guint32 rowstride;
+    guint32 has_alpha;
+    guint32 size;
+    guint64 offset;
+} MelangeIconCacheHeader;
+
+
+typedef struct MelangeIconCacheEntry {
+    MelangeIconCacheHeader header;
+
+    // Either a slice of the mapped atlas or pixels inserted during this session
+    GBytes *pixels;
+
+    // Only used entries survive rewriting the atlas, so stale versions are dropped eventually
+    gboolean used;
+} MelangeIconCacheEntry;
+
+
+struct MelangeIconCache {
+    char *file_name;
+
+    // Maps char* keys to MelangeIconCacheEntry*
+    GHashTable *entries;
+
+    // Entries were inserted since loading
+    gboolean dirty;
+};
+
+
+static void
+melange_icon_cache_entry_free(MelangeIconCacheEntry *entry) {
+    g_bytes_unref(entry->pixels);
+    g_free(entry);
+}
+
+
+static gboolean
+melange_icon_cache_header_is_valid(const MelangeIconCacheHeader *header, gsize file_size) {
+    guint64 channels = header->has_alpha ? 4 : 3;
+    if (header->width == 0 || header->height == 0 || header->rowstride < header->width * channels) {
+        return FALSE;
+    }
+
+    // Same requirement as gdk_pixbuf_new_from_bytes()
+    guint64 min_size = (guint64) header->rowstride * (header->height - 1)
+            + header->width * channels;
+    return header->size >= min_size
+            && header->offset <= file_size && file_size - header->offset >= header->size;
+}
+
+
+static void
+melange_icon_cache_load(MelangeIconCache *cache) {
+    GError *error = NULL;
+    GMappedFile *mapped = g_mapped_file_new(cache->file_name, FALSE, &error);
+    if (!mapped) {
+        if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            g_warning("Unable to open icon cache %s: %s", cache->file_name, error->message);
+        }
+        g_error_free(error);
+        return;
+    }
+
+    // Entries keep slices of the mapping alive, the file itself can be replaced at any time
+    GBytes *bytes = g_mapped_file_get_bytes(mapped);
+    g_mapped_file_unref(mapped);
+
+    gsize size;
+    const char *data = g_bytes_get_data(bytes, &size);
+
+    guint32 n_entries;
+    gsize pos = strlen(MELANGE_ICON_CACHE_MAGIC) + sizeof n_entries;
+    if (size < pos || memcmp(data, MELANGE_ICON_CACHE_MAGIC, strlen(MELANGE_ICON_CACHE_MAGIC))) {
+        goto invalid;
+    }
+    memcpy(&n_entries, data + strlen(MELANGE_ICON_CACHE_MAGIC), sizeof n_entries);
+
+    for (guint32 i = 0; i < n_entries; ++i) {
+        MelangeIconCacheHeader header;
+        if (size - pos < sizeof header) goto invalid;
+        memcpy(&header, data + pos, sizeof header);
+        pos += sizeof header;
+
+        if (size - pos < header.key_length || !melange_icon_cache_header_is_valid(&header, size)) {
+            goto invalid;
+        }
+
+        MelangeIconCacheEntry *entry = g_malloc(sizeof *entry);
+        entry->header = header;
+        entry->pixels = g_bytes_new_from_bytes(bytes, header.offset, header.size);
+        entry->used = FALSE;
+        g_hash_table_insert(cache->entries, g_strndup(data + pos, header.key_length), entry);
+        pos += header.key_length;
+    }
+
+    g_bytes_unref(bytes);
+    return;
+
+    invalid:
+    g_warning("Ignoring invalid icon cache %s", cache->file_name);
+    g_hash_table_remove_all(cache->entries);
+    g_bytes_unref(bytes);
+}
+
+
+MelangeIconCache *
+melange_icon_cache_new(const char *file_name) {
+    MelangeIconCache *cache = g_malloc(sizeof *cache);
+    cache->file_name = g_strdup(file_name);
+    cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+            (GDestroyNotify) melange_icon_cache_entry_free);
+    cache->dirty = FALSE;
+    melange_icon_cache_load(cache);
+    return cache;
+}
+
+
+void
+melange_icon_cache_free(MelangeIconCache *cache) {
+    if (cache) {
+        g_hash_table_destroy(cache->entries);
+        g_free(cache->file_name);
+        g_free(cache);
+    }
+}
+
+
+GdkPixbuf *
+melange_icon_cache_lookup(MelangeIconCache *cache, const char *key) {
+    MelangeIconCacheEntry *entry = g_hash_table_lookup(cache->entries, key);
+    if (!entry) return NULL;
+
+    entry->used = TRUE;
+
+    // Wraps the mapped pixels without copying or decoding
+    const MelangeIconCacheHeader *header = &entry->header;
+    return gdk_pixbuf_new_from_bytes(entry->pixels, GDK_COLORSPACE_RGB,
+            (gboolean) header->has_alpha, 8, (int) header->width, (int) header->height,
+            (int) header->rowstride);
+}
+
+
+void
+melange_icon_cache_insert(MelangeIconCache *cache, const char *key, GdkPixbuf *pixbuf) {
+    if (gdk_pixbuf_get_colorspace(pixbuf) != GDK_COLORSPACE_RGB
+            || gdk_pixbuf_get_bits_per_sample(pixbuf) != 8) {
+        return;
+    }
+
+    MelangeIconCacheEntry *entry = g_malloc(sizeof *entry);
+    entry->pixels = gdk_pixbuf_read_pixel_bytes(pixbuf);
+    entry->header = (MelangeIconCacheHeader) {
+            .key_length = (guint32) strlen(key),
+            .width = (guint32) gdk_pixbuf_get_width(pixbuf),
+            .height = (guint32) gdk_pixbuf_get_height(pixbuf),
+            .rowstride = (guint32) gdk_pixbuf_get_rowstride(pixbuf),
+            .has_alpha = (guint32) gdk_pixbuf_get_has_alpha(pixbuf),
+            .size = (guint32) g_bytes_get_size(entry->pixels),
+            .offset = 0,
+    };
+    entry->used = TRUE;
+
+    g_hash_table_insert(cache->entries, g_strdup(key), entry);
+    cache->dirty = TRUE;
+}
+
+
+static gsize
+melange_icon_cache_align(gsize offset) {
+    return (offset + MELANGE_ICON_CACHE_ALIGNMENT - 1) / MELANGE_ICON_CACHE_ALIGNMENT
+            * MELANGE_ICON_CACHE_ALIGNMENT;
+}
+
+
+void
+melange_icon_cache_save(MelangeIconCache *cache) {
+    if (!cache->dirty) return;
+
+    GPtrArray *keys = g_ptr_array_new();
+    GPtrArray *entries = g_ptr_array_new();
+
+    guint32 n_entries = 0;
+    gsize index_size = strlen(MELANGE_ICON_CACHE_MAGIC) + sizeof n_entries;
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, cache->entries);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        MelangeIconCacheEntry *entry = value;
+        if (entry->used) {
+            g_ptr_array_add(keys, key);
+            g_ptr_array_add(entries, entry);
+            index_size += sizeof(MelangeIconCacheHeader) + entry->header.key_length;
+            ++n_entries;
+        }
+    }
+
+    GByteArray *out = g_byte_array_new();
+    g_byte_array_append(out, (const guint8 *) MELANGE_ICON_CACHE_MAGIC,
+            (guint) strlen(MELANGE_ICON_CACHE_MAGIC));
+    g_byte_array_append(out, (const guint8 *) &n_entries, sizeof n_entries);
+
+    gsize offset = melange_icon_cache_align(index_size);
+    for (guint i = 0; i < n_entries; ++i) {
+        MelangeIconCacheEntry *entry = g_ptr_array_index(entries, i);
+        MelangeIconCacheHeader header = entry->header;
+        header.offset = offset;
+        offset = melange_icon_cache_align(offset + header.size);
+
+        g_byte_array_append(out, (const guint8 *) &header, sizeof header);
+        g_byte_array_append(out, g_ptr_array_index(keys, i), header.key_length);
+    }
+
+    static const guint8 padding[MELANGE_ICON_CACHE_ALIGNMENT] = { 0 };
+    for (guint i = 0; i < n_entries; ++i) {
+        MelangeIconCacheEntry *entry = g_ptr_array_index(entries, i);
+        g_byte_array_append(out, padding, (guint) (melange_icon_cache_align(out->len) - out->len));
+        g_byte_array_append(out, g_bytes_get_data(entry->pixels, NULL), entry->header.size);
+    }
+
+    GError *error = NULL;
+    char *path = g_path_get_dirname(cache->file_name);
+    if (g_mkdir_with_parents(path, 0777) != 0) {
+        g_warning("Unable to create icon cache directory %s: %s", path, g_strerror(errno));
+    } else if (!g_file_set_contents(cache->file_name, (const char *) out->data,
+            (gssize) out->len, &error)) {
+        g_warning("Unable to write icon cache %s: %s", cache->file_name, error->message);
+        g_error_free(error);
+    } else {
+        cache->dirty = FALSE;
+    }
+    g_free(path);
+
+    g_byte_array_unref(out);
+    g_ptr_array_free(entries, TRUE);
+    g_ptr_array_free(keys, TRUE);
+}
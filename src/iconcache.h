@@ -0,0 +1,28 @@
+#ifndef MELANGE_ICONCACHE_H
+#define MELANGE_ICONCACHE_H
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+
+// Persistent cache of rasterized icons. All entries are stored in a single atlas file holding raw
+// pixel data, which is memory-mapped on startup so that cached icons need no decoding at all.
+typedef struct MelangeIconCache MelangeIconCache;
+
+
+// Maps the atlas at file_name if it exists and is valid
+MelangeIconCache *melange_icon_cache_new(const char *file_name);
+
+void melange_icon_cache_free(MelangeIconCache *cache);
+
+// Returns a new reference to the cached pixbuf, or NULL. Keys must identify the source including
+// its version, e.g. by modification time, and the rasterization parameters.
+GdkPixbuf *melange_icon_cache_lookup(MelangeIconCache *cache, const char *key);
+
+void melange_icon_cache_insert(MelangeIconCache *cache, const char *key, GdkPixbuf *pixbuf);
+
+// Rewrites the atlas with all entries used since it was loaded. Does nothing unless entries were
+// inserted.
+void melange_icon_cache_save(MelangeIconCache *cache);
+
+
+#endif // MELANGE_ICONCACHE_H
@@ -0,0 +1,205 @@
+#include "iconfetcher.h"
+
+#include <libsoup/soup.h>
+
+
+// Give up on unresponsive hosts instead of keeping a connection slot forever
+#define MELANGE_ICON_FETCHER_TIMEOUT 30
+
+
+typedef struct MelangeIconFetcherWaiter {
+    MelangeIconFetcherCallback callback;
+    gpointer user_data;
+    GDestroyNotify destroy;
+} MelangeIconFetcherWaiter;
+
+
+// All fetch requests for one URI
+typedef struct MelangeIconFetcherRequest {
+    // NULL once the fetcher has been freed while the download was still running
+    MelangeIconFetcher *fetcher;
+    char *uri;
+    gboolean running;
+
+    // List of MelangeIconFetcherWaiter*
+    GSList *waiters;
+} MelangeIconFetcherRequest;
+
+
+struct MelangeIconFetcher {
+    SoupSession *session;
+    guint max_concurrent;
+    guint n_running;
+
+    // MelangeIconFetcherRequest* in order of arrival, waiting for a free download slot
+    GQueue pending;
+
+    // Maps URIs to pending or running MelangeIconFetcherRequest*
+    GHashTable *requests;
+};
+
+
+// For waiters whose callback has never run
+static void
+melange_icon_fetcher_waiter_free(MelangeIconFetcherWaiter *waiter) {
+    if (waiter->destroy) {
+        waiter->destroy(waiter->user_data);
+    }
+    g_free(waiter);
+}
+
+
+static void
+melange_icon_fetcher_request_free(MelangeIconFetcherRequest *request) {
+    g_slist_free_full(request->waiters, (GDestroyNotify) melange_icon_fetcher_waiter_free);
+    g_free(request->uri);
+    g_free(request);
+}
+
+
+MelangeIconFetcher *
+melange_icon_fetcher_new(guint max_concurrent) {
+    MelangeIconFetcher *fetcher = g_malloc(sizeof *fetcher);
+    fetcher->session = soup_session_new_with_options(
+            SOUP_SESSION_USER_AGENT, "Melange/" MELANGE_VERSION " ",
+            SOUP_SESSION_MAX_CONNS, (int) max_concurrent,
+            SOUP_SESSION_TIMEOUT, MELANGE_ICON_FETCHER_TIMEOUT,
+            NULL);
+    fetcher->max_concurrent = max_concurrent;
+    fetcher->n_running = 0;
+    g_queue_init(&fetcher->pending);
+    fetcher->requests = g_hash_table_new(g_str_hash, g_str_equal);
+    return fetcher;
+}
+
+
+void
+melange_icon_fetcher_free(MelangeIconFetcher *fetcher) {
+    if (!fetcher) return;
+
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, fetcher->requests);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        MelangeIconFetcherRequest *request = value;
+        if (request->running) {
+            // Freed by the completion callback, which soup_session_abort() invokes
+            request->fetcher = NULL;
+            g_slist_free_full(request->waiters, (GDestroyNotify) melange_icon_fetcher_waiter_free);
+            request->waiters = NULL;
+        } else {
+            melange_icon_fetcher_request_free(request);
+        }
+    }
+    g_hash_table_destroy(fetcher->requests);
+    g_queue_clear(&fetcher->pending);
+
+    soup_session_abort(fetcher->session);
+    g_object_unref(fetcher->session);
+    g_free(fetcher);
+}
+
+
+static void melange_icon_fetcher_start_pending(MelangeIconFetcher *fetcher);
+
+
+static void
+melange_icon_fetcher_finish(MelangeIconFetcher *fetcher, MelangeIconFetcherRequest *request,
+        GBytes *data, const GError *error) {
+    g_hash_table_remove(fetcher->requests, request->uri);
+
+    // Waiters were prepended
+    request->waiters = g_slist_reverse(request->waiters);
+    for (GSList *list = request->waiters; list; list = list->next) {
+        MelangeIconFetcherWaiter *waiter = list->data;
+        waiter->callback(data, error, waiter->user_data);
+    }
+    // The callbacks own their user data now
+    g_slist_free_full(request->waiters, g_free);
+    request->waiters = NULL;
+
+    melange_icon_fetcher_request_free(request);
+}
+
+
+static void
+melange_icon_fetcher_message_finished(SoupSession *session, SoupMessage *message,
+        gpointer user_data) {
+    (void) session;
+
+    MelangeIconFetcherRequest *request = user_data;
+    MelangeIconFetcher *fetcher = request->fetcher;
+    if (!fetcher) {
+        melange_icon_fetcher_request_free(request);
+        return;
+    }
+
+    --fetcher->n_running;
+
+    if (SOUP_STATUS_IS_SUCCESSFUL(message->status_code)) {
+        SoupBuffer *buffer = soup_message_body_flatten(message->response_body);
+        GBytes *data = soup_buffer_get_as_bytes(buffer);
+        melange_icon_fetcher_finish(fetcher, request, data, NULL);
+        g_bytes_unref(data);
+        soup_buffer_free(buffer);
+    } else {
+        GError *error = g_error_new(G_IO_ERROR, G_IO_ERROR_FAILED, "HTTP status %u (%s)",
+                message->status_code, message->reason_phrase ? message->reason_phrase : "");
+        melange_icon_fetcher_finish(fetcher, request, NULL, error);
+        g_error_free(error);
+    }
+
+    melange_icon_fetcher_start_pending(fetcher);
+}
+
+
+static void
+melange_icon_fetcher_start_pending(MelangeIconFetcher *fetcher) {
+    while (fetcher->n_running < fetcher->max_concurrent && !g_queue_is_empty(&fetcher->pending)) {
+        MelangeIconFetcherRequest *request = g_queue_pop_head(&fetcher->pending);
+
+        SoupMessage *message = soup_message_new(SOUP_METHOD_GET, request->uri);
+        if (!message) {
+            GError *error = g_error_new(G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                    "Invalid URI %s", request->uri);
+            melange_icon_fetcher_finish(fetcher, request, NULL, error);
+            g_error_free(error);
+            continue;
+        }
+
+        request->running = TRUE;
+        ++fetcher->n_running;
+        soup_session_queue_message(fetcher->session, message,
+                melange_icon_fetcher_message_finished, request);
+    }
+}
+
+
+void
+melange_icon_fetcher_fetch(MelangeIconFetcher *fetcher, const char *uri,
+        MelangeIconFetcherCallback callback, gpointer user_data, GDestroyNotify destroy) {
+    MelangeIconFetcherWaiter waiter_template = {
+            .callback = callback,
+            .user_data = user_data,
+            .destroy = destroy,
+    };
+    MelangeIconFetcherWaiter *waiter = g_memdup(&waiter_template, sizeof waiter_template);
+
+    MelangeIconFetcherRequest *request = g_hash_table_lookup(fetcher->requests, uri);
+    if (request) {
+        request->waiters = g_slist_prepend(request->waiters, waiter);
+        return;
+    }
+
+    MelangeIconFetcherRequest request_template = {
+            .fetcher = fetcher,
+            .uri = g_strdup(uri),
+            .running = FALSE,
+            .waiters = g_slist_prepend(NULL, waiter),
+    };
+    request = g_memdup(&request_template, sizeof request_template);
+    g_hash_table_insert(fetcher->requests, request->uri, request);
+    g_queue_push_tail(&fetcher->pending, request);
+
+    melange_icon_fetcher_start_pending(fetcher);
+}
@@ -0,0 +1,26 @@
+#ifndef MELANGE_ICONFETCHER_H
+#define MELANGE_ICONFETCHER_H
+
+#include <glib.h>
+
+
+// Downloads favicons over plain HTTP without involving WebKit. Requests for the same URI are
+// merged, and at most a fixed number of downloads run at the same time.
+typedef struct MelangeIconFetcher MelangeIconFetcher;
+
+// Exactly one of data and error is non-NULL. Called on the main thread.
+typedef void (*MelangeIconFetcherCallback)(GBytes *data, const GError *error, gpointer user_data);
+
+
+MelangeIconFetcher *melange_icon_fetcher_new(guint max_concurrent);
+
+// Aborts all pending downloads without invoking their callbacks, user_data is released with the
+// destroy function passed to melange_icon_fetcher_fetch() instead
+void melange_icon_fetcher_free(MelangeIconFetcher *fetcher);
+
+// callback takes ownership of user_data, destroy (may be NULL) is only called if it never runs
+void melange_icon_fetcher_fetch(MelangeIconFetcher *fetcher, const char *uri,
+        MelangeIconFetcherCallback callback, gpointer user_data, GDestroyNotify destroy);
+
+
+#endif // MELANGE_ICONFETCHER_H
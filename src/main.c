@@ -1,25 +1,22 @@
 #include "app.h"
-
-#include <libnotify/notify.h>
+#include "trace.h"
 
 
 int
 main(int argc, char **argv) {
-    g_set_application_name("Melange");
-    notify_init("melange");
-
-    char *executable_file;
-    if (g_path_is_absolute(argv[0])) {
-        executable_file = g_strdup(argv[0]);
-    } else {
-        executable_file = g_build_path(G_DIR_SEPARATOR_S, g_get_current_dir(), argv[0], NULL);
+    // Enable as early as possible, --trace is only parsed when the application runs
+    const char *trace = g_getenv("MELANGE_TRACE");
+    if (trace && *trace) {
+        melange_trace_enable(trace);
     }
 
-    GApplication *app = melange_app_new(executable_file);
+    g_set_application_name("Melange");
+
+    GApplication *app = melange_app_new();
     int status = g_application_run(app, argc, argv);
     g_object_unref(app);
 
-    g_free(executable_file);
+    melange_trace_finish();
 
     return status;
 }
@@ -0,0 +1,328 @@
+#include "maintenance.h"
+#include "config.h"
+#include "util.h"
+
+#include <libsoup/soup.h>
+#include <webkit2/webkit2.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+// Only ever created by the account's own service. Anything else is left over, e.g. from before the
+// service URL was changed or from a redirect that registered a worker.
+#define MELANGE_MAINTENANCE_SITE_DATA (WEBKIT_WEBSITE_DATA_SERVICE_WORKER_REGISTRATIONS \
+        | WEBKIT_WEBSITE_DATA_OFFLINE_APPLICATION_CACHE)
+
+
+typedef struct MelangeMaintenance {
+    gboolean dry_run;
+    // Set if the config may not name every account, orphans are then only listed
+    gboolean keep_orphans;
+    GMainLoop *loop;
+    // Accounts whose website data is still being cleaned up
+    guint pending;
+    gboolean ok;
+} MelangeMaintenance;
+
+
+typedef struct MelangeMaintenanceAccount {
+    MelangeMaintenance *maintenance;
+    char *id;
+    // Registrable domain of the service URL, e.g. "whatsapp.com"
+    char *base_domain;
+    gboolean clear_disk_cache;
+    WebKitWebContext *web_context;
+} MelangeMaintenanceAccount;
+
+
+static const char *
+melange_maintenance_action(MelangeMaintenance *maintenance) {
+    return maintenance->dry_run ? "would remove" : "removing";
+}
+
+
+static double
+melange_maintenance_mib(guint64 bytes) {
+    return (double) bytes / 1048576.0;
+}
+
+
+// Falls back to the host itself for IP addresses, localhost and the like
+static char *
+melange_maintenance_get_base_domain(const char *host) {
+    const char *base_domain = host ? soup_tld_get_base_domain(host, NULL) : NULL;
+    return g_strdup(base_domain ? base_domain : host);
+}
+
+
+// Maintenance must not pull website data from under a running instance
+static gboolean
+melange_maintenance_instance_running(const char *application_id) {
+    GDBusConnection *bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+    if (!bus) return FALSE;
+
+    gboolean running = FALSE;
+    GVariant *reply = g_dbus_connection_call_sync(bus, "org.freedesktop.DBus",
+            "/org/freedesktop/DBus", "org.freedesktop.DBus", "NameHasOwner",
+            g_variant_new("(s)", application_id), G_VARIANT_TYPE("(b)"), G_DBUS_CALL_FLAGS_NONE, -1,
+            NULL, NULL);
+    if (reply) {
+        g_variant_get(reply, "(b)", &running);
+        g_variant_unref(reply);
+    }
+    g_object_unref(bus);
+    return running;
+}
+
+
+static void
+melange_maintenance_account_done(MelangeMaintenanceAccount *account) {
+    MelangeMaintenance *maintenance = account->maintenance;
+    g_object_unref(account->web_context);
+    g_free(account->base_domain);
+    g_free(account->id);
+    g_free(account);
+
+    if (--maintenance->pending == 0) {
+        g_main_loop_quit(maintenance->loop);
+    }
+}
+
+
+static void
+melange_maintenance_finish_operation(WebKitWebsiteDataManager *data_manager,
+        GAsyncResult *result, MelangeMaintenanceAccount *account,
+        gboolean (*finish)(WebKitWebsiteDataManager *, GAsyncResult *, GError **)) {
+    GError *error = NULL;
+    if (!finish(data_manager, result, &error)) {
+        g_warning("Unable to clean up website data of %s: %s", account->id, error->message);
+        g_error_free(error);
+        account->maintenance->ok = FALSE;
+    }
+}
+
+
+static void
+melange_maintenance_disk_cache_cleared(WebKitWebsiteDataManager *data_manager,
+        GAsyncResult *result, MelangeMaintenanceAccount *account) {
+    melange_maintenance_finish_operation(data_manager, result, account,
+            webkit_website_data_manager_clear_finish);
+    melange_maintenance_account_done(account);
+}
+
+
+static void
+melange_maintenance_clear_disk_cache(MelangeMaintenanceAccount *account) {
+    if (account->clear_disk_cache && !account->maintenance->dry_run) {
+        webkit_website_data_manager_clear(
+                webkit_web_context_get_website_data_manager(account->web_context),
+                WEBKIT_WEBSITE_DATA_DISK_CACHE, 0, NULL,
+                (GAsyncReadyCallback) melange_maintenance_disk_cache_cleared, account);
+    } else {
+        melange_maintenance_account_done(account);
+    }
+}
+
+
+static void
+melange_maintenance_site_data_removed(WebKitWebsiteDataManager *data_manager,
+        GAsyncResult *result, MelangeMaintenanceAccount *account) {
+    melange_maintenance_finish_operation(data_manager, result, account,
+            webkit_website_data_manager_remove_finish);
+    melange_maintenance_clear_disk_cache(account);
+}
+
+
+static void
+melange_maintenance_site_data_fetched(WebKitWebsiteDataManager *data_manager,
+        GAsyncResult *result, MelangeMaintenanceAccount *account) {
+    GError *error = NULL;
+    GList *data = webkit_website_data_manager_fetch_finish(data_manager, result, &error);
+    if (error) {
+        g_warning("Unable to list website data of %s: %s", account->id, error->message);
+        g_error_free(error);
+        account->maintenance->ok = FALSE;
+    }
+
+    GList *stale = NULL;
+    for (GList *item = data; item; item = item->next) {
+        const char *name = webkit_website_data_get_name(item->data);
+        char *base_domain = melange_maintenance_get_base_domain(name);
+        if (g_strcmp0(base_domain, account->base_domain) != 0) {
+            printf("  %s: %s service workers and offline caches of %s\n", account->id,
+                    melange_maintenance_action(account->maintenance), name);
+            stale = g_list_prepend(stale, item->data);
+        }
+        g_free(base_domain);
+    }
+
+    if (stale && !account->maintenance->dry_run) {
+        webkit_website_data_manager_remove(data_manager, MELANGE_MAINTENANCE_SITE_DATA, stale,
+                NULL, (GAsyncReadyCallback) melange_maintenance_site_data_removed, account);
+    } else {
+        melange_maintenance_clear_disk_cache(account);
+    }
+    g_list_free(stale);
+    g_list_free_full(data, (GDestroyNotify) webkit_website_data_unref);
+}
+
+
+static void
+melange_maintenance_check_account(MelangeAccount *config_account, MelangeMaintenance *maintenance,
+        MelangeConfig *config, const char *data_dir, const char *cache_dir) {
+    char *data_path = g_build_filename(data_dir, config_account->id, NULL);
+    char *cache_path = g_build_filename(cache_dir, config_account->id, NULL);
+    guint quota = config_account->cache_quota > 0 ? config_account->cache_quota
+            : config->cache_quota;
+
+    // Accounts that have not been loaded since data and cache were split still keep both in the
+    // cache directory, see melange_account_view_load()
+    gboolean legacy = !g_file_test(data_path, G_FILE_TEST_IS_DIR);
+    guint64 data_size, cache_size;
+    if (legacy) {
+        g_free(data_path);
+        data_path = g_strdup(cache_path);
+        char *disk_cache_path = g_build_filename(cache_path, "WebKitCache", NULL);
+        cache_size = melange_util_directory_size(disk_cache_path, NULL);
+        data_size = melange_util_directory_size(data_path, NULL) - cache_size;
+        g_free(disk_cache_path);
+    } else {
+        data_size = melange_util_directory_size(data_path, NULL);
+        cache_size = melange_util_directory_size(cache_path, NULL);
+    }
+
+    printf("%-24s %12.1f %12.1f %12u\n", config_account->id, melange_maintenance_mib(data_size),
+            melange_maintenance_mib(cache_size), quota);
+
+    if (!g_file_test(data_path, G_FILE_TEST_IS_DIR)) {
+        // Never loaded, and creating a data manager would create the directories
+        g_free(cache_path);
+        g_free(data_path);
+        return;
+    }
+
+    MelangeMaintenanceAccount *account = g_new0(MelangeMaintenanceAccount, 1);
+    account->maintenance = maintenance;
+    account->id = g_strdup(config_account->id);
+    SoupURI *uri = soup_uri_new(melange_account_get_service_url(config_account));
+    account->base_domain = melange_maintenance_get_base_domain(uri ? uri->host : NULL);
+    if (uri) {
+        soup_uri_free(uri);
+    }
+
+    account->clear_disk_cache = quota > 0 && cache_size > (guint64) quota * 1024 * 1024;
+    if (account->clear_disk_cache) {
+        printf("  %s: disk cache exceeds the quota, %s %.1f MiB\n", account->id,
+                melange_maintenance_action(maintenance), melange_maintenance_mib(cache_size));
+    }
+
+    // The web context keeps the network process that operates on the data manager alive
+    WebKitWebsiteDataManager *data_manager = webkit_website_data_manager_new(
+            "base-data-directory", data_path,
+            "base-cache-directory", cache_path,
+            NULL);
+    account->web_context = webkit_web_context_new_with_website_data_manager(data_manager);
+    ++maintenance->pending;
+    webkit_website_data_manager_fetch(data_manager, MELANGE_MAINTENANCE_SITE_DATA, NULL,
+            (GAsyncReadyCallback) melange_maintenance_site_data_fetched, account);
+    g_object_unref(data_manager);
+
+    g_free(cache_path);
+    g_free(data_path);
+}
+
+
+// Directories below accounts_dir are named after account ids. Ids that appear anywhere in the
+// file are kept, even if their block was ignored, e.g. for naming a preset that no longer exists.
+static void
+melange_maintenance_remove_orphans(MelangeMaintenance *maintenance,
+        const MelangeConfigParseReport *report, const char *accounts_dir) {
+    GDir *dir = g_dir_open(accounts_dir, 0, NULL);
+    if (!dir) return;
+
+    const char *name;
+    while ((name = g_dir_read_name(dir))) {
+        if (g_hash_table_contains(report->account_ids, name)) continue;
+
+        char *path = g_build_filename(accounts_dir, name, NULL);
+        printf("Orphaned %s: %s %.1f MiB\n", path, maintenance->keep_orphans ? "keeping"
+                : melange_maintenance_action(maintenance),
+                melange_maintenance_mib(melange_util_directory_size(path, NULL)));
+        if (!maintenance->dry_run && !maintenance->keep_orphans
+                && !melange_util_remove_directory(path)) {
+            g_warning("Unable to remove %s entirely", path);
+            maintenance->ok = FALSE;
+        }
+        g_free(path);
+    }
+    g_dir_close(dir);
+}
+
+
+int
+melange_maintenance_run(const char *application_id, const char *config_file_name,
+        gboolean dry_run) {
+    if (!dry_run && melange_maintenance_instance_running(application_id)) {
+        g_printerr("Melange is running, quit it first or use --dry-run\n");
+        return EXIT_FAILURE;
+    }
+
+    // A config that fails to parse must not make every account look orphaned
+    GError *error = NULL;
+    char *contents = NULL;
+    gsize length = 0;
+    MelangeConfigParseReport report = { .account_ids = NULL, .dropped_blocks = 0 };
+    MelangeConfig *config;
+    if (g_file_get_contents(config_file_name, &contents, &length, &error)) {
+        config = melange_config_new_from_data_with_report(contents, length, config_file_name,
+                &report, &error);
+        g_free(contents);
+    } else if (g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+        g_clear_error(&error);
+        config = melange_config_new();
+        report.account_ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    } else {
+        config = NULL;
+    }
+    if (!config) {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        return EXIT_FAILURE;
+    }
+
+    // Nor must one that lost account blocks, or one that has been emptied or truncated
+    MelangeMaintenance maintenance = {
+            .dry_run = dry_run,
+            .keep_orphans = report.dropped_blocks > 0 || config->accounts->len == 0,
+            .loop = g_main_loop_new(NULL, FALSE),
+            .pending = 0,
+            .ok = TRUE,
+    };
+    char *data_dir = g_build_filename(g_get_user_data_dir(), "melange", "accounts", NULL);
+    char *cache_dir = g_build_filename(g_get_user_cache_dir(), "melange", "accounts", NULL);
+
+    printf("%-24s %12s %12s %12s\n", "account", "data [MiB]", "cache [MiB]", "quota [MiB]");
+    for (guint i = 0; i < config->accounts->len; ++i) {
+        melange_maintenance_check_account(g_array_index(config->accounts, MelangeAccount *, i),
+                &maintenance, config, data_dir, cache_dir);
+    }
+    if (maintenance.pending > 0) {
+        g_main_loop_run(maintenance.loop);
+    }
+
+    if (maintenance.keep_orphans) {
+        printf("%s, keeping orphaned directories\n", report.dropped_blocks > 0
+                ? "Some account blocks in the configuration were ignored"
+                : "The configuration has no accounts");
+    }
+    melange_maintenance_remove_orphans(&maintenance, &report, data_dir);
+    melange_maintenance_remove_orphans(&maintenance, &report, cache_dir);
+    fflush(stdout);
+
+    g_free(cache_dir);
+    g_free(data_dir);
+    g_main_loop_unref(maintenance.loop);
+    melange_config_parse_report_clear(&report);
+    melange_config_free(config);
+    return maintenance.ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,18 @@
+#ifndef MELANGE_MAINTENANCE_H
+#define MELANGE_MAINTENANCE_H
+
+#include <glib.h>
+
+
+// melange --maintenance: Reports the disk usage of every account and cleans up website data
+// without creating a window, e.g. from a systemd timer. Removes account directories whose id
+// appears nowhere in the config, disk caches over their quota, and service workers and offline app
+// caches of sites other than the account's service. Orphaned directories are only listed if the
+// config has no accounts or some block was ignored. With dry_run, only prints what would be
+// removed.
+// Returns an exit status.
+int melange_maintenance_run(const char *application_id, const char *config_file_name,
+        gboolean dry_run);
+
+
+#endif // MELANGE_MAINTENANCE_H
@@ -1,11 +1,40 @@
 #include "mainwindow.h"
+#include "accountview.h"
 #include "presets.h"
 #include "util.h"
+#include "trace.h"
 
-#include <stdlib.h>
 #include <string.h>
 
 
+// Seconds between two samples of web process memory
+#define MELANGE_MAIN_WINDOW_MEMORY_SAMPLE_INTERVAL (5 * 60)
+
+// Background accounts are parked once the network has been gone for this many seconds, or right
+// before the machine goes to sleep
+#define MELANGE_MAIN_WINDOW_PARK_DELAY 30
+// After resuming, the network monitor may not have noticed the dead link yet
+#define MELANGE_MAIN_WINDOW_RESUME_DELAY 5
+// Reconnecting accounts are started this many seconds apart, at most this many loading at once.
+// An account that has not finished loading after the timeout gives up its slot.
+#define MELANGE_MAIN_WINDOW_RECONNECT_STAGGER 2
+#define MELANGE_MAIN_WINDOW_RECONNECT_CONCURRENCY 2
+#define MELANGE_MAIN_WINDOW_RECONNECT_TIMEOUT 30
+
+
+// Unread messages of one account as last reported by its unread probe
+typedef struct MelangeMainWindowUnreadCounter {
+    MelangeMainWindow *win;
+    // The red badge on the switcher button
+    GtkWidget *label;
+    int count;
+    // Value last applied to label
+    int shown;
+    // Waiting in MelangeMainWindow::dirty_unread_counters
+    gboolean dirty;
+} MelangeMainWindowUnreadCounter;
+
+
 struct MelangeMainWindow {
     GtkApplicationWindow parent_instance;
 
@@ -18,7 +47,10 @@ struct MelangeMainWindow {
     GtkWidget *account_details_view;
 
     // Which view was active before the current one? (For navigation with back/escape)
-    GtkWidget *last_web_view;
+    GtkWidget *last_account_view;
+
+    // Maps MelangeAccount* to their MelangeAccountView
+    GHashTable *account_views;
 
     GtkWidget *sidebar_revealer;
 
@@ -36,13 +68,47 @@ struct MelangeMainWindow {
 
     GtkWidget *download_dialog;
 
-    // Matches number of notifications in titles like "(1) WhatsApp"
-    GRegex *new_message_regex;
-
     guint sidebar_timeout;
-    guint notification_timeout;
+
+    // Loads the remaining account views one by one in "background" load mode
+    guint preload_timeout;
+
+    // Periodically hibernates idle background accounts, active if hibernate-after > 0
+    guint hibernate_timeout;
+    // Samples web process memory while recycle-threshold is set
+    guint recycle_timeout;
+
+    // Without network or while asleep, background accounts are parked (hibernated), and reloads
+    // are put off. Afterwards they come back one by one, see melange_main_window_reconnect_next().
+    GNetworkMonitor *network_monitor;
+    GDBusConnection *system_bus;
+    guint sleep_subscription;
+    gboolean offline;
+    gboolean asleep;
+    gboolean disconnected;
+    guint park_timeout;
+    guint resume_timeout;
+    // MelangeAccountView* waiting to reconnect, most recently used first
+    GList *reconnect_queue;
+    // MelangeAccountView* currently reconnecting -> monotonic second at which it started
+    GHashTable *reconnecting;
+    guint reconnect_timeout;
+
+#if GLIB_CHECK_VERSION(2, 64, 0)
+    GMemoryMonitor *memory_monitor;
+#endif
 
     const char *initial_csd_setting;
+
+    // MelangeMainWindowUnreadCounter* of all account views
+    GPtrArray *unread_counters;
+    // Counters changed since the last UI update, which happens at most once per frame
+    GPtrArray *dirty_unread_counters;
+    int unread_total;
+    int unread_total_shown;
+    // Tick callback while the window is mapped, idle source while it is hidden to the tray
+    guint unread_update;
+    gboolean unread_update_is_tick;
 };
 
 
@@ -73,145 +139,115 @@ melange_main_window_set_property(GObject *object, guint property_id, const GValu
 }
 
 
-static gboolean
-melange_main_window_web_view_context_menu(WebKitWebView *web_view, WebKitContextMenu *context_menu,
-        GdkEvent *event,
-        WebKitHitTestResult *hit_test_result, gpointer user_data) {
-    (void) web_view;
-    (void) context_menu;
-    (void) event;
-    (void) hit_test_result;
-    (void) user_data;
+// Applies all changed counts to the badges and the total to the tray and window icon
+static void
+melange_main_window_update_unread_messages(MelangeMainWindow *win) {
+    for (guint i = 0; i < win->dirty_unread_counters->len; ++i) {
+        MelangeMainWindowUnreadCounter *counter = g_ptr_array_index(win->dirty_unread_counters, i);
+        counter->dirty = FALSE;
+        if (counter->count == counter->shown) continue;
+
+        if (counter->count > 0) {
+            char text[12];
+            snprintf(text, sizeof text, "%d", counter->count);
+            gtk_label_set_text(GTK_LABEL(counter->label), text);
+        }
+        gtk_widget_set_visible(counter->label, counter->count > 0);
+        counter->shown = counter->count;
+    }
+    g_ptr_array_set_size(win->dirty_unread_counters, 0);
 
-    // Suppress context menu
-    return TRUE;
+    if (win->unread_total != win->unread_total_shown) {
+        g_object_set(win->app, "unread-messages", win->unread_total, NULL);
+        win->unread_total_shown = win->unread_total;
+    }
 }
 
 
-// If difference == 0, resets the notification count for web_view to 0.
-// If difference > 0, adds `difference` notifications to web_view.
-// Configures the red notification labels and updates the global notification count.
-static void
-melange_main_window_update_unread_messages(MelangeMainWindow *win, WebKitWebView *web_view,
-        int difference) {
-    int global;
-    g_object_get(win->app, "unread-messages", &global, NULL);
-    int local = (int) (intptr_t) g_object_get_data(G_OBJECT(web_view), "unread-messages");
+static gboolean
+melange_main_window_unread_tick(GtkWidget *widget, GdkFrameClock *frame_clock,
+        gpointer user_data) {
+    (void) widget;
+    (void) frame_clock;
 
-    if (difference == 0) {
-        global = local = 0;
-    } else {
-        local = MAX(0, local) + difference; // local starts out at -1
-        global += difference;
-    }
+    MelangeMainWindow *win = user_data;
+    win->unread_update = 0;
+    melange_main_window_update_unread_messages(win);
+    return G_SOURCE_REMOVE;
+}
 
-    g_object_set(win->app, "unread-messages", global, NULL);
-    g_object_set_data(G_OBJECT(web_view), "unread-messages", (gpointer) (intptr_t) local);
 
-    GtkWidget *notify_label = g_object_get_data(G_OBJECT(web_view), "notify-label");
-    if (local > 0) {
-        char text[10] = { 0 };
-        snprintf(text, 10, "%d", local);
-        gtk_label_set_text(GTK_LABEL(notify_label), text);
-    }
-    gtk_widget_set_visible(notify_label, local > 0);
+static gboolean
+melange_main_window_unread_idle(MelangeMainWindow *win) {
+    win->unread_update = 0;
+    melange_main_window_update_unread_messages(win);
+    return G_SOURCE_REMOVE;
 }
 
 
-static void
-melange_main_window_web_view_notify_title(WebKitWebView *web_view, GParamSpec *pspec,
-        MelangeMainWindow *win) {
-    (void) pspec;
-    (void) win;
+// Cancels a scheduled update. Returns TRUE if there was one.
+static gboolean
+melange_main_window_cancel_unread_update(MelangeMainWindow *win) {
+    if (!win->unread_update) return FALSE;
 
-    // Only use the title notification count if we have not seen any data yet. Later, incoming
-    // notification pop-ups are counted towards the notification count instead
-    if (g_object_get_data(G_OBJECT(web_view), "unread-messages") != (gpointer) -1) {
-        return;
+    if (win->unread_update_is_tick) {
+        gtk_widget_remove_tick_callback(GTK_WIDGET(win), win->unread_update);
+    } else {
+        g_source_remove(win->unread_update);
     }
+    win->unread_update = 0;
+    return TRUE;
+}
 
-    int unread = 0;
 
-    // Parse title like "(1) WhatsApp"
-    GMatchInfo *match;
-    g_regex_match(win->new_message_regex, webkit_web_view_get_title(web_view), 0, &match);
-    if (g_match_info_matches(match)) {
-        unread = (int) strtol(g_match_info_fetch(match, 2), NULL, 10);
-        melange_main_window_update_unread_messages(win, web_view, unread);
+static void
+melange_main_window_queue_unread_update(MelangeMainWindow *win) {
+    if (win->unread_update) return;
+
+    // Frames are not drawn while the window is hidden, but the tray icon still needs updating
+    win->unread_update_is_tick = gtk_widget_get_mapped(GTK_WIDGET(win));
+    if (win->unread_update_is_tick) {
+        win->unread_update = gtk_widget_add_tick_callback(GTK_WIDGET(win),
+                melange_main_window_unread_tick, win, NULL);
+    } else {
+        win->unread_update = g_idle_add((GSourceFunc) melange_main_window_unread_idle, win);
     }
 }
 
 
+// The count is pushed by the unread probe running inside the page whenever it changes. Bursts of
+// changes end up in a single UI update with the next frame.
 static void
-melange_main_window_web_view_load_changed(WebKitWebView *web_view, WebKitLoadEvent load_event,
-        MelangeMainWindow *win) {
-    MelangeAccount *account = g_object_get_data(G_OBJECT(web_view), "account");
-    if (account->preset && load_event == WEBKIT_LOAD_FINISHED) {
-        // Inject JS code for modifying style etc.
-        char *file_name = g_strdup_printf("js/%s.js", account->preset->id);
-        char *override_js = melange_app_load_text_resource(win->app, file_name, TRUE);
-        if (override_js) {
-            webkit_web_view_run_javascript(web_view, override_js, NULL, NULL, NULL);
-            g_free(override_js);
-        }
-        g_free(file_name);
+melange_main_window_account_view_unread_messages_changed(MelangeAccountView *view, int unread,
+        MelangeMainWindowUnreadCounter *counter) {
+    (void) view;
+
+    if (unread == counter->count) return;
+
+    MelangeMainWindow *win = counter->win;
+    win->unread_total = MAX(0, win->unread_total + unread - counter->count);
+    counter->count = unread;
+    if (!counter->dirty) {
+        counter->dirty = TRUE;
+        g_ptr_array_add(win->dirty_unread_counters, counter);
     }
+    melange_main_window_queue_unread_update(win);
 }
 
 
 static gboolean
 melange_main_window_web_view_show_notification(WebKitWebView *web_view,
         WebKitNotification *notification, MelangeMainWindow *win) {
-    MelangeAccount *account = g_object_get_data(G_OBJECT(web_view), "account");
-    g_assert(account);
-
-    // If view in background, count towards notification label
-    if (!gtk_window_is_active(GTK_WINDOW(win))
-            || gtk_stack_get_visible_child(GTK_STACK(win->view_stack)) != GTK_WIDGET(web_view)) {
-        melange_main_window_update_unread_messages(win, web_view, 1);
-    }
+    MelangeAccount *account = melange_account_view_get_account(
+            melange_account_view_for_web_view(web_view));
 
     const char *title = webkit_notification_get_title(notification);
     const char *body = webkit_notification_get_body(notification);
-    const char *icon = account->preset ? account->preset->id : NULL;
-
-    melange_app_show_message_notification(win->app, title, body, icon);
+    melange_app_show_message_notification(win->app, account, title, body);
     return TRUE;
 }
 
 
-// "decide-policy" is emitted when a new navigation request is received, e.g. from clicking a link.
-gboolean
-melange_main_window_web_view_decide_policy(WebKitWebView *web_view, WebKitPolicyDecision *decision,
-        WebKitPolicyDecisionType decision_type, MelangeMainWindow *win) {
-    (void) web_view;
-    (void) win;
-
-    if (decision_type == WEBKIT_POLICY_DECISION_TYPE_NEW_WINDOW_ACTION
-            || decision_type == WEBKIT_POLICY_DECISION_TYPE_NAVIGATION_ACTION) {
-        WebKitNavigationAction *action = webkit_navigation_policy_decision_get_navigation_action(
-                        WEBKIT_NAVIGATION_POLICY_DECISION(decision));
-        const char *uri = webkit_uri_request_get_uri(webkit_navigation_action_get_request(action));
-        if (strncmp(uri, "blob:", 5) == 0) {
-            // Download urls start with blob:, apparently
-            webkit_policy_decision_download(decision);
-            return TRUE;
-        } else if (decision_type == WEBKIT_POLICY_DECISION_TYPE_NEW_WINDOW_ACTION) {
-            // Web apps usually try to open external urls in a new window, so we can redirect that
-            // to the os to open a browser window
-            GError *error = NULL;
-            if (!g_app_info_launch_default_for_uri(uri, NULL, &error)) {
-                g_warning("Unable to open URI %s in external application: %s", uri, error->message);
-                g_error_free(error);
-            }
-            webkit_policy_decision_ignore(decision);
-            return TRUE;
-        }
-    }
-    return FALSE;
-}
-
-
 static gboolean
 melange_main_window_download_decide_destination(WebKitDownload *download, gchar *suggested_filename,
         MelangeMainWindow *win) {
@@ -256,7 +292,7 @@ melange_main_window_set_sidebar_visible(MelangeMainWindow *win, gboolean visible
 
 static gboolean
 melange_main_window_hide_sidebar_callback(MelangeMainWindow *win) {
-    if (WEBKIT_IS_WEB_VIEW(gtk_stack_get_visible_child(GTK_STACK(win->view_stack)))) {
+    if (MELANGE_IS_ACCOUNT_VIEW(gtk_stack_get_visible_child(GTK_STACK(win->view_stack)))) {
         melange_main_window_set_sidebar_visible(win, FALSE);
     }
     win->sidebar_timeout = 0;
@@ -335,66 +371,52 @@ melange_main_window_client_side_decorations_setting_changed(GtkComboBox *combo_b
 }
 
 
-static gboolean
-melange_main_window_clear_active_view_notification(MelangeMainWindow *win) {
-    GtkWidget *active_view = gtk_stack_get_visible_child(GTK_STACK(win->view_stack));
-    melange_main_window_update_unread_messages(win, WEBKIT_WEB_VIEW(active_view), 0);
-    win->notification_timeout = 0;
-    return false;
-}
-
-
 static void
-melange_main_window_cancel_notification_timeout(MelangeMainWindow *win) {
-    if (win->notification_timeout) {
-        g_source_remove(win->notification_timeout);
-        win->notification_timeout = 0;
-    }
-}
-
+melange_main_window_realize(GtkWidget *widget) {
+    GTK_WIDGET_CLASS(melange_main_window_parent_class)->realize(widget);
 
-static void
-melange_main_window_clear_active_view_notification_after_timeout(MelangeMainWindow *win) {
-    if (!win->notification_timeout) {
-        GtkWidget *active_view = gtk_stack_get_visible_child(GTK_STACK(win->view_stack));
-        if (WEBKIT_IS_WEB_VIEW(active_view)) {
-            win->notification_timeout = g_timeout_add(3000,
-                    (GSourceFunc) melange_main_window_clear_active_view_notification, win);
-        }
-    }
+    MelangeMainWindow *win = MELANGE_MAIN_WINDOW(widget);
+    melange_main_window_hide_sidebar_after_timeout(win, 3000);
+    gtk_stack_set_visible_child(GTK_STACK(win->view_stack),
+            win->last_account_view ? win->last_account_view : win->add_view);
 }
 
 
+// A pending tick callback would not run before the window is shown again
 static void
-melange_main_window_notify_is_active(GObject *obj, GParamSpec *pspec, MelangeMainWindow *win) {
-    (void) obj;
-    (void) pspec;
-
-    melange_main_window_cancel_notification_timeout(win);
-
-    // If the user has looked at a view for 3 seconds, clear the notification count
-    if (gtk_window_is_active(GTK_WINDOW(win))) {
-        melange_main_window_clear_active_view_notification_after_timeout(win);
+melange_main_window_unmap(GtkWidget *widget) {
+    MelangeMainWindow *win = MELANGE_MAIN_WINDOW(widget);
+    if (melange_main_window_cancel_unread_update(win)) {
+        melange_main_window_update_unread_messages(win);
     }
-}
-
 
-static void
-melange_main_window_realize(GtkWidget *widget) {
-    GTK_WIDGET_CLASS(melange_main_window_parent_class)->realize(widget);
-
-    MelangeMainWindow *win = MELANGE_MAIN_WINDOW(widget);
-    melange_main_window_hide_sidebar_after_timeout(win, 3000);
-    gtk_stack_set_visible_child(GTK_STACK(win->view_stack),
-            win->last_web_view ? win->last_web_view : win->add_view);
+    GTK_WIDGET_CLASS(melange_main_window_parent_class)->unmap(widget);
 }
 
 
 static void
 melange_main_window_init(MelangeMainWindow *win) {
     win->sidebar_timeout = 0;
-    win->notification_timeout = 0;
-    win->new_message_regex = g_regex_new("(^\\s*|.*\\()(\\d+)\\b", 0, 0, NULL);
+    win->preload_timeout = 0;
+    win->hibernate_timeout = 0;
+    win->recycle_timeout = 0;
+    win->network_monitor = NULL;
+    win->system_bus = NULL;
+    win->sleep_subscription = 0;
+    win->offline = FALSE;
+    win->asleep = FALSE;
+    win->disconnected = FALSE;
+    win->park_timeout = 0;
+    win->resume_timeout = 0;
+    win->reconnect_queue = NULL;
+    win->reconnecting = g_hash_table_new(g_direct_hash, g_direct_equal);
+    win->reconnect_timeout = 0;
+    win->account_views = g_hash_table_new(g_direct_hash, g_direct_equal);
+    win->unread_counters = g_ptr_array_new_with_free_func(g_free);
+    win->dirty_unread_counters = g_ptr_array_new();
+    win->unread_total = 0;
+    win->unread_total_shown = 0;
+    win->unread_update = 0;
 
     GdkGeometry hints = { .min_width = 800, .min_height = 600 };
     gtk_window_set_geometry_hints(GTK_WINDOW(win), NULL, &hints, GDK_HINT_MIN_SIZE);
@@ -410,17 +432,10 @@ melange_main_window_switch_to_view(GtkWidget *view) {
 
 static void
 melange_main_window_switcher_button_clicked(GtkButton *button, MelangeMainWindow *win) {
-    (void) button;
-
-    melange_main_window_cancel_notification_timeout(win);
+    (void) win;
 
     GtkWidget *switch_to = GTK_WIDGET(g_object_get_data(G_OBJECT(button), "switch-to"));
     melange_main_window_switch_to_view(switch_to);
-
-    // If the user has looked at a view for 3 seconds, clear the notification count
-    if (WEBKIT_IS_WEB_VIEW(switch_to)) {
-        melange_main_window_clear_active_view_notification_after_timeout(win);
-    }
 }
 
 
@@ -456,11 +471,11 @@ melange_main_window_create_switcher_button(MelangeMainWindow *win, GdkPixbuf *pi
 
         gtk_container_add(GTK_CONTAINER(switcher), overlay);
         g_object_set_data(G_OBJECT(switcher), "notify-label", label);
-        g_object_set_data(G_OBJECT(switch_to), "notify-label", label);
     } else {
         gtk_button_set_image(GTK_BUTTON(switcher), image);
     }
 
+    g_object_set_data(G_OBJECT(switcher), "image", image);
     g_object_set_data(G_OBJECT(switcher), "switch-to", switch_to);
     g_signal_connect(switcher, "clicked", G_CALLBACK(melange_main_window_switcher_button_clicked),
             win);
@@ -493,6 +508,17 @@ melange_main_window_app_notify_auto_hide_sidebar(GObject *app, GParamSpec *pspec
 }
 
 
+// Keeps a settings switch in line with its property when the config is reloaded
+static void
+melange_main_window_app_notify_setting_switch(GObject *app, GParamSpec *pspec, GtkSwitch *setting) {
+    gboolean state;
+    g_object_get(app, g_param_spec_get_name(pspec), &state, NULL);
+    if (gtk_switch_get_active(setting) != state) {
+        gtk_switch_set_active(setting, state);
+    }
+}
+
+
 static void
 melange_main_window_app_notify_client_side_decorations(GObject *app, GParamSpec *pspec,
         MelangeMainWindow *win) {
@@ -507,9 +533,9 @@ melange_main_window_navigate_back(MelangeMainWindow *win) {
     GtkWidget *view = gtk_stack_get_visible_child(GTK_STACK(win->view_stack));
     if (view == win->settings_view) {
         gtk_stack_set_visible_child(GTK_STACK(win->view_stack),
-                win->last_web_view ? win->last_web_view : win->add_view);
-    } else if (view == win->add_view && win->last_web_view) {
-        gtk_stack_set_visible_child(GTK_STACK(win->view_stack), win->last_web_view);
+                win->last_account_view ? win->last_account_view : win->add_view);
+    } else if (view == win->add_view && win->last_account_view) {
+        gtk_stack_set_visible_child(GTK_STACK(win->view_stack), win->last_account_view);
     } else if (view == win->account_details_view) {
         gtk_stack_set_visible_child(GTK_STACK(win->view_stack), win->add_view);
     } else {
@@ -546,98 +572,510 @@ melange_main_window_key_press_event(GtkWidget *widget, GdkEventKey *event, Melan
 }
 
 
+// Frees the reconnect slot, also if the load failed
 static void
-melange_main_window_add_account_view(MelangeAccount *account, MelangeMainWindow *win) {
-    char *base_path = g_strdup_printf("%s/melange/accounts/%s", g_get_user_cache_dir(),
-            account->id);
-
-    // Each web view has its own data manager and web context to allow multiple accounts of the
-    // same messenger
+melange_main_window_web_view_load_changed(WebKitWebView *web_view, WebKitLoadEvent load_event,
+        MelangeMainWindow *win) {
+    if (load_event == WEBKIT_LOAD_FINISHED) {
+        g_hash_table_remove(win->reconnecting, melange_account_view_for_web_view(web_view));
+    }
+}
 
-    WebKitWebsiteDataManager *data_manager = webkit_website_data_manager_new(
-            "base-data-directory", base_path,
-            "base-cache-directory", base_path,
-            NULL);
 
-    g_free(base_path);
+static void
+melange_main_window_account_view_web_view_created(MelangeAccountView *view,
+        WebKitWebView *web_view, MelangeMainWindow *win) {
+    (void) view;
 
-    WebKitWebContext *web_context = webkit_web_context_new_with_website_data_manager(data_manager);
-    g_signal_connect(web_context, "download-started",
+    g_signal_connect(webkit_web_view_get_context(web_view), "download-started",
             G_CALLBACK(melange_main_window_web_context_download_started), win);
-
-    WebKitSecurityOrigin *origin = webkit_security_origin_new_for_uri(
-            melange_account_get_service_url(account));
-    GList *allowed_origins = g_list_append(NULL, origin);
-    webkit_web_context_initialize_notification_permissions(web_context, allowed_origins, NULL);
-
-    GtkWidget *web_view = webkit_web_view_new_with_context(web_context);
-    g_signal_connect(web_view, "context-menu",
-            G_CALLBACK(melange_main_window_web_view_context_menu), win);
-    g_signal_connect(web_view, "notify::title",
-            G_CALLBACK(melange_main_window_web_view_notify_title), win);
-    g_signal_connect(web_view, "load-changed",
-            G_CALLBACK(melange_main_window_web_view_load_changed), win);
     g_signal_connect(web_view, "show-notification",
             G_CALLBACK(melange_main_window_web_view_show_notification), win);
-    g_signal_connect(web_view, "decide-policy",
-            G_CALLBACK(melange_main_window_web_view_decide_policy), win);
-
-    WebKitSettings *sett = webkit_web_view_get_settings(WEBKIT_WEB_VIEW(web_view));
-    webkit_settings_set_user_agent(sett, melange_account_get_user_agent(account));
-    webkit_settings_set_enable_java(sett, FALSE);
-    webkit_settings_set_enable_offline_web_application_cache(sett, TRUE);
-    webkit_settings_set_enable_plugins(sett, FALSE);
-    webkit_settings_set_enable_developer_extras(sett, FALSE);
+    g_signal_connect(web_view, "load-changed",
+            G_CALLBACK(melange_main_window_web_view_load_changed), win);
+}
 
-    webkit_web_view_load_uri(WEBKIT_WEB_VIEW(web_view), melange_account_get_service_url(account));
-    gtk_container_add(GTK_CONTAINER(win->view_stack), web_view);
-    gtk_widget_show_all(web_view);
 
-    if (!win->last_web_view) {
-        win->last_web_view = web_view;
+static GtkWidget *
+melange_main_window_create_account_view(MelangeMainWindow *win, MelangeAccount *account) {
+    gint64 trace_begin = MELANGE_TRACE_BEGIN();
+    GtkWidget *view = melange_account_view_new(win->app, account);
+    g_signal_connect(view, "web-view-created",
+            G_CALLBACK(melange_main_window_account_view_web_view_created), win);
+    gtk_container_add(GTK_CONTAINER(win->view_stack), view);
+    gtk_widget_show(view);
+
+    if (!win->last_account_view) {
+        win->last_account_view = view;
     }
 
+    char *icon_id = melange_app_get_icon_id(account);
     GdkPixbuf *pixbuf = NULL;
-    if (account->preset) {
-        pixbuf = melange_app_request_icon(win->app, account->preset->id);
+    if (icon_id) {
+        pixbuf = melange_app_request_icon(win->app, icon_id);
     }
+    g_free(icon_id);
     if (!pixbuf) {
         pixbuf = melange_app_load_pixbuf_resource(win->app, "icons/light/messenger.svg",
                 32, 32, FALSE);
     }
 
+    // The switcher button is always created right away, even if the web view is loaded lazily
     GtkWidget *switcher_button = melange_main_window_create_switcher_button(
-            win, pixbuf, 0, web_view, TRUE);
+            win, pixbuf, 0, view, TRUE);
     gtk_container_add(GTK_CONTAINER(win->switcher_box), switcher_button);
     gtk_widget_show_all(switcher_button);
 
-    gpointer pointer = (gpointer) account;
-    g_object_set_data(G_OBJECT(web_view), "account", pointer);
-    g_object_set_data(G_OBJECT(switcher_button), "account", pointer);
+    g_object_set_data(G_OBJECT(switcher_button), "account", (gpointer) account);
+    g_object_set_data(G_OBJECT(view), "switcher-button", switcher_button);
+    g_hash_table_insert(win->account_views, account, view);
+
+    MelangeMainWindowUnreadCounter counter_template = {
+            .win = win,
+            .label = g_object_get_data(G_OBJECT(switcher_button), "notify-label"),
+            .count = 0,
+            .shown = 0,
+            .dirty = FALSE,
+    };
+    MelangeMainWindowUnreadCounter *counter = g_memdup(&counter_template, sizeof counter_template);
+    g_ptr_array_add(win->unread_counters, counter);
+    g_object_set_data(G_OBJECT(view), "unread-counter", counter);
+    g_signal_connect(view, "unread-messages-changed",
+            G_CALLBACK(melange_main_window_account_view_unread_messages_changed), counter);
+
+    char *load_accounts;
+    g_object_get(win->app, "load-accounts", &load_accounts, NULL);
+    if (g_str_equal(load_accounts, "eager")) {
+        melange_account_view_load(MELANGE_ACCOUNT_VIEW(view));
+    }
+    g_free(load_accounts);
+
+    MELANGE_TRACE_END(trace_begin, "add-account-view", account->id);
+    return view;
+}
+
+
+static void
+melange_main_window_add_account_view(MelangeAccount *account, MelangeMainWindow *win) {
+    melange_main_window_create_account_view(win, account);
+}
+
+
+static void
+melange_main_window_app_account_added(MelangeApp *app, MelangeAccount *account,
+        MelangeMainWindow *win) {
+    (void) app;
+    melange_main_window_create_account_view(win, account);
+}
+
+
+// Tears down the view along with its web process before the account is freed
+static void
+melange_main_window_app_account_removed(MelangeApp *app, MelangeAccount *account,
+        MelangeMainWindow *win) {
+    (void) app;
+
+    GtkWidget *view = g_hash_table_lookup(win->account_views, account);
+    if (!view) return;
+    g_hash_table_remove(win->account_views, account);
+
+    MelangeMainWindowUnreadCounter *counter = g_object_get_data(G_OBJECT(view), "unread-counter");
+    g_signal_handlers_disconnect_by_data(view, counter);
+    if (counter->dirty) {
+        g_ptr_array_remove_fast(win->dirty_unread_counters, counter);
+    }
+    if (counter->count > 0) {
+        win->unread_total = MAX(0, win->unread_total - counter->count);
+        melange_main_window_queue_unread_update(win);
+    }
+    g_ptr_array_remove_fast(win->unread_counters, counter);
+
+    if (win->last_account_view == view) {
+        win->last_account_view = NULL;
+    }
+    win->reconnect_queue = g_list_remove(win->reconnect_queue, view);
+    g_hash_table_remove(win->reconnecting, view);
+    if (gtk_stack_get_visible_child(GTK_STACK(win->view_stack)) == view) {
+        gtk_stack_set_visible_child(GTK_STACK(win->view_stack), win->add_view);
+    }
+    gtk_widget_destroy(g_object_get_data(G_OBJECT(view), "switcher-button"));
+    gtk_widget_destroy(view);
+}
+
+
+typedef struct MelangeMainWindowReorder {
+    MelangeMainWindow *win;
+    int position;
+} MelangeMainWindowReorder;
+
+
+static void
+melange_main_window_reorder_switcher_button(MelangeAccount *account,
+        MelangeMainWindowReorder *reorder) {
+    GtkWidget *view = g_hash_table_lookup(reorder->win->account_views, account);
+    if (view) {
+        gtk_box_reorder_child(GTK_BOX(reorder->win->switcher_box),
+                g_object_get_data(G_OBJECT(view), "switcher-button"), reorder->position++);
+    }
+}
+
 
-    g_object_set_data(G_OBJECT(web_view), "unread-messages", (gpointer) -1);
+static void
+melange_main_window_app_accounts_reordered(MelangeApp *app, MelangeMainWindow *win) {
+    MelangeMainWindowReorder reorder = { .win = win, .position = 0 };
+    melange_app_iterate_accounts(app,
+            (MelangeAccountConstFunc) melange_main_window_reorder_switcher_button, &reorder);
+}
+
+
+// In on-demand and background load mode, the web view is created once the account is selected
+static void
+melange_main_window_view_stack_notify_visible_child(GtkStack *stack, GParamSpec *pspec,
+        MelangeMainWindow *win) {
+    (void) pspec;
+
+    GtkWidget *view = gtk_stack_get_visible_child(stack);
+    if (MELANGE_IS_ACCOUNT_VIEW(view)) {
+        melange_account_view_load(MELANGE_ACCOUNT_VIEW(view));
+        melange_app_clear_message_notifications(win->app,
+                melange_account_view_get_account(MELANGE_ACCOUNT_VIEW(view)));
+    }
+}
+
+
+static gboolean
+melange_main_window_preload_next_account_view(MelangeMainWindow *win) {
+    // Continued once reconnected
+    if (win->disconnected) return TRUE;
+
+    GList *children = gtk_container_get_children(GTK_CONTAINER(win->view_stack));
+    gboolean loaded = FALSE;
+    for (GList *list = children; list && !loaded; list = list->next) {
+        if (MELANGE_IS_ACCOUNT_VIEW(list->data)
+                && !melange_account_view_is_loaded(MELANGE_ACCOUNT_VIEW(list->data))
+                && !melange_account_view_is_hibernated(MELANGE_ACCOUNT_VIEW(list->data))) {
+            melange_account_view_load(MELANGE_ACCOUNT_VIEW(list->data));
+            loaded = TRUE;
+        }
+    }
+    g_list_free(children);
+
+    if (!loaded) {
+        win->preload_timeout = 0;
+    }
+    return loaded;
+}
+
+
+// Hibernates all loaded accounts that are not currently visible and have been idle for at least
+// min_idle seconds
+static void
+melange_main_window_hibernate_background_views(MelangeMainWindow *win, gint64 min_idle) {
+    GtkWidget *visible = gtk_stack_get_visible_child(GTK_STACK(win->view_stack));
+    GList *children = gtk_container_get_children(GTK_CONTAINER(win->view_stack));
+    for (GList *list = children; list; list = list->next) {
+        if (!MELANGE_IS_ACCOUNT_VIEW(list->data) || list->data == visible) continue;
+
+        MelangeAccountView *view = MELANGE_ACCOUNT_VIEW(list->data);
+        if (melange_account_view_is_loaded(view)
+                && !melange_account_view_get_account(view)->keep_alive
+                && melange_account_view_get_idle_time(view) >= min_idle) {
+            melange_account_view_hibernate(view);
+        }
+    }
+    g_list_free(children);
+}
+
+
+static gboolean
+melange_main_window_hibernate_timeout_callback(MelangeMainWindow *win) {
+    // The visible account is in use as long as the window is shown
+    GtkWidget *visible = gtk_stack_get_visible_child(GTK_STACK(win->view_stack));
+    if (MELANGE_IS_ACCOUNT_VIEW(visible) && gtk_widget_get_visible(GTK_WIDGET(win))) {
+        melange_account_view_mark_used(MELANGE_ACCOUNT_VIEW(visible));
+    }
+
+    guint hibernate_after;
+    g_object_get(win->app, "hibernate-after", &hibernate_after, NULL);
+    melange_main_window_hibernate_background_views(win, (gint64) hibernate_after * 60);
+    return TRUE;
+}
+
+
+static void
+melange_main_window_app_notify_hibernate_after(GObject *app, GParamSpec *pspec,
+        MelangeMainWindow *win) {
+    (void) pspec;
+
+    guint hibernate_after;
+    g_object_get(app, "hibernate-after", &hibernate_after, NULL);
 
-    melange_main_window_switch_to_view(web_view);
+    if (win->hibernate_timeout) {
+        g_source_remove(win->hibernate_timeout);
+        win->hibernate_timeout = 0;
+    }
+    if (hibernate_after > 0) {
+        win->hibernate_timeout = g_timeout_add_seconds(60,
+                (GSourceFunc) melange_main_window_hibernate_timeout_callback, win);
+    }
+}
+
+
+// All loaded accounts are sampled, so that the visible one has its baseline once it is left. Only
+// background accounts are recycled, the visible one waits until the user switches away.
+static gboolean
+melange_main_window_recycle_timeout_callback(MelangeMainWindow *win) {
+    // The fresh page could not load
+    if (win->disconnected) return TRUE;
+
+    guint recycle_threshold;
+    g_object_get(win->app, "recycle-threshold", &recycle_threshold, NULL);
+    guint64 threshold = (guint64) recycle_threshold * 1024 * 1024;
+
+    GtkWidget *visible = gtk_stack_get_visible_child(GTK_STACK(win->view_stack));
+    gboolean window_visible = gtk_widget_get_visible(GTK_WIDGET(win));
+    GList *children = gtk_container_get_children(GTK_CONTAINER(win->view_stack));
+    for (GList *list = children; list; list = list->next) {
+        if (!MELANGE_IS_ACCOUNT_VIEW(list->data)) continue;
+
+        MelangeAccountView *view = MELANGE_ACCOUNT_VIEW(list->data);
+        if (melange_account_view_sample_memory_growth(view) > threshold
+                && (list->data != visible || !window_visible)) {
+            melange_account_view_recycle(view);
+        }
+    }
+    g_list_free(children);
+    return TRUE;
 }
 
 
+static void
+melange_main_window_app_notify_recycle_threshold(GObject *app, GParamSpec *pspec,
+        MelangeMainWindow *win) {
+    (void) pspec;
+
+    guint recycle_threshold;
+    g_object_get(app, "recycle-threshold", &recycle_threshold, NULL);
+
+    if (win->recycle_timeout) {
+        g_source_remove(win->recycle_timeout);
+        win->recycle_timeout = 0;
+    }
+    if (recycle_threshold > 0) {
+        win->recycle_timeout = g_timeout_add_seconds(MELANGE_MAIN_WINDOW_MEMORY_SAMPLE_INTERVAL,
+                (GSourceFunc) melange_main_window_recycle_timeout_callback, win);
+    }
+}
+
+
+// Background accounts would all reconnect at the same moment once the network is back. They are
+// hibernated instead and brought back by melange_main_window_reconnect_next(). The visible
+// account and keep-alive accounts are left running.
+static void
+melange_main_window_park_background_views(MelangeMainWindow *win) {
+    GtkWidget *visible = gtk_stack_get_visible_child(GTK_STACK(win->view_stack));
+    GList *children = gtk_container_get_children(GTK_CONTAINER(win->view_stack));
+    guint parked = 0;
+    for (GList *list = children; list; list = list->next) {
+        if (!MELANGE_IS_ACCOUNT_VIEW(list->data) || list->data == visible
+                || g_list_find(win->reconnect_queue, list->data)) continue;
+
+        MelangeAccountView *view = MELANGE_ACCOUNT_VIEW(list->data);
+        if (melange_account_view_is_loaded(view)
+                && !melange_account_view_get_account(view)->keep_alive) {
+            melange_account_view_hibernate(view);
+            win->reconnect_queue = g_list_prepend(win->reconnect_queue, view);
+            ++parked;
+        }
+    }
+    g_list_free(children);
+    g_info("Parked %u background accounts", parked);
+}
+
+
+static gboolean
+melange_main_window_park_timeout_callback(MelangeMainWindow *win) {
+    win->park_timeout = 0;
+    melange_main_window_park_background_views(win);
+    return G_SOURCE_REMOVE;
+}
+
+
+static gint
+melange_main_window_compare_idle_time(gconstpointer a, gconstpointer b) {
+    gint64 idle_a = melange_account_view_get_idle_time(MELANGE_ACCOUNT_VIEW((gpointer) a));
+    gint64 idle_b = melange_account_view_get_idle_time(MELANGE_ACCOUNT_VIEW((gpointer) b));
+    return idle_a < idle_b ? -1 : idle_a > idle_b;
+}
+
+
+static gboolean
+melange_main_window_expire_reconnect(gpointer key, gpointer value, gpointer user_data) {
+    (void) key;
+    return GPOINTER_TO_INT(value) + MELANGE_MAIN_WINDOW_RECONNECT_TIMEOUT
+            <= GPOINTER_TO_INT(user_data);
+}
+
+
+// Starts reconnecting the next queued account if a slot is free. Runs every
+// MELANGE_MAIN_WINDOW_RECONNECT_STAGGER seconds until the queue is empty.
+static gboolean
+melange_main_window_reconnect_next(MelangeMainWindow *win) {
+    if (win->disconnected) {
+        win->reconnect_timeout = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    int now = (int) (g_get_monotonic_time() / G_USEC_PER_SEC);
+    g_hash_table_foreach_remove(win->reconnecting, melange_main_window_expire_reconnect,
+            GINT_TO_POINTER(now));
+    if (g_hash_table_size(win->reconnecting) >= MELANGE_MAIN_WINDOW_RECONNECT_CONCURRENCY) {
+        return G_SOURCE_CONTINUE;
+    }
+
+    while (win->reconnect_queue) {
+        MelangeAccountView *view = win->reconnect_queue->data;
+        win->reconnect_queue = g_list_delete_link(win->reconnect_queue, win->reconnect_queue);
+        if (melange_account_view_reconnect(view)) {
+            MELANGE_TRACE_MARK("account-reconnect", melange_account_view_get_account(view)->id);
+            g_hash_table_insert(win->reconnecting, view, GINT_TO_POINTER(now));
+            return G_SOURCE_CONTINUE;
+        }
+    }
+
+    // Nothing is waiting for the remaining slots
+    g_hash_table_remove_all(win->reconnecting);
+    win->reconnect_timeout = 0;
+    return G_SOURCE_REMOVE;
+}
+
+
+static void
+melange_main_window_start_reconnecting(MelangeMainWindow *win) {
+    GList *children = gtk_container_get_children(GTK_CONTAINER(win->view_stack));
+    for (GList *list = children; list; list = list->next) {
+        if (MELANGE_IS_ACCOUNT_VIEW(list->data)
+                && melange_account_view_needs_reconnect(MELANGE_ACCOUNT_VIEW(list->data))
+                && !g_list_find(win->reconnect_queue, list->data)) {
+            win->reconnect_queue = g_list_prepend(win->reconnect_queue, list->data);
+        }
+    }
+    g_list_free(children);
+
+    win->reconnect_queue = g_list_sort(win->reconnect_queue,
+            melange_main_window_compare_idle_time);
+    g_info("Reconnecting %u accounts", g_list_length(win->reconnect_queue));
+    if (win->reconnect_queue && !win->reconnect_timeout) {
+        win->reconnect_timeout = g_timeout_add_seconds(MELANGE_MAIN_WINDOW_RECONNECT_STAGGER,
+                (GSourceFunc) melange_main_window_reconnect_next, win);
+    }
+}
+
+
+static void
+melange_main_window_update_connectivity(MelangeMainWindow *win) {
+    gboolean disconnected = win->offline || win->asleep;
+    if (disconnected == win->disconnected) return;
+    win->disconnected = disconnected;
+
+    if (disconnected) {
+        g_info("%s, pausing reloads", win->asleep ? "Going to sleep" : "Network unavailable");
+        if (!win->asleep && !win->park_timeout) {
+            win->park_timeout = g_timeout_add_seconds(MELANGE_MAIN_WINDOW_PARK_DELAY,
+                    (GSourceFunc) melange_main_window_park_timeout_callback, win);
+        }
+    } else {
+        if (win->park_timeout) {
+            g_source_remove(win->park_timeout);
+            win->park_timeout = 0;
+        }
+        melange_main_window_start_reconnecting(win);
+    }
+}
+
+
+static void
+melange_main_window_network_changed(GNetworkMonitor *monitor, gboolean network_available,
+        MelangeMainWindow *win) {
+    (void) monitor;
+
+    win->offline = !network_available;
+    melange_main_window_update_connectivity(win);
+}
+
+
+static gboolean
+melange_main_window_resume_timeout_callback(MelangeMainWindow *win) {
+    win->resume_timeout = 0;
+    win->asleep = FALSE;
+    melange_main_window_update_connectivity(win);
+    return G_SOURCE_REMOVE;
+}
+
+
+// logind's PrepareForSleep(TRUE) right before suspending, PrepareForSleep(FALSE) after resuming
+static void
+melange_main_window_prepare_for_sleep(GDBusConnection *connection, const char *sender_name,
+        const char *object_path, const char *interface_name, const char *signal_name,
+        GVariant *parameters, gpointer user_data) {
+    (void) connection;
+    (void) sender_name;
+    (void) object_path;
+    (void) interface_name;
+    (void) signal_name;
+
+    MelangeMainWindow *win = MELANGE_MAIN_WINDOW(user_data);
+    gboolean start;
+    g_variant_get(parameters, "(b)", &start);
+    if (win->resume_timeout) {
+        g_source_remove(win->resume_timeout);
+        win->resume_timeout = 0;
+    }
+
+    if (start) {
+        win->asleep = TRUE;
+        melange_main_window_update_connectivity(win);
+        // Every connection is dead after resuming, there is no point in waiting
+        if (win->park_timeout) {
+            g_source_remove(win->park_timeout);
+            win->park_timeout = 0;
+        }
+        melange_main_window_park_background_views(win);
+    } else if (win->asleep) {
+        win->resume_timeout = g_timeout_add_seconds(MELANGE_MAIN_WINDOW_RESUME_DELAY,
+                (GSourceFunc) melange_main_window_resume_timeout_callback, win);
+    }
+}
+
+
+#if GLIB_CHECK_VERSION(2, 64, 0)
+static void
+melange_main_window_low_memory_warning(GMemoryMonitor *monitor,
+        GMemoryMonitorWarningLevel level, MelangeMainWindow *win) {
+    (void) monitor;
+
+    g_info("Low memory warning (level %d), hibernating background accounts", (int) level);
+    melange_main_window_hibernate_background_views(win, 0);
+}
+#endif
+
+
 static void
 melange_main_window_add_service_button_clicked(GtkButton *button, MelangeMainWindow *win) {
     const MelangeAccount *preset = g_object_get_data(G_OBJECT(button), "preset");
     g_return_if_fail(preset);
 
     // Count ids "whatsapp1", "whatsapp2", ...
-
-    int serial = 1;
-    char *id = g_strdup_printf("%s%d", preset->id, serial);
-
+    char *id = melange_app_new_account_id(win->app, preset->id);
     MelangeAccount *account = melange_account_new_from_preset(id, preset);
-    while (!melange_app_add_account(win->app, account)) {
-        g_free(account->id);
-        account->id = g_strdup_printf("%s%d", preset->id, ++serial);
+    if (!melange_app_add_account(win->app, account)) {
+        g_warning("Account id %s is already taken", id);
+        melange_account_free(account);
+        return;
     }
 
-    melange_main_window_add_account_view(account, win);
+    // The view has been created in response to "account-added"
+    melange_main_window_switch_to_view(g_hash_table_lookup(win->account_views, account));
 }
 
 
@@ -665,6 +1103,7 @@ melange_main_window_create_service_add_button(MelangeMainWindow *win,
     gtk_container_add(GTK_CONTAINER(box), label);
 
     GtkWidget *button = gtk_button_new();
+    g_object_set_data(G_OBJECT(button), "image", image);
     gtk_widget_set_margin_top(box, 10);
     gtk_widget_set_margin_bottom(box, 10);
     gtk_widget_set_margin_start(box, 20);
@@ -681,33 +1120,34 @@ melange_main_window_create_service_add_button(MelangeMainWindow *win,
 }
 
 
-// Callback when the app has finished loading a messenger icon from the web.
+// Callback when the app has finished loading a messenger icon. Icons are decoded in the
+// background, so this can happen any time after the buttons have been created.
 static void
-melange_main_window_icon_available(MelangeApp *app, const char *preset, GdkPixbuf *pixbuf,
+melange_main_window_icon_available(MelangeApp *app, const char *icon_id, GdkPixbuf *pixbuf,
         MelangeMainWindow *win) {
     (void) app;
 
     // Update "add service" view grid
-    for (GList *list = gtk_container_get_children(GTK_CONTAINER(win->service_grid)); list;
-         list = list->next) {
-        GtkContainer *button = GTK_CONTAINER(list->data);
-        const char *button_preset = g_object_get_data(G_OBJECT(button), "preset");
-        if (button_preset && g_str_equal(button_preset, preset)) {
-            GtkContainer *box = GTK_CONTAINER(gtk_container_get_children(button)->data);
-            GtkImage *image = GTK_IMAGE(gtk_container_get_children(box)->data);
-            gtk_image_set_from_pixbuf(image, pixbuf);
+    GList *children = gtk_container_get_children(GTK_CONTAINER(win->service_grid));
+    for (GList *list = children; list; list = list->next) {
+        const MelangeAccount *button_preset = g_object_get_data(G_OBJECT(list->data), "preset");
+        if (button_preset && g_str_equal(button_preset->id, icon_id)) {
+            gtk_image_set_from_pixbuf(g_object_get_data(G_OBJECT(list->data), "image"), pixbuf);
         }
     }
+    g_list_free(children);
 
     // Update sidebar
-    for (GList *list = gtk_container_get_children(GTK_CONTAINER(win->switcher_box)); list;
-         list = list->next) {
-        GtkButton *button = GTK_BUTTON(list->data);
-        MelangeAccount *account = g_object_get_data(G_OBJECT(button), "account");
-        if (account && account->preset && g_str_equal(account->preset->id, preset)) {
-            gtk_image_set_from_pixbuf(GTK_IMAGE(gtk_button_get_image(button)), pixbuf);
+    children = gtk_container_get_children(GTK_CONTAINER(win->switcher_box));
+    for (GList *list = children; list; list = list->next) {
+        MelangeAccount *account = g_object_get_data(G_OBJECT(list->data), "account");
+        char *account_icon_id = account ? melange_app_get_icon_id(account) : NULL;
+        if (account_icon_id && g_str_equal(account_icon_id, icon_id)) {
+            gtk_image_set_from_pixbuf(g_object_get_data(G_OBJECT(list->data), "image"), pixbuf);
         }
+        g_free(account_icon_id);
     }
+    g_list_free(children);
 }
 
 
@@ -769,18 +1209,20 @@ melange_main_window_constructed(GObject *obj) {
 
     // Stylesheet
     GtkCssProvider *css_provider = gtk_css_provider_new();
-    char *css_path = melange_app_get_resource_path(win->app, "ui/mainwindow.css");
-    if (!gtk_css_provider_load_from_path(css_provider, css_path, NULL)) {
+    GFile *css_file = melange_app_get_resource_file(win->app, "ui/mainwindow.css");
+    if (!gtk_css_provider_load_from_file(css_provider, css_file, NULL)) {
         g_warning("Unable to load CSS file");
     }
     gtk_style_context_add_provider_for_screen(gdk_screen_get_default(),
             GTK_STYLE_PROVIDER(css_provider), GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
-    g_free(css_path);
+    g_object_unref(css_file);
 
     // Settings controls
     gboolean dark_theme;
     g_object_get(win->app, "dark-theme", &dark_theme, NULL);
     gtk_switch_set_state(dark_theme_setting, dark_theme);
+    g_signal_connect_object(win->app, "notify::dark-theme",
+            G_CALLBACK(melange_main_window_app_notify_setting_switch), dark_theme_setting, 0);
 
     gboolean auto_hide_sidebar;
     g_object_get(win->app, "auto-hide-sidebar", &auto_hide_sidebar, NULL);
@@ -788,6 +1230,9 @@ melange_main_window_constructed(GObject *obj) {
     gtk_switch_set_state(auto_hide_sidebar_setting, auto_hide_sidebar);
     g_signal_connect(win->app, "notify::auto-hide-sidebar",
             G_CALLBACK(melange_main_window_app_notify_auto_hide_sidebar), win);
+    g_signal_connect_object(win->app, "notify::auto-hide-sidebar",
+            G_CALLBACK(melange_main_window_app_notify_setting_switch), auto_hide_sidebar_setting,
+            0);
 
     const char *client_side_decorations;
     g_object_get(win->app, "client-side-decorations", &client_side_decorations, NULL);
@@ -832,13 +1277,57 @@ melange_main_window_constructed(GObject *obj) {
 
     melange_app_iterate_accounts(win->app,
             (MelangeAccountConstFunc) melange_main_window_add_account_view, win);
+    g_signal_connect_object(win->app, "account-added",
+            G_CALLBACK(melange_main_window_app_account_added), win, 0);
+    g_signal_connect_object(win->app, "account-removed",
+            G_CALLBACK(melange_main_window_app_account_removed), win, 0);
+    g_signal_connect_object(win->app, "accounts-reordered",
+            G_CALLBACK(melange_main_window_app_accounts_reordered), win, 0);
 
     gtk_box_pack_end(GTK_BOX(win->switcher_box),
             melange_main_window_create_utility_switcher_button(win, "add", win->add_view),
             FALSE, FALSE, 0);
 
-    g_signal_connect(win, "notify::is-active", G_CALLBACK(melange_main_window_notify_is_active),
-            win);
+    g_signal_connect(win->view_stack, "notify::visible-child",
+            G_CALLBACK(melange_main_window_view_stack_notify_visible_child), win);
+
+    char *load_accounts;
+    g_object_get(win->app, "load-accounts", &load_accounts, NULL);
+    if (g_str_equal(load_accounts, "background")) {
+        // Stagger web process startup instead of spawning all of them at once
+        win->preload_timeout = g_timeout_add_seconds(3,
+                (GSourceFunc) melange_main_window_preload_next_account_view, win);
+    }
+    g_free(load_accounts);
+
+    melange_main_window_app_notify_hibernate_after(G_OBJECT(win->app), NULL, win);
+    g_signal_connect(win->app, "notify::hibernate-after",
+            G_CALLBACK(melange_main_window_app_notify_hibernate_after), win);
+
+    melange_main_window_app_notify_recycle_threshold(G_OBJECT(win->app), NULL, win);
+    g_signal_connect(win->app, "notify::recycle-threshold",
+            G_CALLBACK(melange_main_window_app_notify_recycle_threshold), win);
+
+    win->network_monitor = g_object_ref(g_network_monitor_get_default());
+    win->offline = !g_network_monitor_get_network_available(win->network_monitor);
+    win->disconnected = win->offline;
+    g_signal_connect(win->network_monitor, "network-changed",
+            G_CALLBACK(melange_main_window_network_changed), win);
+
+    win->system_bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, NULL);
+    if (win->system_bus) {
+        win->sleep_subscription = g_dbus_connection_signal_subscribe(win->system_bus,
+                "org.freedesktop.login1", "org.freedesktop.login1.Manager", "PrepareForSleep",
+                "/org/freedesktop/login1", NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+                melange_main_window_prepare_for_sleep, win, NULL);
+    }
+
+#if GLIB_CHECK_VERSION(2, 64, 0)
+    win->memory_monitor = g_memory_monitor_dup_default();
+    g_signal_connect(win->memory_monitor, "low-memory-warning",
+            G_CALLBACK(melange_main_window_low_memory_warning), win);
+#endif
+
     g_signal_connect(win, "button-press-event", G_CALLBACK(melange_main_window_button_press_event),
             win);
     g_signal_connect(win, "key-press-event", G_CALLBACK(melange_main_window_key_press_event), win);
@@ -854,7 +1343,41 @@ melange_main_window_finalize(GObject *obj) {
     MelangeMainWindow *win = MELANGE_MAIN_WINDOW(obj);
     g_signal_handlers_disconnect_by_data(win->app, win);
 
-    g_regex_unref(win->new_message_regex);
+    if (win->preload_timeout) {
+        g_source_remove(win->preload_timeout);
+    }
+    if (win->hibernate_timeout) {
+        g_source_remove(win->hibernate_timeout);
+    }
+    if (win->recycle_timeout) {
+        g_source_remove(win->recycle_timeout);
+    }
+    if (win->park_timeout) {
+        g_source_remove(win->park_timeout);
+    }
+    if (win->resume_timeout) {
+        g_source_remove(win->resume_timeout);
+    }
+    if (win->reconnect_timeout) {
+        g_source_remove(win->reconnect_timeout);
+    }
+    g_list_free(win->reconnect_queue);
+    g_hash_table_destroy(win->reconnecting);
+    g_signal_handlers_disconnect_by_data(win->network_monitor, win);
+    g_object_unref(win->network_monitor);
+    if (win->system_bus) {
+        g_dbus_connection_signal_unsubscribe(win->system_bus, win->sleep_subscription);
+        g_object_unref(win->system_bus);
+    }
+    melange_main_window_cancel_unread_update(win);
+    g_ptr_array_free(win->dirty_unread_counters, TRUE);
+    g_ptr_array_free(win->unread_counters, TRUE);
+    g_hash_table_destroy(win->account_views);
+
+#if GLIB_CHECK_VERSION(2, 64, 0)
+    g_signal_handlers_disconnect_by_data(win->memory_monitor, win);
+    g_object_unref(win->memory_monitor);
+#endif
 
     G_OBJECT_CLASS(melange_main_window_parent_class)->finalize(obj);
 }
@@ -864,6 +1387,7 @@ static void
 melange_main_window_class_init(MelangeMainWindowClass *cls) {
     GtkWidgetClass *widget_class = GTK_WIDGET_CLASS(cls);
     widget_class->realize = melange_main_window_realize;
+    widget_class->unmap = melange_main_window_unmap;
 
     GObjectClass *object_class = G_OBJECT_CLASS(cls);
     object_class->set_property = melange_main_window_set_property;
@@ -0,0 +1,401 @@
+#include "notifier.h"
+#include "trace.h"
+
+#include <gio/gio.h>
+
+
+#define MELANGE_NOTIFIER_BUS_NAME "org.freedesktop.Notifications"
+#define MELANGE_NOTIFIER_OBJECT_PATH "/org/freedesktop/Notifications"
+#define MELANGE_NOTIFIER_INTERFACE "org.freedesktop.Notifications"
+
+// A stalled notification daemon holds up the queue for at most this many milliseconds per call
+#define MELANGE_NOTIFIER_CALL_TIMEOUT 2000
+
+// Accounts waiting for their notification to be sent. Further updates are dropped, the messages
+// are still counted and show up in the next update of the account.
+#define MELANGE_NOTIFIER_MAX_QUEUED 16
+
+
+typedef struct MelangeNotifierAccount {
+    MelangeNotifier *notifier;
+    char *account_id;
+    char *icon_id;
+
+    // Assigned by the notification daemon and passed back to update the notification in place,
+    // 0 if there is none
+    guint32 notification_id;
+    gboolean visible;
+
+    // Waiting in MelangeNotifier::queue
+    gboolean queued;
+    gint64 dispatch_begin;
+
+    // Latest message
+    char *title;
+    char *body;
+
+    // Messages since the user has last seen the account, and since the last update
+    guint n_unseen;
+    guint n_pending;
+
+    // Source id of the running coalescing window, 0 if the next message can be shown right away
+    guint timeout;
+} MelangeNotifierAccount;
+
+
+struct MelangeNotifier {
+    char *icon_dir;
+
+    // "image-data" hint for notifications without an icon file
+    GVariant *fallback_image;
+
+    // NULL until the session bus has been connected
+    GDBusConnection *connection;
+    gboolean bus_failed;
+    guint closed_subscription;
+
+    // Cancels all outstanding D-Bus calls when the notifier is freed
+    GCancellable *cancellable;
+
+    // MelangeNotifierAccount* waiting to be sent, one Notify call is in flight at a time
+    GQueue queue;
+    gboolean call_running;
+    guint n_dropped;
+
+    // Maps account ids to MelangeNotifierAccount*
+    GHashTable *accounts;
+
+    // Maps icon ids to the icon file name, or "" if there is none. Saves a stat() per message.
+    GHashTable *icon_paths;
+};
+
+
+static void melange_notifier_bus_ready(GObject *source, GAsyncResult *result,
+        gpointer user_data);
+
+
+static void
+melange_notifier_account_free(MelangeNotifierAccount *account) {
+    if (account->timeout) {
+        g_source_remove(account->timeout);
+    }
+    g_free(account->account_id);
+    g_free(account->icon_id);
+    g_free(account->title);
+    g_free(account->body);
+    g_free(account);
+}
+
+
+static GVariant *
+melange_notifier_image_data_from_pixbuf(GdkPixbuf *pixbuf) {
+    GVariant *data = g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
+            gdk_pixbuf_read_pixels(pixbuf), gdk_pixbuf_get_byte_length(pixbuf), 1);
+    return g_variant_ref_sink(g_variant_new("(iiibii@ay)",
+            gdk_pixbuf_get_width(pixbuf),
+            gdk_pixbuf_get_height(pixbuf),
+            gdk_pixbuf_get_rowstride(pixbuf),
+            gdk_pixbuf_get_has_alpha(pixbuf),
+            gdk_pixbuf_get_bits_per_sample(pixbuf),
+            gdk_pixbuf_get_n_channels(pixbuf),
+            data));
+}
+
+
+MelangeNotifier *
+melange_notifier_new(const char *icon_dir, GdkPixbuf *fallback_icon) {
+    MelangeNotifier *notifier = g_malloc0(sizeof *notifier);
+    notifier->icon_dir = g_strdup(icon_dir);
+    notifier->fallback_image = melange_notifier_image_data_from_pixbuf(fallback_icon);
+    notifier->cancellable = g_cancellable_new();
+    g_queue_init(&notifier->queue);
+    notifier->accounts = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+            (GDestroyNotify) melange_notifier_account_free);
+    notifier->icon_paths = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    g_bus_get(G_BUS_TYPE_SESSION, notifier->cancellable, melange_notifier_bus_ready, notifier);
+    return notifier;
+}
+
+
+void
+melange_notifier_free(MelangeNotifier *notifier) {
+    if (notifier) {
+        // Completion callbacks see G_IO_ERROR_CANCELLED and do not touch the notifier
+        g_cancellable_cancel(notifier->cancellable);
+        g_object_unref(notifier->cancellable);
+        if (notifier->connection) {
+            g_dbus_connection_signal_unsubscribe(notifier->connection,
+                    notifier->closed_subscription);
+            g_object_unref(notifier->connection);
+        }
+        g_queue_clear(&notifier->queue);
+        g_hash_table_destroy(notifier->accounts);
+        g_hash_table_destroy(notifier->icon_paths);
+        g_variant_unref(notifier->fallback_image);
+        g_free(notifier->icon_dir);
+        g_free(notifier);
+    }
+}
+
+
+// Returns NULL if there is no icon file
+static const char *
+melange_notifier_get_icon_path(MelangeNotifier *notifier, const char *icon_id) {
+    if (!icon_id) return NULL;
+
+    const char *path = g_hash_table_lookup(notifier->icon_paths, icon_id);
+    if (!path) {
+        char *file_name = g_strdup_printf("%s/%s.ico", notifier->icon_dir, icon_id);
+        if (!g_file_test(file_name, G_FILE_TEST_IS_REGULAR)) {
+            g_free(file_name);
+            file_name = g_strdup("");
+        }
+        g_hash_table_insert(notifier->icon_paths, g_strdup(icon_id), file_name);
+        path = file_name;
+    }
+    return *path ? path : NULL;
+}
+
+
+void
+melange_notifier_forget_icon(MelangeNotifier *notifier, const char *icon_id) {
+    g_hash_table_remove(notifier->icon_paths, icon_id);
+}
+
+
+static void
+melange_notifier_close(MelangeNotifier *notifier, MelangeNotifierAccount *account) {
+    if (notifier->connection && account->notification_id) {
+        // Nothing to do on completion, so nothing waits for a stalled daemon either
+        g_dbus_connection_call(notifier->connection, MELANGE_NOTIFIER_BUS_NAME,
+                MELANGE_NOTIFIER_OBJECT_PATH, MELANGE_NOTIFIER_INTERFACE, "CloseNotification",
+                g_variant_new("(u)", account->notification_id), NULL, G_DBUS_CALL_FLAGS_NONE,
+                MELANGE_NOTIFIER_CALL_TIMEOUT, NULL, NULL, NULL);
+    }
+    account->visible = FALSE;
+}
+
+
+static void melange_notifier_dispatch(MelangeNotifier *notifier);
+
+
+static void
+melange_notifier_notify_finished(GObject *source, GAsyncResult *result, gpointer user_data) {
+    GError *error = NULL;
+    GVariant *reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &error);
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        // The notifier is gone
+        g_error_free(error);
+        return;
+    }
+
+    MelangeNotifierAccount *account = user_data;
+    MelangeNotifier *notifier = account->notifier;
+    notifier->call_running = FALSE;
+
+    if (reply) {
+        g_variant_get(reply, "(u)", &account->notification_id);
+        g_variant_unref(reply);
+        account->visible = TRUE;
+        if (account->n_unseen == 0) {
+            // The account has been selected while the call was running
+            melange_notifier_close(notifier, account);
+        }
+    } else {
+        g_warning("Unable to show notification: %s", error->message);
+        g_error_free(error);
+    }
+    MELANGE_TRACE_END(account->dispatch_begin, "notification-dispatch", account->account_id);
+
+    melange_notifier_dispatch(notifier);
+}
+
+
+static void
+melange_notifier_send(MelangeNotifier *notifier, MelangeNotifierAccount *account) {
+    char *summary;
+    char *body;
+    if (account->n_unseen == 1) {
+        summary = g_strdup(account->title);
+        body = g_strdup(account->body);
+    } else {
+        summary = g_strdup_printf("%u new messages in %s", account->n_unseen, account->account_id);
+        body = *account->body
+                ? g_strdup_printf("%s: %s", account->title, account->body)
+                : g_strdup(account->title);
+    }
+
+    const char *icon_path = melange_notifier_get_icon_path(notifier, account->icon_id);
+    GVariantBuilder hints;
+    g_variant_builder_init(&hints, G_VARIANT_TYPE_VARDICT);
+    if (!icon_path) {
+        // Bundled resources have no file path to pass to the notification daemon
+        g_variant_builder_add(&hints, "{sv}", "image-data", notifier->fallback_image);
+    }
+
+    g_dbus_connection_call(notifier->connection, MELANGE_NOTIFIER_BUS_NAME,
+            MELANGE_NOTIFIER_OBJECT_PATH, MELANGE_NOTIFIER_INTERFACE, "Notify",
+            g_variant_new("(susssasa{sv}i)", g_get_application_name(),
+                    account->notification_id, icon_path ? icon_path : "", summary, body, NULL,
+                    &hints, -1),
+            G_VARIANT_TYPE("(u)"), G_DBUS_CALL_FLAGS_NONE, MELANGE_NOTIFIER_CALL_TIMEOUT,
+            notifier->cancellable, melange_notifier_notify_finished, account);
+    notifier->call_running = TRUE;
+
+    g_free(body);
+    g_free(summary);
+}
+
+
+// Sends the next queued notification unless a call is still running
+static void
+melange_notifier_dispatch(MelangeNotifier *notifier) {
+    if (!notifier->connection || notifier->call_running) return;
+
+    MelangeNotifierAccount *account;
+    while ((account = g_queue_pop_head(&notifier->queue))) {
+        account->queued = FALSE;
+        // Skip accounts that have been selected since
+        if (account->n_unseen > 0) {
+            melange_notifier_send(notifier, account);
+            return;
+        }
+    }
+}
+
+
+static void
+melange_notifier_enqueue(MelangeNotifier *notifier, MelangeNotifierAccount *account) {
+    // The queued call picks up the latest state of the account when it is sent
+    if (!account->queued && !notifier->bus_failed) {
+        if (notifier->queue.length < MELANGE_NOTIFIER_MAX_QUEUED) {
+            account->queued = TRUE;
+            account->dispatch_begin = MELANGE_TRACE_BEGIN();
+            g_queue_push_tail(&notifier->queue, account);
+        } else {
+            ++notifier->n_dropped;
+            MELANGE_TRACE_COUNTER("notifications-dropped", notifier->n_dropped);
+        }
+    }
+    account->n_pending = 0;
+    melange_notifier_dispatch(notifier);
+}
+
+
+static void
+melange_notifier_notification_closed(GDBusConnection *connection, const char *sender,
+        const char *object_path, const char *interface_name, const char *signal_name,
+        GVariant *parameters, gpointer user_data) {
+    (void) connection;
+    (void) sender;
+    (void) object_path;
+    (void) interface_name;
+    (void) signal_name;
+
+    MelangeNotifier *notifier = user_data;
+    guint32 id;
+    guint32 reason;
+    g_variant_get(parameters, "(uu)", &id, &reason);
+
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, notifier->accounts);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        MelangeNotifierAccount *account = value;
+        if (account->notification_id == id) {
+            account->visible = FALSE;
+        }
+    }
+}
+
+
+static void
+melange_notifier_bus_ready(GObject *source, GAsyncResult *result, gpointer user_data) {
+    (void) source;
+
+    GError *error = NULL;
+    GDBusConnection *connection = g_bus_get_finish(result, &error);
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_error_free(error);
+        return;
+    }
+
+    MelangeNotifier *notifier = user_data;
+    if (connection) {
+        notifier->connection = connection;
+        notifier->closed_subscription = g_dbus_connection_signal_subscribe(connection,
+                MELANGE_NOTIFIER_BUS_NAME, MELANGE_NOTIFIER_INTERFACE, "NotificationClosed",
+                MELANGE_NOTIFIER_OBJECT_PATH, NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+                melange_notifier_notification_closed, notifier, NULL);
+        melange_notifier_dispatch(notifier);
+    } else {
+        g_warning("Unable to connect to the session bus, notifications are disabled: %s",
+                error->message);
+        g_error_free(error);
+        notifier->bus_failed = TRUE;
+        while (!g_queue_is_empty(&notifier->queue)) {
+            ((MelangeNotifierAccount *) g_queue_pop_head(&notifier->queue))->queued = FALSE;
+        }
+    }
+}
+
+
+static gboolean
+melange_notifier_window_elapsed(MelangeNotifierAccount *account) {
+    if (account->n_pending > 0) {
+        // Show the summary and start another window for the messages still coming in
+        melange_notifier_enqueue(account->notifier, account);
+        return G_SOURCE_CONTINUE;
+    }
+    account->timeout = 0;
+    return G_SOURCE_REMOVE;
+}
+
+
+void
+melange_notifier_post(MelangeNotifier *notifier, const char *account_id, const char *icon_id,
+        guint window, const char *title, const char *body) {
+    MelangeNotifierAccount *account = g_hash_table_lookup(notifier->accounts, account_id);
+    if (!account) {
+        account = g_malloc0(sizeof *account);
+        account->notifier = notifier;
+        account->account_id = g_strdup(account_id);
+        g_hash_table_insert(notifier->accounts, account->account_id, account);
+    }
+
+    if (g_strcmp0(account->icon_id, icon_id) != 0) {
+        g_free(account->icon_id);
+        account->icon_id = g_strdup(icon_id);
+    }
+    g_free(account->title);
+    account->title = g_strdup(title ? title : "");
+    g_free(account->body);
+    account->body = g_strdup(body ? body : "");
+    ++account->n_unseen;
+    ++account->n_pending;
+    MELANGE_TRACE_COUNTER("notifications-pending", account->n_pending);
+
+    // Within the window, the message is picked up when it has passed
+    if (account->timeout) return;
+
+    melange_notifier_enqueue(notifier, account);
+    if (window > 0) {
+        account->timeout = g_timeout_add(window, (GSourceFunc) melange_notifier_window_elapsed,
+                account);
+    }
+}
+
+
+void
+melange_notifier_clear(MelangeNotifier *notifier, const char *account_id) {
+    MelangeNotifierAccount *account = g_hash_table_lookup(notifier->accounts, account_id);
+    if (!account) return;
+
+    // A queued notification is skipped when its turn comes
+    account->n_unseen = 0;
+    account->n_pending = 0;
+    if (account->visible) {
+        melange_notifier_close(notifier, account);
+    }
+}
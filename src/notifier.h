@@ -0,0 +1,32 @@
+#ifndef MELANGE_NOTIFIER_H
+#define MELANGE_NOTIFIER_H
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+
+// Aggregates message notifications per account. Every account owns a single desktop notification
+// which is updated in place, at most once per coalescing window, e.g. "12 new messages in work".
+// Notifications are sent with asynchronous D-Bus calls, a stalled notification daemon never blocks
+// the main loop.
+typedef struct MelangeNotifier MelangeNotifier;
+
+
+// Notifications use <icon_dir>/<icon id>.ico if it exists, fallback_icon otherwise
+MelangeNotifier *melange_notifier_new(const char *icon_dir, GdkPixbuf *fallback_icon);
+
+void melange_notifier_free(MelangeNotifier *notifier);
+
+// The first message after a quiet period is shown immediately, further messages within window
+// milliseconds are summed up and shown once the window has passed. A window of 0 shows every
+// message.
+void melange_notifier_post(MelangeNotifier *notifier, const char *account_id,
+        const char *icon_id, guint window, const char *title, const char *body);
+
+// The user has seen the account, so counting starts over and a visible notification is closed
+void melange_notifier_clear(MelangeNotifier *notifier, const char *account_id);
+
+// Icon files are looked up once, call this when one has been (re-)downloaded
+void melange_notifier_forget_icon(MelangeNotifier *notifier, const char *icon_id);
+
+
+#endif // MELANGE_NOTIFIER_H
@@ -0,0 +1,534 @@
+#include "resourcelimits.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+
+#define MELANGE_RESOURCE_LIMITS_CGROUP_FS "/sys/fs/cgroup"
+
+#define MELANGE_RESOURCE_LIMITS_UNIT_CHARS \
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_"
+
+// Applied to web processes while in the background, relative to melange's own nice value and the
+// default cpu.weight of 100
+#define MELANGE_RESOURCE_LIMITS_BACKGROUND_NICE 10
+#define MELANGE_RESOURCE_LIMITS_BACKGROUND_WEIGHT 20
+
+// From linux/ioprio.h, glibc has no wrapper for ioprio_set()
+#define MELANGE_IOPRIO_WHO_PROCESS 1
+#define MELANGE_IOPRIO_CLASS_NONE 0
+#define MELANGE_IOPRIO_CLASS_IDLE 3
+#define MELANGE_IOPRIO_CLASS_SHIFT 13
+
+
+typedef enum MelangeResourceLimitsCgroupState {
+    MELANGE_RESOURCE_LIMITS_CGROUP_UNTRIED,
+    MELANGE_RESOURCE_LIMITS_CGROUP_READY,
+    MELANGE_RESOURCE_LIMITS_CGROUP_FAILED,
+} MelangeResourceLimitsCgroupState;
+
+
+struct MelangeResourceLimits {
+    // The cgroup melange was started in. Melange moves itself to the "main" child, so that
+    // controllers can be enabled for the account children next to it.
+    char *cgroup_root;
+    MelangeResourceLimitsCgroupState cgroup_state;
+
+    // Maps GINT_TO_POINTER(pid) to the MelangeResourceLimitsProcess* of every web process that has
+    // been reported, including unconfined ones
+    GHashTable *processes;
+
+    // Web processes are deprioritized while the window is hidden. An unprivileged process can
+    // only lower its nice value back if RLIMIT_NICE allows, otherwise confined processes get a
+    // lower cpu.weight instead and unconfined ones keep their CPU priority.
+    gboolean background;
+    int base_nice;
+    gboolean nice_reversible;
+
+    // D-Bus calls still in flight
+    GCancellable *cancellable;
+};
+
+
+typedef struct MelangeResourceLimitsProcess {
+    // Account cgroup or systemd scope the process has been moved to, both NULL if unconfined
+    char *cgroup;
+    char *unit;
+    // Whether the nice value has been raised, the scope may only show up afterwards
+    gboolean reniced;
+} MelangeResourceLimitsProcess;
+
+
+typedef struct MelangeResourceLimitsScopeRequest {
+    MelangeResourceLimits *limits;
+    GPid pid;
+    char *unit;
+} MelangeResourceLimitsScopeRequest;
+
+
+// Parsed account limits, G_MAXUINT64 stands for "max"
+typedef struct MelangeResourceLimitValues {
+    guint64 cpu_quota;
+    guint64 cpu_period;
+    guint64 memory_high;
+    guint64 memory_max;
+} MelangeResourceLimitValues;
+
+
+// "max" or bytes with an optional K, M, G or T suffix, like memory.max
+static gboolean
+melange_resource_limits_parse_memory(const char *str, guint64 *out) {
+    *out = G_MAXUINT64;
+    if (!str || g_str_equal(str, "max")) return TRUE;
+
+    char *end;
+    guint64 value = g_ascii_strtoull(str, &end, 10);
+    if (end == str) return FALSE;
+
+    guint shift;
+    switch (g_ascii_toupper(*end)) {
+        case '\0': shift = 0; break;
+        case 'K': shift = 10; break;
+        case 'M': shift = 20; break;
+        case 'G': shift = 30; break;
+        case 'T': shift = 40; break;
+        default: return FALSE;
+    }
+    if ((*end && end[1]) || value > G_MAXUINT64 >> shift) return FALSE;
+
+    *out = value << shift;
+    return TRUE;
+}
+
+
+// "$MAX [$PERIOD]" in microseconds like cpu.max, where $MAX may be "max"
+static gboolean
+melange_resource_limits_parse_cpu(const char *str, guint64 *quota, guint64 *period) {
+    *quota = G_MAXUINT64;
+    *period = 100000;
+    if (!str) return TRUE;
+
+    char *end;
+    if (g_str_has_prefix(str, "max")) {
+        end = (char *) str + 3;
+    } else {
+        *quota = g_ascii_strtoull(str, &end, 10);
+        if (end == str || *quota == 0) return FALSE;
+    }
+    if (*end == ' ') {
+        const char *period_str = end + 1;
+        *period = g_ascii_strtoull(period_str, &end, 10);
+        if (end == period_str || *period < 1000 || *period > 1000000) return FALSE;
+    }
+    return *end == '\0';
+}
+
+
+static gboolean
+melange_resource_limits_parse(const MelangeAccount *account, MelangeResourceLimitValues *values) {
+    return melange_resource_limits_parse_cpu(account->cpu_max, &values->cpu_quota,
+                    &values->cpu_period)
+            && melange_resource_limits_parse_memory(account->memory_high, &values->memory_high)
+            && melange_resource_limits_parse_memory(account->memory_max, &values->memory_max);
+}
+
+
+static char *
+melange_resource_limits_format_memory(guint64 bytes) {
+    return bytes == G_MAXUINT64 ? g_strdup("max") : g_strdup_printf("%" G_GUINT64_FORMAT, bytes);
+}
+
+
+// Like sd_booted()
+static MelangeResourceLimitMode
+melange_resource_limits_resolve_mode(MelangeResourceLimitMode mode) {
+    if (mode != MELANGE_RESOURCE_LIMITS_AUTO) return mode;
+    return g_file_test("/run/systemd/system", G_FILE_TEST_IS_DIR)
+            ? MELANGE_RESOURCE_LIMITS_SYSTEMD : MELANGE_RESOURCE_LIMITS_CGROUP;
+}
+
+
+// g_file_set_contents() replaces files, cgroupfs only supports writing them in place
+static gboolean
+melange_resource_limits_write(const char *group, const char *file_name, const char *value) {
+    char *path = g_build_filename(group, file_name, NULL);
+    FILE *file = fopen(path, "w");
+    gboolean ok = file != NULL;
+    if (file) {
+        // Rejected values only show up once the buffer is flushed
+        ok = fputs(value, file) >= 0;
+        ok = fclose(file) == 0 && ok;
+    }
+    if (!ok) {
+        g_warning("Unable to write \"%s\" to %s: %s", value, path, g_strerror(errno));
+    }
+    g_free(path);
+    return ok;
+}
+
+
+static gboolean
+melange_resource_limits_make_group(const char *group) {
+    if (g_mkdir(group, 0755) != 0 && errno != EEXIST) {
+        g_warning("Unable to create cgroup %s: %s", group, g_strerror(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+static gboolean
+melange_resource_limits_setup_cgroup(MelangeResourceLimits *limits) {
+    if (limits->cgroup_state != MELANGE_RESOURCE_LIMITS_CGROUP_UNTRIED) {
+        return limits->cgroup_state == MELANGE_RESOURCE_LIMITS_CGROUP_READY;
+    }
+    limits->cgroup_state = MELANGE_RESOURCE_LIMITS_CGROUP_FAILED;
+
+    // On the unified hierarchy, the only line is "0::<path>"
+    char *contents;
+    if (g_file_get_contents("/proc/self/cgroup", &contents, NULL, NULL)) {
+        char **lines = g_strsplit(contents, "\n", -1);
+        for (char **line = lines; *line && !limits->cgroup_root; ++line) {
+            if (g_str_has_prefix(*line, "0::")) {
+                limits->cgroup_root = g_build_filename(MELANGE_RESOURCE_LIMITS_CGROUP_FS,
+                        *line + 3, NULL);
+            }
+        }
+        g_strfreev(lines);
+        g_free(contents);
+    }
+    if (!limits->cgroup_root) {
+        g_warning("Not running on cgroup v2, web processes will not be limited");
+        return FALSE;
+    }
+
+    // Controllers can only be enabled for children once the cgroup itself has no processes left
+    char *main_group = g_build_filename(limits->cgroup_root, "main", NULL);
+    char *pid = g_strdup_printf("%d", (int) getpid());
+    gboolean ok = melange_resource_limits_make_group(main_group)
+            && melange_resource_limits_write(main_group, "cgroup.procs", pid)
+            && melange_resource_limits_write(limits->cgroup_root, "cgroup.subtree_control",
+                    "+cpu +memory");
+    g_free(pid);
+    g_free(main_group);
+    if (!ok) {
+        g_warning("Unable to set up cgroup %s for resource limits, it may not be delegated",
+                limits->cgroup_root);
+        return FALSE;
+    }
+
+    limits->cgroup_state = MELANGE_RESOURCE_LIMITS_CGROUP_READY;
+    return TRUE;
+}
+
+
+static void
+melange_resource_limits_process_free(MelangeResourceLimitsProcess *process) {
+    g_free(process->cgroup);
+    g_free(process->unit);
+    g_free(process);
+}
+
+
+// Guards against touching an unrelated process that has inherited the pid of an exited one
+static gboolean
+melange_resource_limits_is_web_process(GPid pid) {
+    char *file_name = g_strdup_printf("/proc/%d/comm", (int) pid);
+    char *comm = NULL;
+    // Truncated to 15 characters
+    gboolean is_web_process = g_file_get_contents(file_name, &comm, NULL, NULL)
+            && g_str_has_prefix(comm, "WebKitWebProces");
+    g_free(comm);
+    g_free(file_name);
+    return is_web_process;
+}
+
+
+static void
+melange_resource_limits_unit_properties_set(GObject *source_object, GAsyncResult *result,
+        gpointer user_data) {
+    (void) user_data;
+
+    GError *error = NULL;
+    GVariant *reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object), result,
+            &error);
+    if (reply) {
+        g_variant_unref(reply);
+    } else {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_warning("Unable to change CPU weight of web process scope: %s", error->message);
+        }
+        g_error_free(error);
+    }
+}
+
+
+static void
+melange_resource_limits_set_unit_weight(MelangeResourceLimits *limits, const char *unit,
+        guint64 weight) {
+    GDBusConnection *bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+    if (!bus) return;
+
+    GVariantBuilder properties;
+    g_variant_builder_init(&properties, G_VARIANT_TYPE("a(sv)"));
+    g_variant_builder_add(&properties, "(sv)", "CPUWeight", g_variant_new_uint64(weight));
+    g_dbus_connection_call(bus, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+            "org.freedesktop.systemd1.Manager", "SetUnitProperties",
+            g_variant_new("(sba(sv))", unit, TRUE, &properties), NULL, G_DBUS_CALL_FLAGS_NONE, -1,
+            limits->cancellable, melange_resource_limits_unit_properties_set, NULL);
+    g_object_unref(bus);
+}
+
+
+// I/O priority and nice value are per thread, every thread of the process is changed
+static void
+melange_resource_limits_prioritize(MelangeResourceLimits *limits, GPid pid,
+        MelangeResourceLimitsProcess *process, gboolean background) {
+    int ioprio = background ? MELANGE_IOPRIO_CLASS_IDLE << MELANGE_IOPRIO_CLASS_SHIFT
+            : MELANGE_IOPRIO_CLASS_NONE << MELANGE_IOPRIO_CLASS_SHIFT;
+    int nice = background ? limits->base_nice + MELANGE_RESOURCE_LIMITS_BACKGROUND_NICE
+            : limits->base_nice;
+    gboolean renice = background
+            ? !process->cgroup && !process->unit && limits->nice_reversible : process->reniced;
+    if (renice) {
+        process->reniced = background;
+    }
+
+    char *task_dir = g_strdup_printf("/proc/%d/task", (int) pid);
+    GDir *dir = g_dir_open(task_dir, 0, NULL);
+    if (dir) {
+        const char *name;
+        while ((name = g_dir_read_name(dir))) {
+            int tid = atoi(name);
+            syscall(SYS_ioprio_set, MELANGE_IOPRIO_WHO_PROCESS, tid, ioprio);
+            if (renice) {
+                setpriority(PRIO_PROCESS, (id_t) tid, nice);
+            }
+        }
+        g_dir_close(dir);
+    }
+    g_free(task_dir);
+
+    guint64 weight = background ? MELANGE_RESOURCE_LIMITS_BACKGROUND_WEIGHT : 100;
+    if (process->cgroup) {
+        char *weight_str = g_strdup_printf("%" G_GUINT64_FORMAT, weight);
+        melange_resource_limits_write(process->cgroup, "cpu.weight", weight_str);
+        g_free(weight_str);
+    } else if (process->unit) {
+        melange_resource_limits_set_unit_weight(limits, process->unit, weight);
+    }
+}
+
+
+static void
+melange_resource_limits_apply_cgroup(MelangeResourceLimits *limits,
+        const MelangeAccount *account, const MelangeResourceLimitValues *values, GPid pid,
+        MelangeResourceLimitsProcess *process) {
+    if (!melange_resource_limits_setup_cgroup(limits)) return;
+
+    char *name = g_strcanon(g_strconcat("account-", account->id, NULL),
+            MELANGE_RESOURCE_LIMITS_UNIT_CHARS, '_');
+    char *group = g_build_filename(limits->cgroup_root, name, NULL);
+    char *cpu_max = values->cpu_quota == G_MAXUINT64
+            ? g_strdup_printf("max %" G_GUINT64_FORMAT, values->cpu_period)
+            : g_strdup_printf("%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT, values->cpu_quota,
+                    values->cpu_period);
+    char *memory_high = melange_resource_limits_format_memory(values->memory_high);
+    char *memory_max = melange_resource_limits_format_memory(values->memory_max);
+    char *pid_str = g_strdup_printf("%d", (int) pid);
+
+    if (melange_resource_limits_make_group(group)
+            && melange_resource_limits_write(group, "cpu.max", cpu_max)
+            && melange_resource_limits_write(group, "memory.high", memory_high)
+            && melange_resource_limits_write(group, "memory.max", memory_max)
+            && melange_resource_limits_write(group, "cgroup.procs", pid_str)) {
+        g_info("Moved web process %d of account %s to %s", (int) pid, account->id, group);
+        process->cgroup = g_strdup(group);
+    }
+
+    g_free(pid_str);
+    g_free(memory_max);
+    g_free(memory_high);
+    g_free(cpu_max);
+    g_free(group);
+    g_free(name);
+}
+
+
+static void
+melange_resource_limits_scope_started(GObject *source_object, GAsyncResult *result,
+        gpointer user_data) {
+    MelangeResourceLimitsScopeRequest *request = user_data;
+    GError *error = NULL;
+    GVariant *reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object), result,
+            &error);
+    if (reply) {
+        g_info("Started %s", request->unit);
+        g_variant_unref(reply);
+
+        MelangeResourceLimits *limits = request->limits;
+        MelangeResourceLimitsProcess *process = g_hash_table_lookup(limits->processes,
+                GINT_TO_POINTER(request->pid));
+        if (process) {
+            process->unit = g_strdup(request->unit);
+            if (limits->background) {
+                melange_resource_limits_prioritize(limits, request->pid, process, TRUE);
+            }
+        }
+    } else {
+        // Also when cancelled, limits are gone by then
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_warning("Unable to start systemd scope %s: %s", request->unit, error->message);
+        }
+        g_error_free(error);
+    }
+    g_free(request->unit);
+    g_free(request);
+}
+
+
+static void
+melange_resource_limits_apply_systemd(MelangeResourceLimits *limits,
+        const MelangeAccount *account, const MelangeResourceLimitValues *values, GPid pid) {
+    GError *error = NULL;
+    // The shared connection GApplication has registered with
+    GDBusConnection *bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+    if (!bus) {
+        g_warning("Unable to connect to the session bus: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    GVariantBuilder properties;
+    g_variant_builder_init(&properties, G_VARIANT_TYPE("a(sv)"));
+    g_variant_builder_add(&properties, "(sv)", "Description",
+            g_variant_new_take_string(g_strdup_printf("Melange account %s", account->id)));
+    guint32 pids[] = { (guint32) pid };
+    g_variant_builder_add(&properties, "(sv)", "PIDs",
+            g_variant_new_fixed_array(G_VARIANT_TYPE_UINT32, pids, 1, sizeof pids[0]));
+    g_variant_builder_add(&properties, "(sv)", "CollectMode",
+            g_variant_new_string("inactive-or-failed"));
+    if (values->cpu_quota != G_MAXUINT64) {
+        g_variant_builder_add(&properties, "(sv)", "CPUQuotaPerSecUSec",
+                g_variant_new_uint64(values->cpu_quota * G_USEC_PER_SEC / values->cpu_period));
+    }
+    if (values->memory_high != G_MAXUINT64) {
+        g_variant_builder_add(&properties, "(sv)", "MemoryHigh",
+                g_variant_new_uint64(values->memory_high));
+    }
+    if (values->memory_max != G_MAXUINT64) {
+        g_variant_builder_add(&properties, "(sv)", "MemoryMax",
+                g_variant_new_uint64(values->memory_max));
+    }
+
+    char *id = g_strcanon(g_strdup(account->id), MELANGE_RESOURCE_LIMITS_UNIT_CHARS, '_');
+    MelangeResourceLimitsScopeRequest *request = g_new(MelangeResourceLimitsScopeRequest, 1);
+    request->limits = limits;
+    request->pid = pid;
+    request->unit = g_strdup_printf("melange-%s-%d.scope", id, (int) pid);
+    g_free(id);
+
+    g_dbus_connection_call(bus, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+            "org.freedesktop.systemd1.Manager", "StartTransientUnit",
+            g_variant_new("(ssa(sv)a(sa(sv)))", request->unit, "fail", &properties, NULL),
+            G_VARIANT_TYPE("(o)"), G_DBUS_CALL_FLAGS_NONE, -1, limits->cancellable,
+            melange_resource_limits_scope_started, request);
+    g_object_unref(bus);
+}
+
+
+MelangeResourceLimits *
+melange_resource_limits_new(void) {
+    MelangeResourceLimits template = {
+            .cgroup_root = NULL,
+            .cgroup_state = MELANGE_RESOURCE_LIMITS_CGROUP_UNTRIED,
+            .processes = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                    (GDestroyNotify) melange_resource_limits_process_free),
+            .background = FALSE,
+            .base_nice = getpriority(PRIO_PROCESS, 0),
+            .nice_reversible = FALSE,
+            .cancellable = g_cancellable_new(),
+    };
+
+    // Lowering the nice value to n needs RLIMIT_NICE >= 20 - n
+    struct rlimit nice_limit;
+    if (getrlimit(RLIMIT_NICE, &nice_limit) == 0) {
+        template.nice_reversible = nice_limit.rlim_cur == RLIM_INFINITY
+                || (rlim_t) (20 - template.base_nice) <= nice_limit.rlim_cur;
+    }
+    return g_memdup(&template, sizeof template);
+}
+
+
+void
+melange_resource_limits_free(MelangeResourceLimits *limits) {
+    if (limits) {
+        g_cancellable_cancel(limits->cancellable);
+        g_object_unref(limits->cancellable);
+        g_hash_table_destroy(limits->processes);
+        g_free(limits->cgroup_root);
+        g_free(limits);
+    }
+}
+
+
+void
+melange_resource_limits_prepare(MelangeResourceLimits *limits, MelangeResourceLimitMode mode) {
+    if (melange_resource_limits_resolve_mode(mode) == MELANGE_RESOURCE_LIMITS_CGROUP) {
+        melange_resource_limits_setup_cgroup(limits);
+    }
+}
+
+
+void
+melange_resource_limits_apply(MelangeResourceLimits *limits, MelangeResourceLimitMode mode,
+        const MelangeAccount *account, GPid pid) {
+    MelangeResourceLimitsProcess *process = g_new0(MelangeResourceLimitsProcess, 1);
+    g_hash_table_replace(limits->processes, GINT_TO_POINTER(pid), process);
+
+    MelangeResourceLimitValues values;
+    if (mode == MELANGE_RESOURCE_LIMITS_OFF
+            || (!account->cpu_max && !account->memory_high && !account->memory_max)) {
+        // Unconfined
+    } else if (!melange_resource_limits_parse(account, &values)) {
+        g_warning("Invalid cpu-max, memory-high or memory-max of account %s, not limiting it",
+                account->id);
+    } else if (melange_resource_limits_resolve_mode(mode) == MELANGE_RESOURCE_LIMITS_CGROUP) {
+        melange_resource_limits_apply_cgroup(limits, account, &values, pid, process);
+    } else {
+        melange_resource_limits_apply_systemd(limits, account, &values, pid);
+    }
+
+    // Started while hidden, e.g. after a crash. Scopes are deprioritized once they exist.
+    if (limits->background) {
+        melange_resource_limits_prioritize(limits, pid, process, TRUE);
+    }
+}
+
+
+void
+melange_resource_limits_set_background(MelangeResourceLimits *limits, gboolean background) {
+    if (background == limits->background) return;
+    limits->background = background;
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, limits->processes);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        GPid pid = GPOINTER_TO_INT(key);
+        if (melange_resource_limits_is_web_process(pid)) {
+            melange_resource_limits_prioritize(limits, pid, value, background);
+        } else {
+            // Exited, e.g. when its account was hibernated
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+    g_info("%s %u web processes", background ? "Deprioritized" : "Restored priority of",
+            g_hash_table_size(limits->processes));
+}
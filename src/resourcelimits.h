@@ -0,0 +1,33 @@
+#ifndef MELANGE_RESOURCELIMITS_H
+#define MELANGE_RESOURCELIMITS_H
+
+#include "config.h"
+
+
+// Confines the web process of each account with cpu-max, memory-high or memory-max to its own
+// cgroup v2 subtree or systemd user scope, so that a single runaway messenger cannot push the
+// machine into swap. Failures are logged once and leave the process unconfined.
+//
+// Also lowers the CPU and I/O priority of all web processes while the window is hidden.
+typedef struct MelangeResourceLimits MelangeResourceLimits;
+
+
+MelangeResourceLimits *melange_resource_limits_new(void);
+
+void melange_resource_limits_free(MelangeResourceLimits *limits);
+
+// In cgroup mode, moves melange out of its cgroup so that child cgroups can be limited. Must be
+// called before any web process is started, they would be left behind.
+void melange_resource_limits_prepare(MelangeResourceLimits *limits, MelangeResourceLimitMode mode);
+
+// Registers pid, a web process rendering account, and moves it under the account's limits unless
+// mode is off or the account sets no limits. The systemd scope is created asynchronously.
+void melange_resource_limits_apply(MelangeResourceLimits *limits, MelangeResourceLimitMode mode,
+        const MelangeAccount *account, GPid pid);
+
+// Idle I/O priority and a higher nice value or lower cpu.weight for all registered web processes
+// while background is set, restores the defaults when it is cleared
+void melange_resource_limits_set_background(MelangeResourceLimits *limits, gboolean background);
+
+
+#endif // MELANGE_RESOURCELIMITS_H
@@ -0,0 +1,257 @@
+#include "trace.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#ifdef MELANGE_HAVE_SYSPROF
+#include <sysprof-capture.h>
+#endif
+
+
+typedef enum {
+    MELANGE_TRACE_OUTPUT_CHROME,
+    MELANGE_TRACE_OUTPUT_SYSPROF,
+} MelangeTraceOutput;
+
+
+gboolean melange_trace_active = FALSE;
+
+static MelangeTraceOutput trace_output;
+
+// Trace points are hit from icon worker threads as well
+static GMutex trace_mutex;
+
+// Chrome output: comma-separated JSON events collected until melange_trace_finish()
+static GString *trace_events;
+static char *trace_file_name;
+static gint64 trace_epoch;
+
+// Small sequential thread ids are easier to read in trace viewers than pointers
+static GPrivate trace_thread_id;
+static gint trace_n_threads;
+
+#ifdef MELANGE_HAVE_SYSPROF
+// Maps counter names to sysprof counter ids
+static GHashTable *trace_counter_ids;
+#endif
+
+
+gboolean
+melange_trace_enable(const char *spec) {
+    if (melange_trace_active) return TRUE;
+
+    if (g_str_equal(spec, "chrome") || g_str_has_prefix(spec, "chrome:")) {
+        const char *file_name = strchr(spec, ':');
+        trace_file_name = file_name && file_name[1] ? g_strdup(file_name + 1)
+                : g_strdup_printf("melange-%d.trace.json", (int) getpid());
+        trace_events = g_string_new(NULL);
+        trace_epoch = g_get_monotonic_time();
+        trace_output = MELANGE_TRACE_OUTPUT_CHROME;
+    } else if (g_str_equal(spec, "sysprof")) {
+#ifdef MELANGE_HAVE_SYSPROF
+        sysprof_collector_init();
+        trace_counter_ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        trace_output = MELANGE_TRACE_OUTPUT_SYSPROF;
+#else
+        g_warning("Melange was built without sysprof support");
+        return FALSE;
+#endif
+    } else {
+        g_warning("Invalid trace output \"%s\", expected chrome[:FILE] or sysprof", spec);
+        return FALSE;
+    }
+
+    melange_trace_active = TRUE;
+    return TRUE;
+}
+
+
+void
+melange_trace_finish(void) {
+    if (!melange_trace_active) return;
+
+    g_mutex_lock(&trace_mutex);
+    melange_trace_active = FALSE;
+
+    if (trace_output == MELANGE_TRACE_OUTPUT_CHROME) {
+        GString *json = g_string_new("{\"traceEvents\":[\n");
+        g_string_append_len(json, trace_events->str, (gssize) trace_events->len);
+        // Timestamps are relative to the epoch, which is g_get_monotonic_time() when tracing was
+        // enabled. Tools can correlate it with their own monotonic clock.
+        g_string_append_printf(json, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":"
+                "{\"monotonic-epoch\":\"%" G_GINT64_FORMAT "\"}}\n", trace_epoch);
+
+        GError *error = NULL;
+        if (g_file_set_contents(trace_file_name, json->str, (gssize) json->len, &error)) {
+            g_message("Trace written to %s", trace_file_name);
+        } else {
+            g_warning("Unable to write trace %s: %s", trace_file_name, error->message);
+            g_error_free(error);
+        }
+
+        g_string_free(json, TRUE);
+        g_string_free(trace_events, TRUE);
+        trace_events = NULL;
+        g_free(trace_file_name);
+        trace_file_name = NULL;
+    }
+#ifdef MELANGE_HAVE_SYSPROF
+    else {
+        g_hash_table_destroy(trace_counter_ids);
+        trace_counter_ids = NULL;
+    }
+#endif
+
+    g_mutex_unlock(&trace_mutex);
+}
+
+
+static int
+melange_trace_get_thread_id(void) {
+    int id = GPOINTER_TO_INT(g_private_get(&trace_thread_id));
+    if (!id) {
+        id = g_atomic_int_add(&trace_n_threads, 1) + 1;
+        g_private_set(&trace_thread_id, GINT_TO_POINTER(id));
+    }
+    return id;
+}
+
+
+static void
+melange_trace_append_json_string(GString *out, const char *str) {
+    g_string_append_c(out, '"');
+    for (const char *c = str; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            g_string_append_c(out, '\\');
+            g_string_append_c(out, *c);
+        } else if ((unsigned char) *c < 0x20) {
+            g_string_append_printf(out, "\\u%04x", (unsigned) (unsigned char) *c);
+        } else {
+            g_string_append_c(out, *c);
+        }
+    }
+    g_string_append_c(out, '"');
+}
+
+
+// Appends the fields common to all events, the caller adds the rest and the closing brace.
+// Must be called with trace_mutex held.
+static void
+melange_trace_begin_chrome_event(const char *name, char phase, gint64 timestamp) {
+    if (trace_events->len > 0) {
+        g_string_append(trace_events, ",\n");
+    }
+    g_string_append(trace_events, "{\"name\":");
+    melange_trace_append_json_string(trace_events, name);
+    g_string_append_printf(trace_events,
+            ",\"cat\":\"melange\",\"ph\":\"%c\",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%d",
+            phase, timestamp - trace_epoch, (int) getpid(), melange_trace_get_thread_id());
+}
+
+
+static void
+melange_trace_append_chrome_detail(const char *detail) {
+    if (detail) {
+        g_string_append(trace_events, ",\"args\":{\"detail\":");
+        melange_trace_append_json_string(trace_events, detail);
+        g_string_append_c(trace_events, '}');
+    }
+}
+
+
+void
+melange_trace_span(gint64 begin, const char *name, const char *detail) {
+    gint64 end = g_get_monotonic_time();
+
+    g_mutex_lock(&trace_mutex);
+    if (!melange_trace_active) goto unlock;
+
+    if (trace_output == MELANGE_TRACE_OUTPUT_CHROME) {
+        melange_trace_begin_chrome_event(name, 'X', begin);
+        g_string_append_printf(trace_events, ",\"dur\":%" G_GINT64_FORMAT, end - begin);
+        melange_trace_append_chrome_detail(detail);
+        g_string_append_c(trace_events, '}');
+    }
+#ifdef MELANGE_HAVE_SYSPROF
+    else {
+        // Monotonic clock in nanoseconds, just like SYSPROF_CAPTURE_CURRENT_TIME
+        sysprof_collector_mark(begin * 1000, (end - begin) * 1000, "melange", name,
+                detail ? detail : "");
+    }
+#endif
+
+    unlock:
+    g_mutex_unlock(&trace_mutex);
+}
+
+
+void
+melange_trace_mark(const char *name, const char *detail) {
+    gint64 now = g_get_monotonic_time();
+
+    g_mutex_lock(&trace_mutex);
+    if (!melange_trace_active) goto unlock;
+
+    if (trace_output == MELANGE_TRACE_OUTPUT_CHROME) {
+        melange_trace_begin_chrome_event(name, 'i', now);
+        g_string_append(trace_events, ",\"s\":\"t\"");
+        melange_trace_append_chrome_detail(detail);
+        g_string_append_c(trace_events, '}');
+    }
+#ifdef MELANGE_HAVE_SYSPROF
+    else {
+        sysprof_collector_mark(now * 1000, 0, "melange", name, detail ? detail : "");
+    }
+#endif
+
+    unlock:
+    g_mutex_unlock(&trace_mutex);
+}
+
+
+#ifdef MELANGE_HAVE_SYSPROF
+// Counters must be announced to sysprof before their first value. Called with trace_mutex held.
+static guint
+melange_trace_get_sysprof_counter_id(const char *name) {
+    gpointer id;
+    if (g_hash_table_lookup_extended(trace_counter_ids, name, NULL, &id)) {
+        return GPOINTER_TO_UINT(id);
+    }
+
+    SysprofCaptureCounter counter = { 0 };
+    counter.id = sysprof_collector_request_counters(1);
+    counter.type = SYSPROF_CAPTURE_COUNTER_INT64;
+    g_strlcpy(counter.category, "Melange", sizeof counter.category);
+    g_strlcpy(counter.name, name, sizeof counter.name);
+    g_strlcpy(counter.description, name, sizeof counter.description);
+    sysprof_collector_define_counters(&counter, 1);
+
+    g_hash_table_insert(trace_counter_ids, g_strdup(name), GUINT_TO_POINTER(counter.id));
+    return counter.id;
+}
+#endif
+
+
+void
+melange_trace_counter(const char *name, gint64 value) {
+    gint64 now = g_get_monotonic_time();
+
+    g_mutex_lock(&trace_mutex);
+    if (!melange_trace_active) goto unlock;
+
+    if (trace_output == MELANGE_TRACE_OUTPUT_CHROME) {
+        melange_trace_begin_chrome_event(name, 'C', now);
+        g_string_append(trace_events, ",\"args\":{\"value\":");
+        g_string_append_printf(trace_events, "%" G_GINT64_FORMAT "}}", value);
+    }
+#ifdef MELANGE_HAVE_SYSPROF
+    else {
+        guint id = melange_trace_get_sysprof_counter_id(name);
+        SysprofCaptureCounterValue counter_value = { .v64 = value };
+        sysprof_collector_set_counters(&id, &counter_value, 1);
+    }
+#endif
+
+    unlock:
+    g_mutex_unlock(&trace_mutex);
+}
@@ -0,0 +1,47 @@
+#ifndef MELANGE_TRACE_H
+#define MELANGE_TRACE_H
+
+#include <glib.h>
+
+
+// Lightweight tracing of startup and hot paths. Disabled unless enabled through $MELANGE_TRACE or
+// --trace, in which case spans, marks and counters are either collected into a Chrome trace-event
+// JSON file (chrome://tracing, Perfetto) or forwarded to a running sysprof as marks.
+//
+// While disabled, every trace point costs a single branch on melange_trace_active.
+
+extern gboolean melange_trace_active;
+
+
+// Accepts "chrome", "chrome:FILE" or "sysprof". Returns FALSE if the spec is invalid.
+gboolean melange_trace_enable(const char *spec);
+
+// Writes the Chrome trace file, if any. Trace points are ignored afterwards.
+void melange_trace_finish(void);
+
+void melange_trace_span(gint64 begin, const char *name, const char *detail);
+
+void melange_trace_mark(const char *name, const char *detail);
+
+void melange_trace_counter(const char *name, gint64 value);
+
+
+// Start timestamp to pass to MELANGE_TRACE_END, 0 while tracing is disabled
+#define MELANGE_TRACE_BEGIN() (G_UNLIKELY(melange_trace_active) ? g_get_monotonic_time() : 0)
+
+// Records a span from begin until now. detail can be NULL.
+#define MELANGE_TRACE_END(begin, name, detail) G_STMT_START { \
+        if (G_UNLIKELY(melange_trace_active)) melange_trace_span((begin), (name), (detail)); \
+    } G_STMT_END
+
+// Records an instant event
+#define MELANGE_TRACE_MARK(name, detail) G_STMT_START { \
+        if (G_UNLIKELY(melange_trace_active)) melange_trace_mark((name), (detail)); \
+    } G_STMT_END
+
+#define MELANGE_TRACE_COUNTER(name, value) G_STMT_START { \
+        if (G_UNLIKELY(melange_trace_active)) melange_trace_counter((name), (gint64) (value)); \
+    } G_STMT_END
+
+
+#endif // MELANGE_TRACE_H
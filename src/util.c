@@ -1,5 +1,7 @@
 #include "util.h"
 
+#include <glib/gstdio.h>
+
 
 gboolean
 melange_util_has_dark_background(GtkWidget *widget) {
@@ -10,3 +12,49 @@ melange_util_has_dark_background(GtkWidget *widget) {
     GdkRGBA *bg = g_value_get_boxed(&value);
     return bg->red + bg->green + bg->blue < 1.5;
 }
+
+
+guint64
+melange_util_directory_size(const char *path, GCancellable *cancellable) {
+    GDir *dir = g_dir_open(path, 0, NULL);
+    if (!dir) return 0;
+
+    guint64 size = 0;
+    const char *name;
+    while ((name = g_dir_read_name(dir)) && !g_cancellable_is_cancelled(cancellable)) {
+        char *child = g_build_filename(path, name, NULL);
+        GStatBuf st;
+        if (g_lstat(child, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                size += melange_util_directory_size(child, cancellable);
+            } else if (S_ISREG(st.st_mode)) {
+                size += (guint64) st.st_size;
+            }
+        }
+        g_free(child);
+    }
+    g_dir_close(dir);
+    return size;
+}
+
+
+gboolean
+melange_util_remove_directory(const char *path) {
+    GDir *dir = g_dir_open(path, 0, NULL);
+    if (dir) {
+        const char *name;
+        while ((name = g_dir_read_name(dir))) {
+            char *child = g_build_filename(path, name, NULL);
+            GStatBuf st;
+            // Symlinks are removed, never followed
+            if (g_lstat(child, &st) == 0 && S_ISDIR(st.st_mode)) {
+                melange_util_remove_directory(child);
+            } else {
+                g_remove(child);
+            }
+            g_free(child);
+        }
+        g_dir_close(dir);
+    }
+    return g_rmdir(path) == 0;
+}
@@ -14,5 +14,11 @@ gboolean melange_util_has_dark_background(GtkWidget *widget);
 
 GdkPixbuf *melange_load_resource_pixbuf(MelangeApp *app, const char *file_name);
 
+// Apparent size of all regular files below path, in bytes. Does not follow symlinks.
+guint64 melange_util_directory_size(const char *path, GCancellable *cancellable);
+
+// rm -r, returns FALSE if path could not be removed entirely
+gboolean melange_util_remove_directory(const char *path);
+
 
 #endif //MELANGE_UTIL_H
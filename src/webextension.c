@@ -0,0 +1,24 @@
+// Loaded into every web process. WebKit does not expose web process ids, so each page tells its
+// account view which process renders it. The UI process uses the id to apply resource limits.
+
+#include <webkit2/webkit-web-extension.h>
+#include <unistd.h>
+
+
+static void
+melange_web_extension_page_created(WebKitWebExtension *extension, WebKitWebPage *web_page,
+        gpointer user_data) {
+    (void) extension;
+    (void) user_data;
+
+    WebKitUserMessage *message = webkit_user_message_new("web-process-id",
+            g_variant_new_uint32((guint32) getpid()));
+    webkit_web_page_send_message_to_view(web_page, message, NULL, NULL, NULL);
+}
+
+
+G_MODULE_EXPORT void
+webkit_web_extension_initialize(WebKitWebExtension *extension) {
+    g_signal_connect(extension, "page-created", G_CALLBACK(melange_web_extension_page_created),
+            NULL);
+}